@@ -0,0 +1,133 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "bit_image.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <emmintrin.h>
+#define HAVE_SSE2
+#endif
+
+/******************************************************************************
+  The one bit images behind bit_image.h.
+
+  Packing takes the top bit of each byte, which is set for 128 or more; on
+  x86 SSE2 gathers the top bits of 16 bytes with one instruction. Unpacking
+  looks each byte of bits up in a table of the eight pixels it stands for.
+
+  Compile with the program that uses it.
+******************************************************************************/
+
+int bit_image_create(bit_image_t *image, int width, int height){
+  memset(image, 0, sizeof(*image));
+  image->words = (width + 63) / 64;
+  image->bits = calloc((size_t)image->words * height, sizeof(uint64_t));
+  if(image->bits == NULL) return -1;
+  image->width = width;
+  image->height = height;
+  return 0;
+}
+
+void bit_image_free(bit_image_t *image){
+  free(image->bits);
+  memset(image, 0, sizeof(*image));
+}
+
+static uint64_t pack_word(const unsigned char *p, int n){
+  uint64_t word = 0;
+  int x = 0;
+
+#ifdef HAVE_SSE2
+  for(; x+16<=n; x+=16){
+    __m128i v = _mm_loadu_si128((const __m128i *)(p + x));
+    word |= (uint64_t)(unsigned)_mm_movemask_epi8(v) << x;
+  }
+#endif
+  for(; x<n; x++){
+    word |= (uint64_t)(p[x] >> 7) << x;
+  }
+  return word;
+}
+
+void bit_image_pack_rows(const image_t *in, bit_image_t *out, int first_row,
+                         int end_row){
+  int y, i;
+
+  for(y=first_row; y<end_row; y++){
+    const unsigned char *row = in->pixels + (size_t)y * in->stride;
+    uint64_t *bits = out->bits + (size_t)y * out->words;
+
+    for(i=0; i<out->words; i++){
+      int n = in->width - i * 64;
+      bits[i] = pack_word(row + i * 64, n < 64 ? n : 64);
+    }
+  }
+}
+
+static uint64_t pixels[256];    // The eight pixels of each byte of bits
+static pthread_once_t pixels_made = PTHREAD_ONCE_INIT;
+
+static void make_pixels(void){
+  int b, x;
+
+  for(b=0; b<256; b++){
+    uint64_t p = 0;
+    for(x=0; x<8; x++) if(b & (1 << x)) p |= (uint64_t)255 << (8 * x);
+    pixels[b] = p;
+  }
+}
+
+void bit_image_unpack_rows(const bit_image_t *in, image_t *out,
+                           int first_row, int end_row){
+  int y, x;
+
+  pthread_once(&pixels_made, make_pixels);
+  for(y=first_row; y<end_row; y++){
+    const unsigned char *bytes = (const unsigned char *)
+                                 (in->bits + (size_t)y * in->words);
+    unsigned char *row = out->pixels + (size_t)y * out->stride;
+
+    // Bytes of bits are in pixel order as x86 and most ARMs are little
+    // endian; anything else unpacks a bit at a time
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    for(x=0; x+8<=in->width; x+=8){
+      memcpy(row + x, &pixels[bytes[x / 8]], 8);
+    }
+#else
+    x = 0;
+    (void)bytes;
+#endif
+    for(; x<in->width; x++){
+      const uint64_t *bits = in->bits + (size_t)y * in->words;
+      row[x] = (bits[x / 64] >> (x % 64)) & 1 ? 255 : 0;
+    }
+  }
+}
+
+void bit_detect_edges_rows(const bit_image_t *in, bit_image_t *out,
+                           int first_row, int end_row){
+  int width = in->width, height = in->height, n = in->words;
+  int last = width - 1;
+  int y, i;
+
+  for(y=first_row; y<end_row; y++){
+    const uint64_t *c = in->bits + (size_t)y * n;
+    uint64_t *o = out->bits + (size_t)y * n;
+    uint64_t previous = 0;
+
+    if(y == 0 || y == height - 1 || width < 3){
+      memset(o, 0, n * sizeof(uint64_t));
+      continue;
+    }
+    for(i=0; i<n; i++){
+      uint64_t pixels = c[i], next = i + 1 < n ? c[i + 1] : 0;
+      uint64_t left = pixels << 1 | previous >> 63;
+      uint64_t right = pixels >> 1 | next << 63;
+      o[i] = pixels & ~(left & right & c[i - n] & c[i + n]);
+      previous = pixels;
+    }
+    // The first and last pixels of the row are on the border
+    o[0] &= ~(uint64_t)1;
+    o[last / 64] &= ~((uint64_t)1 << (last % 64));
+  }
+}
@@ -0,0 +1,66 @@
+#ifndef BIT_IMAGE_H
+#define BIT_IMAGE_H
+
+#include <stdint.h>
+#include "image_io.h"
+
+/******************************************************************************
+  Black and white images kept as one bit per pixel, for images that are
+  only ever 0 or 255, such as the output of a colour threshold.
+
+  Pixel x of row y is bit x % 64 of word x / 64 of the row, and each row
+  starts on a new word, the bits past the width being 0. That is an eighth
+  of the memory of image_t, and 64 pixels to a word.
+
+  On such an image the edge test of edge_detect.h, 4 x pixel minus its
+  four neighbours above 0, comes down to "this pixel is set and one of its
+  four neighbours is not". bit_detect_edges_rows() does that a word at a
+  time: the row shifted one bit each way gives the left and right
+  neighbours of all 64 pixels, and the words above and below give the
+  others, so a word of edges is
+    pixels & ~(left & right & above & below)
+  with no compares at all. The pixels on the border of the image are 0, as
+  in edge_detect.h, so the edges are the same, unpacked, as those of
+  detect_edges_rows() on the same image.
+******************************************************************************/
+
+typedef struct bit_image {
+  int width;
+  int height;
+  int words;                 // 64 bit words per row
+  uint64_t *bits;
+} bit_image_t;
+
+/**
+ Makes a width x height image, all 0. Returns 0, or -1 if out of memory.
+*/
+
+int bit_image_create(bit_image_t *image, int width, int height);
+
+void bit_image_free(bit_image_t *image);
+
+/**
+ Packs rows first_row to end_row of in into the same rows of out, a pixel
+ being set if it is 128 or more. out must be the size of in.
+*/
+
+void bit_image_pack_rows(const image_t *in, bit_image_t *out, int first_row,
+                         int end_row);
+
+/**
+ Unpacks rows first_row to end_row of in into out, as 255 and 0.
+*/
+
+void bit_image_unpack_rows(const bit_image_t *in, image_t *out,
+                           int first_row, int end_row);
+
+/**
+ Detects the edges of rows first_row to end_row of in, writing them to the
+ same rows of out. Threads may share an image as long as their rows do
+ not overlap.
+*/
+
+void bit_detect_edges_rows(const bit_image_t *in, bit_image_t *out,
+                           int first_row, int end_row);
+
+#endif
@@ -0,0 +1,455 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "canny.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS
+#endif
+
+/******************************************************************************
+  The Canny edge detector behind canny.h.
+
+  The stages keep what they make in whole images: the blurred image, the
+  gradient sizes in 16 bits (|x| + |y| is at most 2040) and the directions
+  in bytes, numbered
+    0  the gradient is left to right, so the edge runs up and down
+    1  it is down and to the right, or up and to the left
+    2  it is up and down
+    3  it is down and to the left, or up and to the right
+  A gradient is left to right if |y| <= |x| tan 22.5 and up and down if
+  |y| > |x| tan 67.5; tan 22.5 is taken as 27146 / 65536 and tan 67.5 as
+  2 + that, so that AVX2 can do it exactly in 16 bits.
+
+  Suppression writes 0, 1 for a weak pixel or 2 for a strong one into the
+  output image. Hysteresis follows the edges from each strong pixel as it
+  comes to it, while the pixels around are still in the cache, marking
+  every pixel it reaches 3, and at the end 3 becomes 255 and anything else
+  0.
+
+  Compile with the program that uses it, along with convolve.c, -lm and
+  -pthread.
+******************************************************************************/
+
+#define TAN_22_5 27146             // tan 22.5 degrees x 65536
+#define WEAK 1
+#define STRONG 2
+#define EDGE 3                     // A pixel found to be on an edge
+
+const char *canny_stage_names[CANNY_STAGES] = {
+  "blur", "gradient", "suppress", "hysteresis"
+};
+
+typedef struct canny_job {
+  const image_t *in;
+  image_t *out;
+  const convolution_t *blur;
+  int low, high, n_threads;
+  image_t blurred;
+  uint16_t *magnitude;
+  unsigned char *direction;
+
+  pthread_barrier_t barrier;
+  atomic_int found[2];             // Pixels found by each round, in turn
+  atomic_int failed;
+  int rounds;
+  struct timespec marks[CANNY_STAGES + 1];
+} canny_job_t;
+
+typedef struct canny_thread {
+  canny_job_t *job;
+  int index;
+  int first_row, end_row;
+  size_t *stack;                   // Edge pixels still to be followed
+  size_t n_stack, max_stack;
+} canny_thread_t;
+
+typedef void (*gradient_kernel_t)(const unsigned char *row, int stride,
+                                  uint16_t *magnitude,
+                                  unsigned char *direction, int first,
+                                  int end);
+
+static void gradient_scalar(const unsigned char *row, int stride,
+                            uint16_t *magnitude, unsigned char *direction,
+                            int first, int end){
+  int x;
+
+  for(x=first; x<end; x++){
+    const unsigned char *p = row + x;
+    int gx = (p[1 - stride] + 2 * p[1] + p[1 + stride])
+             - (p[-1 - stride] + 2 * p[-1] + p[-1 + stride]);
+    int gy = (p[stride - 1] + 2 * p[stride] + p[stride + 1])
+             - (p[-stride - 1] + 2 * p[-stride] + p[-stride + 1]);
+    int ax = gx < 0 ? -gx : gx, ay = gy < 0 ? -gy : gy;
+    int t = (ax * TAN_22_5) >> 16;
+
+    magnitude[x] = ax + ay;
+    direction[x] = ay <= t ? 0 : ay > 2 * ax + t ? 2 : (gx ^ gy) < 0 ? 3 : 1;
+  }
+}
+
+#ifdef HAVE_X86_KERNELS
+
+__attribute__((target("avx2")))
+static __m256i load16(const unsigned char *p){
+  return _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)p));
+}
+
+__attribute__((target("avx2")))
+static void gradient_avx2(const unsigned char *row, int stride,
+                          uint16_t *magnitude, unsigned char *direction,
+                          int first, int end){
+  const __m256i one = _mm256_set1_epi16(1), two = _mm256_set1_epi16(2);
+  const __m256i tan = _mm256_set1_epi16(TAN_22_5);
+  int x;
+
+  for(x=first; x+16<=end; x+=16){
+    const unsigned char *p = row + x;
+    __m256i ul = load16(p - stride - 1), u = load16(p - stride);
+    __m256i ur = load16(p - stride + 1), l = load16(p - 1);
+    __m256i r = load16(p + 1), dl = load16(p + stride - 1);
+    __m256i d = load16(p + stride), dr = load16(p + stride + 1);
+    __m256i gx, gy, ax, ay, t, not_across, up_down, dir;
+
+    gx = _mm256_sub_epi16(_mm256_add_epi16(_mm256_add_epi16(ur, dr),
+                                           _mm256_slli_epi16(r, 1)),
+                          _mm256_add_epi16(_mm256_add_epi16(ul, dl),
+                                           _mm256_slli_epi16(l, 1)));
+    gy = _mm256_sub_epi16(_mm256_add_epi16(_mm256_add_epi16(dl, dr),
+                                           _mm256_slli_epi16(d, 1)),
+                          _mm256_add_epi16(_mm256_add_epi16(ul, ur),
+                                           _mm256_slli_epi16(u, 1)));
+    ax = _mm256_abs_epi16(gx);
+    ay = _mm256_abs_epi16(gy);
+    t = _mm256_mulhi_epu16(ax, tan);
+    _mm256_storeu_si256((__m256i *)(magnitude + x), _mm256_add_epi16(ax, ay));
+
+    not_across = _mm256_cmpgt_epi16(ay, t);
+    up_down = _mm256_cmpgt_epi16(ay, _mm256_add_epi16(_mm256_slli_epi16(ax, 1),
+                                                      t));
+    // 1, or 3 where the signs differ; then 2 if up and down; then 0 if
+    // left to right
+    dir = _mm256_add_epi16(one, _mm256_and_si256(
+                                    _mm256_srai_epi16(_mm256_xor_si256(gx, gy),
+                                                      15), two));
+    dir = _mm256_blendv_epi8(dir, two, up_down);
+    dir = _mm256_and_si256(dir, not_across);
+    _mm_storeu_si128((__m128i *)(direction + x),
+                     _mm_packus_epi16(_mm256_castsi256_si128(dir),
+                                      _mm256_extracti128_si256(dir, 1)));
+  }
+  gradient_scalar(row, stride, magnitude, direction, x, end);
+}
+
+#endif
+
+static const struct {
+  const char *name;
+  gradient_kernel_t kernel;
+} kernels[] = {
+  {"scalar", gradient_scalar},
+#ifdef HAVE_X86_KERNELS
+  {"avx2", gradient_avx2},
+#endif
+};
+#define N_KERNELS (int)(sizeof(kernels) / sizeof(kernels[0]))
+
+static int kernel_in_use = -1;
+static pthread_once_t kernel_chosen = PTHREAD_ONCE_INIT;
+
+static int kernel_supported(int k){
+#ifdef HAVE_X86_KERNELS
+  __builtin_cpu_init();
+  if(kernels[k].kernel == gradient_avx2) return __builtin_cpu_supports("avx2");
+#endif
+  return 1;
+}
+
+static void choose_kernel(void){
+  int k;
+
+  if(kernel_in_use >= 0) return;   // Already set by canny_use()
+  for(k=N_KERNELS-1; k>0 && !kernel_supported(k); k--);
+  kernel_in_use = k;
+}
+
+int canny_use(const char *name){
+  int k;
+
+  for(k=0; k<N_KERNELS; k++){
+    if(strcmp(kernels[k].name, name) == 0 && kernel_supported(k)){
+      kernel_in_use = k;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+const char *canny_kernel(void){
+  pthread_once(&kernel_chosen, choose_kernel);
+  return kernels[kernel_in_use].name;
+}
+
+static void gradient_rows(canny_job_t *job, int first_row, int end_row){
+  const image_t *b = &job->blurred;
+  int width = b->width, height = b->height;
+  gradient_kernel_t kernel = kernels[kernel_in_use].kernel;
+  int y;
+
+  for(y=first_row; y<end_row; y++){
+    uint16_t *magnitude = job->magnitude + (size_t)y * width;
+    unsigned char *direction = job->direction + (size_t)y * width;
+
+    memset(magnitude, 0, width * sizeof(uint16_t));
+    memset(direction, 0, width);
+    if(y == 0 || y == height - 1 || width < 3) continue;
+    kernel(b->pixels + (size_t)y * b->stride, b->stride, magnitude,
+           direction, 1, width - 1);
+  }
+}
+
+static void suppress_rows(canny_job_t *job, int first_row, int end_row){
+  int width = job->in->width, height = job->in->height;
+  // The pixels either side of one along each direction
+  const long across[4][2] = {
+    {-1, 1}, {-width - 1, width + 1}, {-width, width}, {-width + 1, width - 1}
+  };
+  int x, y;
+
+  for(y=first_row; y<end_row; y++){
+    const uint16_t *magnitude = job->magnitude + (size_t)y * width;
+    const unsigned char *direction = job->direction + (size_t)y * width;
+    unsigned char *out_row = job->out->pixels + (size_t)y * job->out->stride;
+
+    memset(out_row, 0, width);
+    if(y == 0 || y == height - 1) continue;
+    // Worked out without branches, which go either way at random on a
+    // noisy image
+    for(x=1; x<width-1; x++){
+      int m = magnitude[x];
+      const long *side = across[direction[x]];
+      // >= on one side only, so that a ridge two pixels wide keeps one
+      int kept = (m > job->low) & (m > magnitude[x + side[0]]) &
+                 (m >= magnitude[x + side[1]]);
+
+      out_row[x] = kept * (WEAK + (m > job->high));
+    }
+  }
+}
+
+static int push(canny_thread_t *t, size_t at){
+  if(t->n_stack == t->max_stack){
+    size_t max = t->max_stack ? t->max_stack * 2 : 4096;
+    size_t *stack = realloc(t->stack, max * sizeof(size_t));
+    if(stack == NULL){
+      atomic_store(&t->job->failed, 1);
+      return -1;
+    }
+    t->stack = stack;
+    t->max_stack = max;
+  }
+  t->stack[t->n_stack++] = at;
+  return 0;
+}
+
+/**
+ Follows the edges on the stack through the weak pixels of the band.
+*/
+
+static void follow(canny_thread_t *t){
+  image_t *out = t->job->out;
+  unsigned char *pixels = out->pixels;
+  long stride = out->stride;
+  size_t band_start = (size_t)t->first_row * stride;
+  size_t band_end = (size_t)t->end_row * stride;
+  int dx, dy;
+
+  // Only pixels off the border are ever on the stack, so the pixels around
+  // one are in the band if their place in the image is
+  while(t->n_stack > 0){
+    size_t at = t->stack[--t->n_stack];
+
+    for(dy=-1; dy<=1; dy++){
+      for(dx=-1; dx<=1; dx++){
+        size_t next = at + dy * stride + dx;
+        if(next >= band_start && next < band_end && pixels[next] == WEAK){
+          pixels[next] = EDGE;
+          if(push(t, next) != 0) return;
+        }
+      }
+    }
+  }
+}
+
+/**
+ Pushes the weak pixels of row y that touch an edge in row y + dy, outside
+ the band, and returns how many.
+*/
+
+static int look_across(canny_thread_t *t, int y, int dy){
+  image_t *out = t->job->out;
+  const unsigned char *row = out->pixels + (size_t)y * out->stride;
+  const unsigned char *other = row + dy * (long)out->stride;
+  int x, found = 0;
+
+  for(x=1; x<out->width-1; x++){
+    if(row[x] == WEAK && (other[x - 1] == EDGE || other[x] == EDGE ||
+                          other[x + 1] == EDGE)){
+      if(push(t, (size_t)y * out->stride + x) != 0) break;
+      found++;
+    }
+  }
+  return found;
+}
+
+static void hysteresis(canny_thread_t *t){
+  canny_job_t *job = t->job;
+  image_t *out = job->out;
+  int first = t->first_row, end = t->end_row;
+  int x, y, round;
+  size_t i, kept;
+
+  for(y=first; y<end; y++){
+    unsigned char *row = out->pixels + (size_t)y * out->stride;
+    unsigned char *p = row, *row_end = row + out->width;
+
+    while((p = memchr(p, STRONG, row_end - p)) != NULL){
+      *p = EDGE;
+      if(push(t, (size_t)y * out->stride + (p - row)) != 0) break;
+      follow(t);
+    }
+  }
+
+  // Each round reads only rows no one is writing, then writes only its
+  // own band
+  for(round=0; ; round++){
+    int found = 0;
+
+    pthread_barrier_wait(&job->barrier);
+    if(first < end && first > 0) found += look_across(t, first, -1);
+    if(first < end && end < out->height) found += look_across(t, end - 1, 1);
+    atomic_fetch_add(&job->found[round % 2], found);
+
+    pthread_barrier_wait(&job->barrier);
+    if(atomic_load(&job->found[round % 2]) == 0 ||
+       atomic_load(&job->failed)){
+      break;
+    }
+    if(t->index == 0){
+      atomic_store(&job->found[(round + 1) % 2], 0);
+      job->rounds = round + 1;
+    }
+    for(i=0, kept=0; i<t->n_stack; i++){
+      if(out->pixels[t->stack[i]] == WEAK){
+        out->pixels[t->stack[i]] = EDGE;
+        t->stack[kept++] = t->stack[i];
+      }
+    }
+    t->n_stack = kept;
+    follow(t);
+  }
+
+  for(y=first; y<end; y++){
+    unsigned char *row = out->pixels + (size_t)y * out->stride;
+    for(x=0; x<out->width; x++) row[x] = row[x] == EDGE ? 255 : 0;
+  }
+}
+
+static void stage_done(canny_thread_t *t, int stage){
+  pthread_barrier_wait(&t->job->barrier);
+  if(t->index == 0) clock_gettime(CLOCK_MONOTONIC, &t->job->marks[stage]);
+}
+
+static void *canny_thread(void *arg){
+  canny_thread_t *t = arg;
+  canny_job_t *job = t->job;
+  int first = t->first_row, end = t->end_row;
+
+  stage_done(t, 0);
+  if(job->blur != NULL &&
+     convolve_rows(job->in, &job->blurred, job->blur, first, end) != 0){
+    atomic_store(&job->failed, 1);
+  }
+  stage_done(t, 1);
+  gradient_rows(job, first, end);
+  stage_done(t, 2);
+  suppress_rows(job, first, end);
+  stage_done(t, 3);
+  hysteresis(t);
+  stage_done(t, 4);
+  return NULL;
+}
+
+static long long nanoseconds(const struct timespec *start,
+                             const struct timespec *finish){
+  return (finish->tv_sec - start->tv_sec) * 1000000000LL +
+         (finish->tv_nsec - start->tv_nsec);
+}
+
+int canny(const image_t *in, image_t *out, const convolution_t *blur,
+          int low, int high, int n_threads, canny_times_t *times){
+  canny_job_t job;
+  canny_thread_t *threads;
+  pthread_t *ids;
+  size_t n = (size_t)in->width * in->height;
+  int i, failed;
+
+  pthread_once(&kernel_chosen, choose_kernel);
+  if(n_threads < 1) n_threads = 1;
+  memset(&job, 0, sizeof(job));
+  job.in = in;
+  job.out = out;
+  job.blur = blur;
+  job.low = low;
+  job.high = high;
+  job.n_threads = n_threads;
+  if(blur == NULL){
+    job.blurred = *in;
+  } else if(image_create(&job.blurred, in->width, in->height) != 0){
+    return -1;
+  }
+  job.magnitude = malloc(n * sizeof(uint16_t));
+  job.direction = malloc(n);
+  threads = calloc(n_threads, sizeof(canny_thread_t));
+  ids = malloc(n_threads * sizeof(pthread_t));
+  failed = job.magnitude == NULL || job.direction == NULL ||
+           threads == NULL || ids == NULL;
+
+  if(!failed){
+    pthread_barrier_init(&job.barrier, NULL, n_threads);
+    for(i=0; i<n_threads; i++){
+      threads[i].job = &job;
+      threads[i].index = i;
+      threads[i].first_row = (long)in->height * i / n_threads;
+      threads[i].end_row = (long)in->height * (i + 1) / n_threads;
+      if(i > 0) pthread_create(&ids[i], NULL, canny_thread, &threads[i]);
+    }
+    canny_thread(&threads[0]);
+    for(i=1; i<n_threads; i++){
+      pthread_join(ids[i], NULL);
+    }
+    pthread_barrier_destroy(&job.barrier);
+    failed = atomic_load(&job.failed);
+
+    if(times != NULL){
+      for(i=0; i<CANNY_STAGES; i++){
+        times->stage[i] = nanoseconds(&job.marks[i], &job.marks[i + 1]);
+      }
+      times->rounds = job.rounds;
+    }
+  }
+
+  for(i=0; threads != NULL && i<n_threads; i++){
+    free(threads[i].stack);
+  }
+  free(threads);
+  free(ids);
+  free(job.magnitude);
+  free(job.direction);
+  if(blur != NULL) image_free(&job.blurred);
+  return failed ? -1 : 0;
+}
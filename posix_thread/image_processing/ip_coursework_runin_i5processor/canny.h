@@ -0,0 +1,65 @@
+#ifndef CANNY_H
+#define CANNY_H
+
+#include "image_io.h"
+#include "convolve.h"
+
+/******************************************************************************
+  The Canny edge detector, which gives edges one pixel wide that follow
+  the outlines of things, rather than the thick edges of edge_detect.h.
+
+  It has four stages, each shared between the threads by bands of rows,
+  with every thread waiting for the others at the end of each stage:
+    blur         the image is smoothed with a kernel of convolve.h,
+                 gaussian5 unless another is given, to keep noise from
+                 being taken for edges
+    gradient     the Sobel x and y sums of each pixel are made, and from
+                 them, in the same loop, the size of the gradient,
+                 |x| + |y|, and its direction, to the nearest 45 degrees
+    suppress     a pixel is kept only if its gradient is larger than those
+                 of the two pixels either side of it in the direction of
+                 the gradient, so that an edge is thinned to one pixel. A
+                 pixel kept is strong if its gradient is above high, weak
+                 if above low, otherwise it is dropped
+    hysteresis   every strong pixel is an edge, and so is every weak one
+                 joined to an edge by the 8 pixels around it
+  Hysteresis is where the threads meet: an edge may cross from one band to
+  another. Each thread follows the edges from the strong pixels of its own
+  band as far as they go within it. The threads then look at the rows just
+  outside their bands for edges that reach a weak pixel of theirs, and
+  follow those in turn, until a round finds none. Most edges cross a few
+  bands at most, so a few rounds do.
+
+  The gradient loop is done 16 pixels at a time with AVX2 where the
+  processor has it, giving the same gradients as the plain C loop.
+******************************************************************************/
+
+#define CANNY_STAGES 4
+
+typedef struct canny_times {
+  long long stage[CANNY_STAGES];       // Nanoseconds, in the order above
+  int rounds;                          // Rounds of hysteresis between bands
+} canny_times_t;
+
+extern const char *canny_stage_names[CANNY_STAGES];
+
+/**
+ Finds the edges of in, writing 255 for an edge and 0 otherwise to out, on
+ n_threads threads. blur may be NULL for none; times may be NULL. Returns
+ 0, or -1 if out of memory.
+*/
+
+int canny(const image_t *in, image_t *out, const convolution_t *blur,
+          int low, int high, int n_threads, canny_times_t *times);
+
+/**
+ Chooses the gradient loop: "scalar" or "avx2". Returns -1 if there is no
+ such loop or the processor cannot run it. By default the fastest one the
+ processor can run is used.
+*/
+
+int canny_use(const char *name);
+
+const char *canny_kernel(void);
+
+#endif
@@ -0,0 +1,484 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "convolve.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS
+#endif
+
+/******************************************************************************
+  The convolution engine behind convolve.h.
+
+  Compile with the program that uses it, and -lm.
+******************************************************************************/
+
+static const struct {
+  const char *name;
+  int size;
+  int weights[25];
+  int divisor;
+  int mode;
+} named[] = {
+  {"laplacian4", 3, { 0,-1, 0, -1, 4,-1,  0,-1, 0}, 1, CONVOLVE_POSITIVE},
+  {"laplacian8", 3, {-1,-1,-1, -1, 8,-1, -1,-1,-1}, 1, CONVOLVE_POSITIVE},
+  {"sobel_x",    3, {-1, 0, 1, -2, 0, 2, -1, 0, 1}, 1, CONVOLVE_ABS},
+  {"sobel_y",    3, {-1,-2,-1,  0, 0, 0,  1, 2, 1}, 1, CONVOLVE_ABS},
+  {"prewitt_x",  3, {-1, 0, 1, -1, 0, 1, -1, 0, 1}, 1, CONVOLVE_ABS},
+  {"prewitt_y",  3, {-1,-1,-1,  0, 0, 0,  1, 1, 1}, 1, CONVOLVE_ABS},
+  {"scharr_x",   3, {-3, 0, 3,-10, 0,10, -3, 0, 3}, 1, CONVOLVE_ABS},
+  {"scharr_y",   3, {-3,-10,-3, 0, 0, 0,  3,10, 3}, 1, CONVOLVE_ABS},
+  {"gaussian3",  3, { 1, 2, 1,  2, 4, 2,  1, 2, 1}, 16, CONVOLVE_CLAMP},
+  {"gaussian5",  5, { 1, 4, 6, 4, 1,  4,16,24,16, 4,  6,24,36,24, 6,
+                      4,16,24,16, 4,  1, 4, 6, 4, 1}, 256, CONVOLVE_CLAMP},
+  {"box3",       3, { 1, 1, 1,  1, 1, 1,  1, 1, 1}, 9, CONVOLVE_CLAMP},
+  {"sharpen",    3, { 0,-1, 0, -1, 5,-1,  0,-1, 0}, 1, CONVOLVE_CLAMP},
+};
+#define N_NAMED (int)(sizeof(named) / sizeof(named[0]))
+
+static const char *mode_names[] = {"clamp", "abs", "positive"};
+
+static int gcd(int a, int b){
+  if(a < 0) a = -a;
+  if(b < 0) b = -b;
+  while(b != 0){
+    int t = a % b;
+    a = b;
+    b = t;
+  }
+  return a;
+}
+
+/**
+ Looks for a column and a row whose product is the kernel, in whole
+ numbers if it has them and otherwise in floats.
+*/
+
+static void find_factors(convolution_t *c){
+  int n = c->size, i, j, p = 0, q = 0;
+  float largest = 0;
+
+  for(i=0; i<n; i++){
+    for(j=0; j<n; j++){
+      if(fabsf(c->weights[i * n + j]) > largest){
+        largest = fabsf(c->weights[i * n + j]);
+        p = i;
+        q = j;
+      }
+    }
+  }
+  c->separable = 0;
+  if(largest == 0) return;
+
+  if(c->integer){
+    int pivot = c->iweights[p * n + q], g = 0;
+
+    // Rank one: every weight times the pivot is its column times its row
+    for(i=0; i<n; i++){
+      for(j=0; j<n; j++){
+        if((long)c->iweights[i * n + j] * pivot !=
+           (long)c->iweights[i * n + q] * c->iweights[p * n + j]) return;
+      }
+    }
+    for(i=0; i<n; i++) g = gcd(g, c->iweights[i * n + q]);
+    if(pivot < 0) g = -g;
+    for(j=0; j<n; j++){
+      if((long)c->iweights[p * n + j] * g % pivot != 0) return;
+    }
+    for(i=0; i<n; i++) c->icolumn[i] = c->iweights[i * n + q] / g;
+    for(j=0; j<n; j++){
+      c->irow[j] = (long)c->iweights[p * n + j] * g / pivot;
+    }
+    c->separable = 1;
+  } else {
+    float pivot = c->weights[p * n + q];
+
+    for(i=0; i<n; i++){
+      for(j=0; j<n; j++){
+        float product = c->weights[i * n + q] * c->weights[p * n + j] / pivot;
+        if(fabsf(product - c->weights[i * n + j]) > 1e-6f * largest) return;
+      }
+    }
+    for(i=0; i<n; i++) c->column[i] = c->weights[i * n + q];
+    for(j=0; j<n; j++) c->row[j] = c->weights[p * n + j] / pivot;
+    c->separable = 1;
+  }
+}
+
+static void prepare(convolution_t *c){
+  int n = c->size * c->size, i, sum = 0, negative = 0;
+
+  c->integer = c->divisor == rintf(c->divisor) && c->divisor >= 1;
+  for(i=0; i<n; i++){
+    if(c->weights[i] != rintf(c->weights[i]) ||
+       fabsf(c->weights[i]) > 32767) c->integer = 0;
+  }
+  if(c->integer){
+    for(i=0; i<n; i++){
+      c->iweights[i] = c->weights[i];
+      sum += abs(c->iweights[i]);
+      negative |= c->iweights[i] < 0;
+    }
+    c->idivisor = c->divisor;
+  }
+  find_factors(c);
+
+  c->simd = 0;
+#ifdef HAVE_X86_KERNELS
+  __builtin_cpu_init();
+  if(c->integer && (c->size == 3 || c->size == 5) &&
+     (c->idivisor & (c->idivisor - 1)) == 0 &&
+     __builtin_cpu_supports("avx2")){
+    long top = 255L * sum + c->idivisor / 2;
+
+    for(c->shift=0; (1 << c->shift) < c->idivisor; c->shift++);
+    c->unsigned_sum = !negative;
+    // Every partial sum must fit in 16 bits, and the result must still be
+    // positive when read as signed for the pack at the end
+    if(negative ? top <= 32767 : top <= 65535 && (top >> c->shift) <= 32767){
+      c->simd = c->size;
+    }
+  }
+#endif
+}
+
+int convolution_parse(const char *spec, convolution_t *c){
+  const char *p;
+  char *end;
+  int i, n;
+
+  memset(c, 0, sizeof(*c));
+  for(i=0; i<N_NAMED; i++){
+    if(strcmp(spec, named[i].name) == 0){
+      snprintf(c->name, sizeof(c->name), "%s", named[i].name);
+      c->size = named[i].size;
+      for(n=0; n<c->size * c->size; n++) c->weights[n] = named[i].weights[n];
+      c->divisor = named[i].divisor;
+      c->mode = named[i].mode;
+      prepare(c);
+      return 0;
+    }
+  }
+
+  c->size = strtol(spec, &end, 10);
+  if(*end != ':' || c->size < 1 || c->size > KERNEL_MAX || c->size % 2 == 0){
+    fprintf(stderr, "%s: not a kernel name or size:weights[/divisor]"
+            "[:mode] with an odd size up to %d\n", spec, KERNEL_MAX);
+    return -1;
+  }
+  snprintf(c->name, sizeof(c->name), "custom");
+  p = end + 1;
+  for(n=0; n<c->size * c->size; n++){
+    c->weights[n] = strtod(p, &end);
+    if(end == p){
+      fprintf(stderr, "%s: needs %d weights\n", spec, c->size * c->size);
+      return -1;
+    }
+    p = *end == ',' ? end + 1 : end;
+  }
+  c->divisor = 1;
+  if(*p == '/'){
+    c->divisor = strtod(p + 1, &end);
+    p = end;
+    if(c->divisor <= 0){
+      fprintf(stderr, "%s: the divisor must be above 0\n", spec);
+      return -1;
+    }
+  }
+  c->mode = CONVOLVE_CLAMP;
+  if(*p == ':'){
+    for(i=0; i<3 && strcmp(p + 1, mode_names[i]) != 0; i++);
+    if(i == 3){
+      fprintf(stderr, "%s: the mode is clamp, abs or positive\n", spec);
+      return -1;
+    }
+    c->mode = i;
+  } else if(*p != '\0'){
+    fprintf(stderr, "%s: unexpected \"%s\"\n", spec, p);
+    return -1;
+  }
+  prepare(c);
+  return 0;
+}
+
+void convolution_describe(const convolution_t *c, char *text, size_t size){
+  snprintf(text, size, "%s %dx%d %s%s%s, %s", c->name, c->size, c->size,
+           c->integer ? "integer" : "float",
+           c->separable ? ", separable" : "",
+           c->simd ? ", avx2" : "", mode_names[c->mode]);
+}
+
+static int floor_divide(int a, int b){
+  return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+static inline unsigned char finish_int(int sum, const convolution_t *c){
+  int v = c->idivisor == 1 ? sum
+                           : floor_divide(sum + c->idivisor / 2, c->idivisor);
+
+  switch(c->mode){
+    case CONVOLVE_POSITIVE: return v > 0 ? 255 : 0;
+    case CONVOLVE_ABS: if(v < 0) v = -v; break;
+  }
+  return v < 0 ? 0 : v > 255 ? 255 : v;
+}
+
+static inline unsigned char finish_float(float sum, const convolution_t *c){
+  float v = sum / c->divisor;
+
+  switch(c->mode){
+    case CONVOLVE_POSITIVE: return v > 0 ? 255 : 0;
+    case CONVOLVE_ABS: v = fabsf(v); break;
+  }
+  v = rintf(v);
+  return v < 0 ? 0 : v > 255 ? 255 : v;
+}
+
+/**
+ A pixel where the kernel does not fit across the row. rows are the rows
+ from r above to r below, already limited to the image.
+*/
+
+static unsigned char edge_pixel(const unsigned char *const *rows, int width,
+                                const convolution_t *c, int x){
+  int r = c->size / 2, i, j, isum = 0;
+  float fsum = 0;
+
+  for(i=0; i<c->size; i++){
+    for(j=0; j<c->size; j++){
+      int xx = x + j - r;
+      xx = xx < 0 ? 0 : xx >= width ? width - 1 : xx;
+      if(c->integer){
+        isum += c->iweights[i * c->size + j] * rows[i][xx];
+      } else {
+        fsum += c->weights[i * c->size + j] * rows[i][xx];
+      }
+    }
+  }
+  return c->integer ? finish_int(isum, c) : finish_float(fsum, c);
+}
+
+/**
+ The first and last r pixels of a row, where the kernel does not fit.
+*/
+
+static void edge_columns(const unsigned char *const *rows,
+                         unsigned char *out_row, int width,
+                         const convolution_t *c){
+  int r = c->size / 2, x;
+
+  if(c->mode == CONVOLVE_POSITIVE){
+    memset(out_row, 0, r);
+    memset(out_row + width - r, 0, r);
+    return;
+  }
+  for(x=0; x<r; x++) out_row[x] = edge_pixel(rows, width, c, x);
+  for(x=width-r; x<width; x++) out_row[x] = edge_pixel(rows, width, c, x);
+}
+
+static void direct_row(const unsigned char *const *rows,
+                       unsigned char *out_row, const convolution_t *c,
+                       int first, int end){
+  int r = c->size / 2, x, i, j;
+
+  for(x=first; x<end; x++){
+    if(c->integer){
+      int sum = 0;
+      for(i=0; i<c->size; i++){
+        const unsigned char *p = rows[i] + x - r;
+        for(j=0; j<c->size; j++) sum += c->iweights[i * c->size + j] * p[j];
+      }
+      out_row[x] = finish_int(sum, c);
+    } else {
+      float sum = 0;
+      for(i=0; i<c->size; i++){
+        const unsigned char *p = rows[i] + x - r;
+        for(j=0; j<c->size; j++) sum += c->weights[i * c->size + j] * p[j];
+      }
+      out_row[x] = finish_float(sum, c);
+    }
+  }
+}
+
+#ifdef HAVE_X86_KERNELS
+
+// size is a constant in each caller, so the loops over the kernel unroll
+
+__attribute__((target("avx2"), always_inline))
+static inline void simd_row(const unsigned char *const *rows,
+                            unsigned char *out_row, const convolution_t *c,
+                            int first, int end, int size){
+  const int r = size / 2;
+  const __m256i zero = _mm256_setzero_si256();
+  const __m128i shift = _mm_cvtsi32_si128(c->shift);
+  __m256i w[25];
+  int x, i, j;
+
+  for(i=0; i<size * size; i++) w[i] = _mm256_set1_epi16(c->iweights[i]);
+
+  for(x=first; x+16<=end; x+=16){
+    __m256i sum = _mm256_set1_epi16(c->idivisor / 2);
+    __m256i packed;
+
+    for(i=0; i<size; i++){
+      const unsigned char *p = rows[i] + x - r;
+      for(j=0; j<size; j++){
+        __m256i pixels;
+        if(c->iweights[i * size + j] == 0) continue;
+        pixels = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(p + j)));
+        sum = _mm256_add_epi16(sum,
+                               _mm256_mullo_epi16(pixels, w[i * size + j]));
+      }
+    }
+    sum = c->unsigned_sum ? _mm256_srl_epi16(sum, shift)
+                          : _mm256_sra_epi16(sum, shift);
+    if(c->mode == CONVOLVE_POSITIVE){
+      sum = _mm256_cmpgt_epi16(sum, zero);
+      packed = _mm256_packs_epi16(sum, sum);
+    } else {
+      if(c->mode == CONVOLVE_ABS) sum = _mm256_abs_epi16(sum);
+      packed = _mm256_packus_epi16(sum, sum);
+    }
+    // The pack works within 128 bit lanes; bring the two halves together
+    packed = _mm256_permute4x64_epi64(packed, 0xd8);
+    _mm_storeu_si128((__m128i *)(out_row + x), _mm256_castsi256_si128(packed));
+  }
+  direct_row(rows, out_row, c, x, end);
+}
+
+__attribute__((target("avx2")))
+static void simd_row3(const unsigned char *const *rows,
+                      unsigned char *out_row, const convolution_t *c,
+                      int first, int end){
+  simd_row(rows, out_row, c, first, end, 3);
+}
+
+__attribute__((target("avx2")))
+static void simd_row5(const unsigned char *const *rows,
+                      unsigned char *out_row, const convolution_t *c,
+                      int first, int end){
+  simd_row(rows, out_row, c, first, end, 5);
+}
+
+#endif
+
+/**
+ Rows y0 to y1 and columns r to width - r, where the kernel fits, in two
+ passes: along the rows into a buffer, then down the columns.
+*/
+
+static int separable_rows(const image_t *in, image_t *out,
+                          const convolution_t *c, int y0, int y1){
+  int r = c->size / 2, n = c->size;
+  int columns = in->width - 2 * r, rows = y1 - y0 + 2 * r;
+  int x, y, i;
+
+  if(c->integer){
+    int *across = malloc(sizeof(int) * columns * rows);
+    if(across == NULL) return -1;
+    for(y=0; y<rows; y++){
+      const unsigned char *p = in->pixels + (size_t)(y0 - r + y) * in->stride;
+      int *a = across + (size_t)y * columns;
+      for(x=0; x<columns; x++){
+        int sum = 0;
+        for(i=0; i<n; i++) sum += c->irow[i] * p[x + i];
+        a[x] = sum;
+      }
+    }
+    for(y=y0; y<y1; y++){
+      unsigned char *out_row = out->pixels + (size_t)y * out->stride + r;
+      const int *a = across + (size_t)(y - y0) * columns;
+      for(x=0; x<columns; x++){
+        int sum = 0;
+        for(i=0; i<n; i++) sum += c->icolumn[i] * a[(size_t)i * columns + x];
+        out_row[x] = finish_int(sum, c);
+      }
+    }
+    free(across);
+  } else {
+    float *across = malloc(sizeof(float) * columns * rows);
+    if(across == NULL) return -1;
+    for(y=0; y<rows; y++){
+      const unsigned char *p = in->pixels + (size_t)(y0 - r + y) * in->stride;
+      float *a = across + (size_t)y * columns;
+      for(x=0; x<columns; x++){
+        float sum = 0;
+        for(i=0; i<n; i++) sum += c->row[i] * p[x + i];
+        a[x] = sum;
+      }
+    }
+    for(y=y0; y<y1; y++){
+      unsigned char *out_row = out->pixels + (size_t)y * out->stride + r;
+      const float *a = across + (size_t)(y - y0) * columns;
+      for(x=0; x<columns; x++){
+        float sum = 0;
+        for(i=0; i<n; i++) sum += c->column[i] * a[(size_t)i * columns + x];
+        out_row[x] = finish_float(sum, c);
+      }
+    }
+    free(across);
+  }
+  return 0;
+}
+
+void convolve_line(const unsigned char *const *rows, unsigned char *out_row,
+                   int width, int y, int height, const convolution_t *c){
+  int r = c->size / 2, x1 = width - r, x;
+
+  if(c->mode == CONVOLVE_POSITIVE && (y < r || y >= height - r || x1 <= r)){
+    memset(out_row, 0, width);
+    return;
+  }
+  if(x1 <= r){
+    for(x=0; x<width; x++) out_row[x] = edge_pixel(rows, width, c, x);
+    return;
+  }
+  edge_columns(rows, out_row, width, c);
+#ifdef HAVE_X86_KERNELS
+  if(c->simd == 3){
+    simd_row3(rows, out_row, c, r, x1);
+    return;
+  }
+  if(c->simd == 5){
+    simd_row5(rows, out_row, c, r, x1);
+    return;
+  }
+#endif
+  direct_row(rows, out_row, c, r, x1);
+}
+
+int convolve_rows(const image_t *in, image_t *out, const convolution_t *c,
+                  int first_row, int end_row){
+  int r = c->size / 2, width = in->width, height = in->height;
+  // The rows where the kernel fits inside the image
+  int y0 = first_row > r ? first_row : r;
+  int y1 = end_row < height - r ? end_row : height - r;
+  const unsigned char *rows[KERNEL_MAX];
+  int i, y;
+
+  // A separable kernel does the rows where it fits in two passes, below
+  if(!c->separable || c->simd || width - r <= r) y1 = y0;
+
+  for(y=first_row; y<end_row; y++){
+    if(y >= y0 && y < y1) continue;
+    for(i=0; i<c->size; i++){
+      int yy = y + i - r;
+      yy = yy < 0 ? 0 : yy >= height ? height - 1 : yy;
+      rows[i] = in->pixels + (size_t)yy * in->stride;
+    }
+    convolve_line(rows, out->pixels + (size_t)y * out->stride, width, y,
+                  height, c);
+  }
+  if(y1 > y0){
+    if(separable_rows(in, out, c, y0, y1) != 0) return -1;
+    for(y=y0; y<y1; y++){
+      for(i=0; i<c->size; i++){
+        rows[i] = in->pixels + (size_t)(y + i - r) * in->stride;
+      }
+      edge_columns(rows, out->pixels + (size_t)y * out->stride, width, c);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,96 @@
+#ifndef CONVOLVE_H
+#define CONVOLVE_H
+
+#include <stddef.h>
+#include "image_io.h"
+
+/******************************************************************************
+  Convolution of a grey scale image with any square kernel of odd size up
+  to KERNEL_MAX, for the operators that edge_detect.h does not do.
+
+  A kernel is given by name:
+    laplacian4 laplacian8 sobel_x sobel_y prewitt_x prewitt_y scharr_x
+    scharr_y gaussian3 gaussian5 box3 sharpen
+  or written out as size:weights[/divisor][:mode], the weights row by row:
+    3:1,2,1,2,4,2,1,2,1/16
+    5:0.0030,0.0133,0.0219,0.0133,0.0030,...:clamp
+
+  The sum of the weights times the pixels is divided by the divisor and
+  then turned into a pixel by the mode:
+    clamp      limited to 0..255 (blurs and sharpening)
+    abs        the size, limited to 255 (one direction of a gradient)
+    positive   255 if above 0, else 0 (the test of detect_edges)
+
+  A pixel too close to the border for the kernel to fit is 0 when the mode
+  is positive, as in detect_edges, and otherwise is worked out as if the
+  border pixels carried on outside the image.
+
+  How the sum is done is chosen when the kernel is made:
+    - Whole number weights are summed in integers, exactly; anything else
+      is summed in floats.
+    - A kernel that is a column times a row (Sobel, Gaussian, box ...) is
+      done as two passes of size weights each rather than one of size x
+      size.
+    - On x86 with AVX2, 3x3 and 5x5 whole number kernels whose sums fit in
+      16 bits, and whose divisor is a power of two, are done 16 pixels at a
+      time. They give the same pixels as the integer code.
+******************************************************************************/
+
+#define KERNEL_MAX 15
+
+enum { CONVOLVE_CLAMP, CONVOLVE_ABS, CONVOLVE_POSITIVE };
+
+typedef struct convolution {
+  char name[32];
+  int size;
+  float weights[KERNEL_MAX * KERNEL_MAX];
+  float divisor;
+  int mode;
+
+  // Filled in by convolution_parse()
+  int integer;               // Weights and divisor are whole numbers
+  int separable;             // weights = column x row
+  int simd;                  // 3 or 5 if an AVX2 path is used, else 0
+  int iweights[KERNEL_MAX * KERNEL_MAX];
+  int idivisor;
+  int icolumn[KERNEL_MAX], irow[KERNEL_MAX];
+  float column[KERNEL_MAX], row[KERNEL_MAX];
+  int shift;                 // log2 of idivisor, for the AVX2 paths
+  int unsigned_sum;          // No negative weights, so sums may use 16 bits
+} convolution_t;
+
+/**
+ Makes a kernel from a name or a written out kernel, as above. Returns 0,
+ or -1 with a message on stderr.
+*/
+
+int convolution_parse(const char *spec, convolution_t *c);
+
+/**
+ Describes how the kernel will be applied, e.g.
+ "sobel_x 3x3 integer, separable, avx2".
+*/
+
+void convolution_describe(const convolution_t *c, char *text, size_t size);
+
+/**
+ Convolves rows first_row up to, but not including, end_row of in into the
+ same rows of out. Threads may share an image as long as their rows do
+ not overlap. Returns 0, or -1 if out of memory, when the rows of out are
+ not all written.
+*/
+
+int convolve_rows(const image_t *in, image_t *out, const convolution_t *c,
+                  int first_row, int end_row);
+
+/**
+ Convolves row y of an image of width x height pixels whose rows y - r to
+ y + r, r being size / 2, are rows[0] to rows[size - 1]. Rows above the
+ top or below the bottom of the image should be given as the top or
+ bottom row. For programs that keep only a few rows of an image at once.
+*/
+
+void convolve_line(const unsigned char *const *rows, unsigned char *out_row,
+                   int width, int y, int height, const convolution_t *c);
+
+#endif
@@ -0,0 +1,419 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include "image_io.h"
+#include "edge_detect.h"
+#include "convolve.h"
+#include "pipeline.h"
+
+/******************************************************************************
+  Detects the edges of many images with no display, writing each result as
+  a binary PGM file of the same name in the output directory. Two images
+  of the same name, or an output that would overwrite an image, stop the
+  run before it starts.
+
+  The images can be given as files, as directories (every .pgm and .ppm in
+  them is used) or as a list of file names, one per line, with -l ("-l -"
+  reads the list from stdin):
+    ./edge_batch -o edges frames/
+    ./edge_batch -o edges -l todo.txt
+
+  Every thread takes the next image from the list, loads it, detects its
+  edges and writes them out, so one thread's reading or writing overlaps
+  with the others' detecting. Most images are small, so a whole image is
+  the unit of work: there is no synchronisation inside one, and throughput
+  grows with the number of cores. As a thread takes an image it also asks
+  the kernel to start reading the one that will be taken a thread count
+  later, so that it is usually in memory by the time it is needed.
+
+  With -K kernel the image is convolved with that kernel instead, e.g.
+  -K sobel_x or -K 3:1,2,1,2,4,2,1,2,1/16 (see convolve.h). With -p the
+  image goes through a pipeline of stages, fused into one pass, e.g.
+  -p "threshold:128|gaussian3|edges|dilate" (see pipeline.h); -u runs the
+  same stages one after the other instead, for comparison. Either way the
+  memory traffic of the two is reported.
+
+  Other options: -t threads (default all online cores).
+
+  At the end the number of images per second and of millions of pixels
+  (MPix) per second are printed.
+
+  Compile with:
+    cc -O2 -o edge_batch edge_batch.c edge_detect.c convolve.c pipeline.c image_io.c -lm -pthread
+******************************************************************************/
+
+#define MAX_THREADS 256
+
+char **files;
+char **outputs;              // The output of each file, see plan_outputs()
+int n_files, max_files;
+const char *output_directory = "edges";
+int n_threads;
+convolution_t kernel;
+int use_kernel;
+pipeline_t pipeline;
+int use_pipeline, unfused;
+atomic_llong traffic_fused, traffic_unfused;
+
+atomic_int next_file;
+atomic_llong pixels_done;
+atomic_llong bytes_read;
+atomic_int images_done;
+atomic_int images_failed;
+
+void add_file(const char *name){
+  if(n_files == max_files){
+    max_files = max_files ? max_files * 2 : 256;
+    files = realloc(files, max_files * sizeof(char *));
+    if(files == NULL){
+      fprintf(stderr, "out of memory\n");
+      exit(1);
+    }
+  }
+  files[n_files++] = strdup(name);
+}
+
+int has_image_suffix(const char *name){
+  const char *dot = strrchr(name, '.');
+  return dot != NULL && (strcmp(dot, ".pgm") == 0 || strcmp(dot, ".ppm") == 0);
+}
+
+int compare_names(const void *a, const void *b){
+  return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/**
+ Adds every .pgm and .ppm file in a directory, in name order.
+*/
+
+void add_directory(const char *directory){
+  DIR *dir = opendir(directory);
+  struct dirent *entry;
+  int first = n_files;
+  char path[4096];
+
+  if(dir == NULL){
+    perror(directory);
+    exit(1);
+  }
+  while((entry = readdir(dir)) != NULL){
+    if(has_image_suffix(entry->d_name)){
+      snprintf(path, sizeof(path), "%s/%s", directory, entry->d_name);
+      add_file(path);
+    }
+  }
+  closedir(dir);
+  qsort(files + first, n_files - first, sizeof(char *), compare_names);
+}
+
+void add_list(const char *list){
+  FILE *fp = strcmp(list, "-") == 0 ? stdin : fopen(list, "r");
+  char line[4096];
+
+  if(fp == NULL){
+    perror(list);
+    exit(1);
+  }
+  while(fgets(line, sizeof(line), fp) != NULL){
+    line[strcspn(line, "\r\n")] = '\0';
+    if(line[0] != '\0') add_file(line);
+  }
+  if(fp != stdin) fclose(fp);
+}
+
+void add_argument(const char *name){
+  struct stat st;
+
+  if(stat(name, &st) == 0 && S_ISDIR(st.st_mode)){
+    add_directory(name);
+  } else {
+    add_file(name);
+  }
+}
+
+/**
+ Makes the name of the output for an input: the same base name, in the
+ output directory, ending in .pgm.
+*/
+
+void output_name(const char *input, char *output, size_t size){
+  const char *base = strrchr(input, '/');
+  const char *dot;
+  int length;
+
+  base = base ? base + 1 : input;
+  dot = strrchr(base, '.');
+  length = dot ? dot - base : (int)strlen(base);
+  snprintf(output, size, "%s/%.*s.pgm", output_directory, length, base);
+}
+
+typedef struct file_id {
+  dev_t dev;
+  ino_t ino;
+} file_id_t;
+
+int compare_outputs(const void *a, const void *b){
+  return strcmp(outputs[*(const int *)a], outputs[*(const int *)b]);
+}
+
+int compare_ids(const void *a, const void *b){
+  const file_id_t *x = a, *y = b;
+  if(x->dev != y->dev) return x->dev < y->dev ? -1 : 1;
+  return x->ino < y->ino ? -1 : x->ino > y->ino;
+}
+
+/**
+ Names the output of every input, and returns the number of clashes: two
+ inputs that would be written to the same file, such as d1/x.pgm and
+ d2/x.pgm or x.pgm and x.ppm, and outputs that are one of the inputs, as
+ with -o frames frames/. Either way images would be overwritten while the
+ run still counted them as done, so nothing is started if there are any.
+*/
+
+int plan_outputs(){
+  int *order = malloc(n_files * sizeof(int));
+  file_id_t *inputs = malloc(n_files * sizeof(file_id_t));
+  char name[4096];
+  struct stat st;
+  int n_inputs = 0, clashes = 0, i;
+
+  outputs = malloc(n_files * sizeof(char *));
+  for(i=0; i<n_files; i++){
+    output_name(files[i], name, sizeof(name));
+    outputs[i] = strdup(name);
+    order[i] = i;
+    if(stat(files[i], &st) == 0){
+      inputs[n_inputs].dev = st.st_dev;
+      inputs[n_inputs].ino = st.st_ino;
+      n_inputs++;
+    }
+  }
+
+  qsort(order, n_files, sizeof(int), compare_outputs);
+  for(i=1; i<n_files; i++){
+    if(strcmp(outputs[order[i - 1]], outputs[order[i]]) == 0){
+      fprintf(stderr, "%s and %s would both be written to %s\n",
+              files[order[i - 1]], files[order[i]], outputs[order[i]]);
+      clashes++;
+    }
+  }
+
+  // Compared as files rather than names, which may differ for one file
+  qsort(inputs, n_inputs, sizeof(file_id_t), compare_ids);
+  for(i=0; i<n_files; i++){
+    file_id_t id;
+    if(stat(outputs[i], &st) != 0) continue;
+    id.dev = st.st_dev;
+    id.ino = st.st_ino;
+    if(bsearch(&id, inputs, n_inputs, sizeof(file_id_t), compare_ids)){
+      fprintf(stderr, "%s would be overwritten by the output of %s\n",
+              outputs[i], files[i]);
+      clashes++;
+    }
+  }
+  free(order);
+  free(inputs);
+  return clashes;
+}
+
+/**
+ Starts reading a file into the page cache without waiting for it.
+*/
+
+void prefetch(const char *filename){
+  int fd = open(filename, O_RDONLY);
+  if(fd < 0) return;
+  posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+  close(fd);
+}
+
+void *batch_worker(void *unused){
+  unsigned char *buffer = NULL;  // Reused for every output of this thread
+  size_t buffer_size = 0;
+  int i;
+
+  while((i = atomic_fetch_add(&next_file, 1)) < n_files){
+    image_t in, out;
+    size_t pixels;
+
+    if(i + n_threads < n_files) prefetch(files[i + n_threads]);
+    if(image_load(files[i], &in) != 0){
+      atomic_fetch_add(&images_failed, 1);
+      continue;
+    }
+    pixels = (size_t)in.width * in.height;
+    if(pixels > buffer_size){
+      free(buffer);
+      buffer = malloc(pixels);
+      buffer_size = buffer ? pixels : 0;
+      if(buffer == NULL){
+        fprintf(stderr, "%s: out of memory\n", files[i]);
+        image_free(&in);
+        atomic_fetch_add(&images_failed, 1);
+        continue;
+      }
+    }
+    image_wrap(&out, buffer, in.width, in.height, in.width);
+
+    if(use_pipeline){
+      long long fused_bytes, unfused_bytes;
+      int failed = unfused ? pipeline_run_unfused(&pipeline, &in, &out)
+                           : pipeline_run(&pipeline, &in, &out, 0, in.height);
+      if(failed){
+        fprintf(stderr, "%s: out of memory\n", files[i]);
+        image_free(&in);
+        atomic_fetch_add(&images_failed, 1);
+        continue;
+      }
+      pipeline_traffic(&pipeline, in.width, in.height, &unfused_bytes,
+                       &fused_bytes);
+      atomic_fetch_add(&traffic_fused, fused_bytes);
+      atomic_fetch_add(&traffic_unfused, unfused_bytes);
+    } else if(use_kernel){
+      if(convolve_rows(&in, &out, &kernel, 0, in.height) != 0){
+        fprintf(stderr, "%s: out of memory\n", files[i]);
+        image_free(&in);
+        atomic_fetch_add(&images_failed, 1);
+        continue;
+      }
+    } else {
+      detect_edges_rows(&in, &out, 0, in.height);
+    }
+
+    if(image_write_pgm(outputs[i], &out) != 0){
+      atomic_fetch_add(&images_failed, 1);
+    } else {
+      atomic_fetch_add(&images_done, 1);
+      atomic_fetch_add(&pixels_done, pixels);
+      atomic_fetch_add(&bytes_read, in.map_length);
+    }
+    image_free(&in);
+  }
+  free(buffer);
+  return NULL;
+}
+
+int time_difference(struct timespec *start, struct timespec *finish,
+                    long long int *difference) {
+  long long int ds =  finish->tv_sec - start->tv_sec;
+  long long int dn =  finish->tv_nsec - start->tv_nsec;
+
+  if(dn < 0 ) {
+    ds--;
+    dn += 1000000000;
+  }
+  *difference = ds * 1000000000 + dn;
+  return !(*difference > 0);
+}
+
+int main(int argc, char **argv){
+  pthread_t threads[MAX_THREADS];
+  struct timespec start, finish;
+  long long int time_elapsed;
+  double seconds;
+  char description[128];
+  int opt, i;
+
+  n_threads = sysconf(_SC_NPROCESSORS_ONLN);
+  while((opt = getopt(argc, argv, "o:l:t:K:p:u")) != -1){
+    switch(opt){
+      case 'o': output_directory = optarg; break;
+      case 'l': add_list(optarg); break;
+      case 't': n_threads = atoi(optarg); break;
+      case 'K':
+        if(convolution_parse(optarg, &kernel) != 0) return 1;
+        use_kernel = 1;
+        break;
+      case 'p':
+        if(pipeline_parse(optarg, &pipeline) != 0) return 1;
+        use_pipeline = 1;
+        break;
+      case 'u': unfused = 1; break;
+      default:
+        fprintf(stderr, "usage: %s [-o directory] [-t threads] "
+                "[-K kernel] [-p pipeline [-u]] [-l list] "
+                "[image or directory ...]\n", argv[0]);
+        return 1;
+    }
+  }
+  for(i=optind; i<argc; i++){
+    add_argument(argv[i]);
+  }
+  if(n_files == 0){
+    fprintf(stderr, "no images to process\n");
+    return 1;
+  }
+  if(mkdir(output_directory, 0755) != 0 && errno != EEXIST){
+    perror(output_directory);
+    return 1;
+  }
+  if(plan_outputs() != 0){
+    fprintf(stderr, "no images processed, every image needs an output of "
+            "its own\n");
+    return 1;
+  }
+  if(n_threads < 1) n_threads = 1;
+  if(n_threads > MAX_THREADS) n_threads = MAX_THREADS;
+  if(n_threads > n_files) n_threads = n_files;
+
+  if(use_pipeline){
+    pipeline_describe(&pipeline, description, sizeof(description));
+    strncat(description, unfused ? ", unfused" : ", fused",
+            sizeof(description) - strlen(description) - 1);
+  } else if(use_kernel){
+    convolution_describe(&kernel, description, sizeof(description));
+  } else {
+    snprintf(description, sizeof(description), "edges, %s",
+             edge_detect_kernel());
+  }
+  printf("%d images, %d threads, %s, writing to %s\n", n_files, n_threads,
+         description, output_directory);
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  for(i=0; i<n_threads && i<n_files; i++){
+    prefetch(files[i]);
+  }
+  for(i=0; i<n_threads; i++){
+    pthread_create(&threads[i], NULL, batch_worker, NULL);
+  }
+  for(i=0; i<n_threads; i++){
+    pthread_join(threads[i], NULL);
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &finish);
+  time_difference(&start, &finish, &time_elapsed);
+  seconds = time_elapsed / 1.0e9;
+
+  printf("%d images done, %d failed\n", atomic_load(&images_done),
+         atomic_load(&images_failed));
+  printf("%0.1f images/s, %0.1f MPix/s, %0.1f MB/s read\n",
+         atomic_load(&images_done) / seconds,
+         atomic_load(&pixels_done) / seconds / 1e6,
+         atomic_load(&bytes_read) / seconds / 1e6);
+  if(use_pipeline){
+    long long saved = atomic_load(&traffic_unfused) -
+                      atomic_load(&traffic_fused);
+    printf("memory traffic %0.1f MB fused, %0.1f MB unfused: fusing saves "
+           "%0.1f MB (%0.1f%%)\n", atomic_load(&traffic_fused) / 1e6,
+           atomic_load(&traffic_unfused) / 1e6, saved / 1e6,
+           100.0 * saved / atomic_load(&traffic_unfused));
+  }
+  printf("Time elapsed was %lldns or %0.9lfs\n", time_elapsed, seconds);
+
+  for(i=0; i<n_files; i++){
+    free(files[i]);
+    free(outputs[i]);
+  }
+  free(files);
+  free(outputs);
+  return atomic_load(&images_failed) ? 1 : 0;
+}
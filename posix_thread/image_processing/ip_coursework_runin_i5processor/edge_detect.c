@@ -0,0 +1,233 @@
+#include <string.h>
+#include <pthread.h>
+#include "edge_detect.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS
+#endif
+
+/******************************************************************************
+  The edge detector behind edge_detect.h.
+
+  The pixels of a row that are not on the border are done by a row kernel.
+  The scalar one is the test of ip_coursework_011.c. On x86 there are also
+  SSE2, AVX2 and AVX-512 kernels that do 16, 32 or 64 pixels at once: each
+  pixel and its four neighbours are widened to 16 bits, where 4 x 255 and
+  the sum of four neighbours both fit, and "4 x pixel > sum of neighbours"
+  is tested with one compare. The all ones or all zeros result is narrowed
+  back to 255 or 0 with a saturating pack. As this is the same test, in
+  integers, the edges are the same bit for bit whichever kernel is used.
+  The pixels left over at the end of a row are done by the scalar kernel.
+
+  The fastest kernel the processor has is chosen the first time one is
+  needed. SSE2 is part of every x86-64 processor; the others are compiled
+  with target attributes, so no special compiler flags are needed.
+
+  Compile with the program that uses it.
+******************************************************************************/
+
+typedef void (*row_kernel_t)(const unsigned char *row, int stride,
+                             unsigned char *out_row, int first, int end);
+
+static void row_scalar(const unsigned char *row, int stride,
+                       unsigned char *out_row, int first, int end){
+  int x;
+
+  for(x=first; x<end; x++){
+    int r = row[x] * 4 - row[x - 1] - row[x + 1] - row[x - stride]
+            - row[x + stride];
+    out_row[x] = r > 0 ? 255 : 0;
+  }
+}
+
+#ifdef HAVE_X86_KERNELS
+
+__attribute__((target("sse2")))
+static void row_sse2(const unsigned char *row, int stride,
+                     unsigned char *out_row, int first, int end){
+  const __m128i zero = _mm_setzero_si128();
+  int x;
+
+  for(x=first; x+16<=end; x+=16){
+    const unsigned char *p = row + x;
+    __m128i c = _mm_loadu_si128((const __m128i *)p);
+    __m128i l = _mm_loadu_si128((const __m128i *)(p - 1));
+    __m128i r = _mm_loadu_si128((const __m128i *)(p + 1));
+    __m128i u = _mm_loadu_si128((const __m128i *)(p - stride));
+    __m128i d = _mm_loadu_si128((const __m128i *)(p + stride));
+    __m128i lo, hi;
+
+    lo = _mm_add_epi16(_mm_add_epi16(_mm_unpacklo_epi8(l, zero),
+                                     _mm_unpacklo_epi8(r, zero)),
+                       _mm_add_epi16(_mm_unpacklo_epi8(u, zero),
+                                     _mm_unpacklo_epi8(d, zero)));
+    hi = _mm_add_epi16(_mm_add_epi16(_mm_unpackhi_epi8(l, zero),
+                                     _mm_unpackhi_epi8(r, zero)),
+                       _mm_add_epi16(_mm_unpackhi_epi8(u, zero),
+                                     _mm_unpackhi_epi8(d, zero)));
+    lo = _mm_cmpgt_epi16(_mm_slli_epi16(_mm_unpacklo_epi8(c, zero), 2), lo);
+    hi = _mm_cmpgt_epi16(_mm_slli_epi16(_mm_unpackhi_epi8(c, zero), 2), hi);
+    _mm_storeu_si128((__m128i *)(out_row + x), _mm_packs_epi16(lo, hi));
+  }
+  row_scalar(row, stride, out_row, x, end);
+}
+
+// The unpacks and the pack work within each 128 bit lane, so the pixels
+// come back out in the order they went in
+
+__attribute__((target("avx2")))
+static void row_avx2(const unsigned char *row, int stride,
+                     unsigned char *out_row, int first, int end){
+  const __m256i zero = _mm256_setzero_si256();
+  int x;
+
+  for(x=first; x+32<=end; x+=32){
+    const unsigned char *p = row + x;
+    __m256i c = _mm256_loadu_si256((const __m256i *)p);
+    __m256i l = _mm256_loadu_si256((const __m256i *)(p - 1));
+    __m256i r = _mm256_loadu_si256((const __m256i *)(p + 1));
+    __m256i u = _mm256_loadu_si256((const __m256i *)(p - stride));
+    __m256i d = _mm256_loadu_si256((const __m256i *)(p + stride));
+    __m256i lo, hi;
+
+    lo = _mm256_add_epi16(_mm256_add_epi16(_mm256_unpacklo_epi8(l, zero),
+                                           _mm256_unpacklo_epi8(r, zero)),
+                          _mm256_add_epi16(_mm256_unpacklo_epi8(u, zero),
+                                           _mm256_unpacklo_epi8(d, zero)));
+    hi = _mm256_add_epi16(_mm256_add_epi16(_mm256_unpackhi_epi8(l, zero),
+                                           _mm256_unpackhi_epi8(r, zero)),
+                          _mm256_add_epi16(_mm256_unpackhi_epi8(u, zero),
+                                           _mm256_unpackhi_epi8(d, zero)));
+    lo = _mm256_cmpgt_epi16(
+             _mm256_slli_epi16(_mm256_unpacklo_epi8(c, zero), 2), lo);
+    hi = _mm256_cmpgt_epi16(
+             _mm256_slli_epi16(_mm256_unpackhi_epi8(c, zero), 2), hi);
+    _mm256_storeu_si256((__m256i *)(out_row + x),
+                        _mm256_packs_epi16(lo, hi));
+  }
+  row_sse2(row, stride, out_row, x, end);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void row_avx512(const unsigned char *row, int stride,
+                       unsigned char *out_row, int first, int end){
+  const __m512i zero = _mm512_setzero_si512();
+  int x;
+
+  for(x=first; x+64<=end; x+=64){
+    const unsigned char *p = row + x;
+    __m512i c = _mm512_loadu_si512(p);
+    __m512i l = _mm512_loadu_si512(p - 1);
+    __m512i r = _mm512_loadu_si512(p + 1);
+    __m512i u = _mm512_loadu_si512(p - stride);
+    __m512i d = _mm512_loadu_si512(p + stride);
+    __m512i lo, hi;
+    __mmask32 lo_edge, hi_edge;
+
+    lo = _mm512_add_epi16(_mm512_add_epi16(_mm512_unpacklo_epi8(l, zero),
+                                           _mm512_unpacklo_epi8(r, zero)),
+                          _mm512_add_epi16(_mm512_unpacklo_epi8(u, zero),
+                                           _mm512_unpacklo_epi8(d, zero)));
+    hi = _mm512_add_epi16(_mm512_add_epi16(_mm512_unpackhi_epi8(l, zero),
+                                           _mm512_unpackhi_epi8(r, zero)),
+                          _mm512_add_epi16(_mm512_unpackhi_epi8(u, zero),
+                                           _mm512_unpackhi_epi8(d, zero)));
+    lo_edge = _mm512_cmpgt_epi16_mask(
+                  _mm512_slli_epi16(_mm512_unpacklo_epi8(c, zero), 2), lo);
+    hi_edge = _mm512_cmpgt_epi16_mask(
+                  _mm512_slli_epi16(_mm512_unpackhi_epi8(c, zero), 2), hi);
+    _mm512_storeu_si512(out_row + x,
+                        _mm512_packs_epi16(_mm512_movm_epi16(lo_edge),
+                                           _mm512_movm_epi16(hi_edge)));
+  }
+  row_avx2(row, stride, out_row, x, end);
+}
+
+#endif
+
+static const struct {
+  const char *name;
+  row_kernel_t kernel;
+} kernels[] = {
+  {"scalar", row_scalar},
+#ifdef HAVE_X86_KERNELS
+  {"sse2", row_sse2},
+  {"avx2", row_avx2},
+  {"avx512", row_avx512},
+#endif
+};
+#define N_KERNELS (int)(sizeof(kernels) / sizeof(kernels[0]))
+
+static int kernel_in_use = -1;
+static pthread_once_t kernel_chosen = PTHREAD_ONCE_INIT;
+
+static int kernel_supported(int k){
+#ifdef HAVE_X86_KERNELS
+  __builtin_cpu_init();
+  if(kernels[k].kernel == row_sse2) return __builtin_cpu_supports("sse2");
+  if(kernels[k].kernel == row_avx2) return __builtin_cpu_supports("avx2");
+  if(kernels[k].kernel == row_avx512){
+    return __builtin_cpu_supports("avx512f") &&
+           __builtin_cpu_supports("avx512bw");
+  }
+#endif
+  return 1;
+}
+
+static void choose_kernel(void){
+  int k;
+
+  if(kernel_in_use >= 0) return;   // Already set by edge_detect_use()
+  for(k=N_KERNELS-1; k>0 && !kernel_supported(k); k--);
+  kernel_in_use = k;
+}
+
+int edge_detect_use(const char *name){
+  int k;
+
+  for(k=0; k<N_KERNELS; k++){
+    if(strcmp(kernels[k].name, name) == 0 && kernel_supported(k)){
+      kernel_in_use = k;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+const char *edge_detect_kernel(void){
+  pthread_once(&kernel_chosen, choose_kernel);
+  return kernels[kernel_in_use].name;
+}
+
+void detect_edges_tile(const image_t *in, image_t *out, int x0, int y0,
+                       int x1, int y1){
+  int width = in->width, height = in->height, stride = in->stride;
+  // The columns inside the tile that are not on the border of the image
+  int first = x0 > 1 ? x0 : 1;
+  int end = x1 < width - 1 ? x1 : width - 1;
+  row_kernel_t kernel;
+  int x, y;
+
+  pthread_once(&kernel_chosen, choose_kernel);
+  kernel = kernels[kernel_in_use].kernel;
+
+  if(end < first) end = first;
+  for(y=y0; y<y1; y++){
+    const unsigned char *row = in->pixels + (size_t)y * stride;
+    unsigned char *out_row = out->pixels + (size_t)y * out->stride;
+
+    if(y == 0 || y == height - 1 || width < 3){
+      memset(out_row + x0, 0, x1 - x0);
+      continue;
+    }
+    for(x=x0; x<first && x<x1; x++) out_row[x] = 0;
+    kernel(row, stride, out_row, first, end);
+    for(x=end; x<x1; x++) out_row[x] = 0;
+  }
+}
+
+void detect_edges_rows(const image_t *in, image_t *out, int first_row,
+                       int end_row){
+  detect_edges_tile(in, out, 0, first_row, in->width, end_row);
+}
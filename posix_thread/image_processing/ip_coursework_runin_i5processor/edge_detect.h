@@ -0,0 +1,51 @@
+#ifndef EDGE_DETECT_H
+#define EDGE_DETECT_H
+
+#include "image_io.h"
+
+/******************************************************************************
+  The edge detector of ip_coursework_011.c, for programs that run it on
+  images of any size and on part of an image at a time.
+
+  A pixel is an edge if 4 x itself minus its four neighbours is positive;
+  the pixels on the border of the image have no four neighbours and are
+  always 0. The border is dealt with once per row, outside the loop over
+  the pixels, so the inner loop has no tests in it. The inner loop is done
+  with SSE2, AVX2 or AVX-512 where the processor has them, giving the same
+  edges as the plain C loop.
+******************************************************************************/
+
+/**
+ Detects the edges of rows first_row up to, but not including, end_row of
+ in, writing them to the same rows of out. Threads may share an image as
+ long as their rows do not overlap.
+*/
+
+void detect_edges_rows(const image_t *in, image_t *out, int first_row,
+                       int end_row);
+
+/**
+ Detects the edges of the tile of columns x0 to x1 and rows y0 to y1, the
+ ends not included. It reads one pixel around the tile, but writes only
+ inside it, so tiles that do not overlap can be done at the same time.
+*/
+
+void detect_edges_tile(const image_t *in, image_t *out, int x0, int y0,
+                       int x1, int y1);
+
+/**
+ Chooses the row kernel by name: "scalar", "sse2", "avx2" or "avx512".
+ Returns -1 if there is no such kernel or the processor cannot run it.
+ Call it before any thread detects edges; by default the fastest kernel
+ the processor can run is used.
+*/
+
+int edge_detect_use(const char *name);
+
+/**
+ Returns the name of the row kernel in use.
+*/
+
+const char *edge_detect_kernel(void);
+
+#endif
@@ -0,0 +1,95 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "image_io.h"
+#include "edge_detect.h"
+
+/******************************************************************************
+  Checks that every row kernel of edge_detect.c the processor can run gives
+  the same edges, bit for bit, as the plain C one. Random images of random
+  widths and strides are run whole and in random tiles, with the output
+  filled with the same noise beforehand, so pixels a kernel should not
+  have touched are checked too. Kernels the processor cannot run are
+  skipped. Prints PASS or FAIL and exits with 0 or 1.
+
+  Compile with:
+    cc -O2 -o edge_detect_test edge_detect_test.c edge_detect.c image_io.c
+******************************************************************************/
+
+#define ROUNDS 500
+#define TILES 8
+
+static const char *names[] = { "sse2", "avx2", "avx512" };
+
+static void fill(unsigned char *p, size_t n){
+  size_t i;
+  for(i=0; i<n; i++){
+    p[i] = rand();
+  }
+}
+
+int main(){
+  int n, round, failed = 0;
+
+  srand(2018);
+  for(n=0; n<3; n++){
+    int checked = 0;
+
+    if(edge_detect_use(names[n]) != 0){
+      printf("%s: not supported here, skipped\n", names[n]);
+      continue;
+    }
+    for(round=0; round<ROUNDS && !failed; round++){
+      int width = 1 + rand() % 300, height = 1 + rand() % 40;
+      int stride = width + rand() % 80, t;
+      size_t size = (size_t)stride * height;
+      unsigned char *pixels = malloc(size), *expected = malloc(size);
+      unsigned char *got = malloc(size), *noise = malloc(size);
+      image_t in, want, out;
+
+      fill(pixels, size);
+      fill(noise, size);
+      image_wrap(&in, pixels, width, height, stride);
+      image_wrap(&want, expected, width, height, stride);
+      image_wrap(&out, got, width, height, stride);
+
+      memcpy(expected, noise, size);
+      memcpy(got, noise, size);
+      edge_detect_use("scalar");
+      detect_edges_rows(&in, &want, 0, height);
+      edge_detect_use(names[n]);
+      detect_edges_rows(&in, &out, 0, height);
+      if(memcmp(expected, got, size) != 0){
+        printf("FAIL: %s rows of a %dx%d image of stride %d\n", names[n],
+               width, height, stride);
+        failed = 1;
+      }
+
+      for(t=0; t<TILES && !failed; t++){
+        int x0 = rand() % width, x1 = x0 + 1 + rand() % (width - x0);
+        int y0 = rand() % height, y1 = y0 + 1 + rand() % (height - y0);
+
+        memcpy(expected, noise, size);
+        memcpy(got, noise, size);
+        edge_detect_use("scalar");
+        detect_edges_tile(&in, &want, x0, y0, x1, y1);
+        edge_detect_use(names[n]);
+        detect_edges_tile(&in, &out, x0, y0, x1, y1);
+        if(memcmp(expected, got, size) != 0){
+          printf("FAIL: %s tile (%d,%d)-(%d,%d) of a %dx%d image of "
+                 "stride %d\n", names[n], x0, y0, x1, y1, width, height,
+                 stride);
+          failed = 1;
+        }
+      }
+      free(pixels);
+      free(expected);
+      free(got);
+      free(noise);
+      checked++;
+    }
+    printf("%s: %d images checked against scalar\n", names[n], checked);
+  }
+  printf("%s\n", failed ? "FAIL" : "PASS");
+  return failed;
+}
@@ -0,0 +1,201 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "image_io.h"
+#include "edge_detect.h"
+#include "labels.h"
+
+/******************************************************************************
+  Labels the connected components of an edge map or a thresholded image
+  (see labels.h), timing each stage, and writes out the labels and the
+  size, bounding box and centre of every component:
+    ./edge_labels [-t threads] [-c 4|8] [-T threshold] [-e] [-r repeats]
+                  [-C] [-o view.pgm] [-L labels.raw] [-s stats.csv]
+                  image.pgm
+
+  A pixel above -T (default 0) is foreground, so an edge map or the output
+  of a threshold can be given as it is; -e detects the edges of the image
+  first, with edge_detect.h, and labels those. -c is the connectivity
+  (default 8), -t defaults to all online cores, -r to 1.
+
+  -C labels the image with the plain one thread labeller as well, says
+  whether the two agree and how long that took, and exits with 1 if they
+  do not.
+
+  Outputs:
+    -o  a PGM with each component in a grey of its own, to look at
+    -L  the labels as 32 bit numbers, width x height of them, in the byte
+        order of the machine
+    -s  one line per component: label, area, x0, y0, x1, y1, cx, cy
+
+  Compile with:
+    cc -O2 -o edge_labels edge_labels.c labels.c edge_detect.c image_io.c -pthread
+******************************************************************************/
+
+int time_difference(struct timespec *start, struct timespec *finish,
+                    long long int *difference){
+  long long int ds =  finish->tv_sec - start->tv_sec;
+  long long int dn =  finish->tv_nsec - start->tv_nsec;
+
+  if(dn < 0 ){
+    ds--;
+    dn += 1000000000;
+  }
+  *difference = ds * 1000000000 + dn;
+  return !(*difference > 0);
+}
+
+int write_view(const char *filename, const labelling_t *l){
+  image_t view;
+  size_t i, n = (size_t)l->width * l->height;
+  int failed;
+
+  if(image_create(&view, l->width, l->height) != 0){
+    fprintf(stderr, "out of memory\n");
+    return -1;
+  }
+  // Neighbouring labels get greys far apart; none is as dark as the
+  // background
+  for(i=0; i<n; i++){
+    view.pixels[i] = l->labels[i] ? 64 + (l->labels[i] * 97) % 192 : 0;
+  }
+  failed = image_write_pgm(filename, &view);
+  image_free(&view);
+  return failed;
+}
+
+int write_labels(const char *filename, const labelling_t *l){
+  FILE *f = fopen(filename, "wb");
+  size_t n = (size_t)l->width * l->height;
+
+  if(f == NULL || fwrite(l->labels, sizeof(uint32_t), n, f) != n){
+    perror(filename);
+    if(f != NULL) fclose(f);
+    return -1;
+  }
+  return fclose(f) == 0 ? 0 : -1;
+}
+
+int write_stats(const char *filename, const labelling_t *l){
+  FILE *f = fopen(filename, "w");
+  int c;
+
+  if(f == NULL){
+    perror(filename);
+    return -1;
+  }
+  fprintf(f, "label,area,x0,y0,x1,y1,cx,cy\n");
+  for(c=0; c<l->n_components; c++){
+    const component_t *p = &l->components[c];
+    fprintf(f, "%d,%lld,%d,%d,%d,%d,%.3f,%.3f\n", c + 1, p->area, p->x0,
+            p->y0, p->x1, p->y1, p->cx, p->cy);
+  }
+  return fclose(f) == 0 ? 0 : -1;
+}
+
+int main(int argc, char **argv){
+  int n_threads = sysconf(_SC_NPROCESSORS_ONLN);
+  int connectivity = 8, threshold = 0, edges = 0, repeats = 1, check = 0;
+  const char *view_name = NULL, *labels_name = NULL, *stats_name = NULL;
+  image_t image, edge_map, *input = &image;
+  labelling_t labels, reference;
+  label_times_t times, best;
+  long long int total, best_total = 0, time_elapsed;
+  struct timespec start, finish;
+  int opt, r, s, different = 0;
+
+  while((opt = getopt(argc, argv, "t:c:T:er:Co:L:s:")) != -1){
+    switch(opt){
+      case 't': n_threads = atoi(optarg); break;
+      case 'c': connectivity = atoi(optarg) == 4 ? 4 : 8; break;
+      case 'T': threshold = atoi(optarg); break;
+      case 'e': edges = 1; break;
+      case 'r': repeats = atoi(optarg); break;
+      case 'C': check = 1; break;
+      case 'o': view_name = optarg; break;
+      case 'L': labels_name = optarg; break;
+      case 's': stats_name = optarg; break;
+      default:
+        fprintf(stderr, "usage: %s [-t threads] [-c 4|8] [-T threshold] "
+                "[-e] [-r repeats] [-C] [-o view.pgm] [-L labels.raw] "
+                "[-s stats.csv] image.pgm\n", argv[0]);
+        return 1;
+    }
+  }
+  if(argc <= optind){
+    fprintf(stderr, "usage: %s [-t threads] [-c 4|8] [-T threshold] [-e] "
+            "[-r repeats] [-C] [-o view.pgm] [-L labels.raw] "
+            "[-s stats.csv] image.pgm\n", argv[0]);
+    return 1;
+  }
+  if(n_threads < 1) n_threads = 1;
+  if(repeats < 1) repeats = 1;
+  if(image_load(argv[optind], &image) != 0){
+    return 1;
+  }
+  if(edges){
+    if(image_create(&edge_map, image.width, image.height) != 0){
+      fprintf(stderr, "out of memory\n");
+      return 1;
+    }
+    detect_edges_rows(&image, &edge_map, 0, image.height);
+    input = &edge_map;
+  }
+
+  printf("image dimensions %dx%d, %d threads, %d connectivity, "
+         "foreground above %d%s\n", image.width, image.height, n_threads,
+         connectivity, threshold, edges ? " of the edges" : "");
+
+  memset(&best, 0, sizeof(best));
+  for(r=0; r<repeats; r++){
+    if(r > 0) labelling_free(&labels);
+    if(label_components(input, threshold, connectivity, n_threads, &labels,
+                        &times) != 0){
+      fprintf(stderr, "out of memory\n");
+      return 1;
+    }
+    total = 0;
+    for(s=0; s<LABEL_STAGES; s++){
+      total += times.stage[s];
+      if(r == 0 || times.stage[s] < best.stage[s]){
+        best.stage[s] = times.stage[s];
+      }
+    }
+    if(r == 0 || total < best_total) best_total = total;
+  }
+  for(s=0; s<LABEL_STAGES; s++){
+    printf("%-8s %10lldns %5.1f%%\n", label_stage_names[s], best.stage[s],
+           100.0 * best.stage[s] / best_total);
+  }
+  printf("in all   %10lldns, %0.1f MPix/s, %d components\n", best_total,
+         (double)image.width * image.height / best_total * 1e3,
+         labels.n_components);
+
+  if(check){
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if(label_components_reference(input, threshold, connectivity,
+                                  &reference) != 0){
+      fprintf(stderr, "out of memory\n");
+      return 1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &finish);
+    time_difference(&start, &finish, &time_elapsed);
+    different = !labelling_same(&labels, &reference);
+    printf("one thread, filling each component: %lldns, %d components, %s\n",
+           time_elapsed, reference.n_components,
+           different ? "DIFFERENT LABELS" : "same labels and stats");
+    labelling_free(&reference);
+  }
+
+  if((view_name != NULL && write_view(view_name, &labels) != 0) ||
+     (labels_name != NULL && write_labels(labels_name, &labels) != 0) ||
+     (stats_name != NULL && write_stats(stats_name, &labels) != 0)){
+    return 1;
+  }
+  labelling_free(&labels);
+  if(edges) image_free(&edge_map);
+  image_free(&image);
+  return different;
+}
@@ -0,0 +1,454 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include "image_io.h"
+#include "edge_detect.h"
+#include "pipeline.h"
+
+/******************************************************************************
+  Detects the edges of a stream of frames, such as from a camera, as they
+  arrive.
+
+  Frames are read from a file, a FIFO or stdin ("-"), either as raw grey
+  scale pixels, width x height bytes per frame with no header, given with
+  -s, or as binary PGM images one after the other (as ffmpeg writes with
+  -f image2pipe -vcodec pgm). The edges go out in the same format to the
+  file named with -o ("-" for stdout), or nowhere if there is no -o:
+    ffmpeg ... -f rawvideo -pix_fmt gray - | ./edge_stream -s 1920x1080 -o - -
+
+  The work is split into three stages that run at the same time, each with
+  threads of its own:
+    read     one thread reads a frame into a free frame buffer
+    detect   -t threads (default all online cores less two) each take a
+             frame that has been read and detect its edges
+    write    one thread writes the frames out, in the order they came in
+  The stages are joined by queues. Frame buffers are allocated once, -b of
+  them (default twice the detect threads and two more), and go round and
+  round: when all are in use the reader waits, so a slow stage holds the
+  others back rather than letting frames pile up in memory.
+
+  With -p the frames go through a fused pipeline of stages rather than the
+  edge detector alone (see pipeline.h).
+
+  At the end the frames per second are printed, for the whole run and for
+  the steady state after the first -W frames (default 10), along with the
+  latency of a frame, from when it had been read to when it had been
+  written, at the 50th, 90th and 99th percentiles. The number of times each
+  stage found nothing to do says which stage held the others back.
+
+  A stream that is cut short or holds a frame that is not PGM of the first
+  frame's size, or edges that cannot be made or written, stop the run where
+  they happen and make the program exit with 1.
+
+  Compile with:
+    cc -O2 -o edge_stream edge_stream.c edge_detect.c pipeline.c convolve.c image_io.c -lm -pthread
+******************************************************************************/
+
+#define MAX_FRAMES 256
+#define MAX_THREADS 256
+
+typedef struct frame {
+  long long number;
+  image_t in;
+  image_t out;
+  struct timespec read_at;
+  int failed;                // Not detected, so out holds stale pixels
+} frame_t;
+
+typedef struct frame_queue {
+  pthread_mutex_t lock;
+  pthread_cond_t not_empty;
+  frame_t *frames[MAX_FRAMES];
+  int head;
+  int n_queued;
+  int closed;
+  long long waits;           // Times a taker found the queue empty
+} frame_queue_t;
+
+frame_queue_t free_frames, read_frames, done_frames;
+frame_t frames[MAX_FRAMES];
+int n_frames;
+
+FILE *input, *output;
+int raw, width, height;
+pipeline_t pipeline;
+int use_pipeline;
+int detectors_left;
+atomic_int stream_failed;    // Edges not made or written; stops the stream
+int input_failed;            // The stream was cut short or not PGM
+pthread_mutex_t detectors_lock = PTHREAD_MUTEX_INITIALIZER;
+
+long long *latencies;        // ns from read to written, per frame
+long long n_written;
+struct timespec *written_at;
+int warm_up = 10;
+
+void queue_init(frame_queue_t *queue){
+  memset(queue, 0, sizeof(*queue));
+  pthread_mutex_init(&queue->lock, NULL);
+  pthread_cond_init(&queue->not_empty, NULL);
+}
+
+/**
+ Adds a frame. There are never more frames than a queue holds, so this
+ does not wait.
+*/
+
+void queue_put(frame_queue_t *queue, frame_t *frame){
+  pthread_mutex_lock(&queue->lock);
+  queue->frames[(queue->head + queue->n_queued) % MAX_FRAMES] = frame;
+  queue->n_queued++;
+  pthread_cond_signal(&queue->not_empty);
+  pthread_mutex_unlock(&queue->lock);
+}
+
+/**
+ Takes the next frame, waiting for one. Returns NULL once the queue is
+ closed and empty.
+*/
+
+frame_t *queue_take(frame_queue_t *queue){
+  frame_t *frame = NULL;
+
+  pthread_mutex_lock(&queue->lock);
+  if(queue->n_queued == 0 && !queue->closed) queue->waits++;
+  while(queue->n_queued == 0 && !queue->closed){
+    pthread_cond_wait(&queue->not_empty, &queue->lock);
+  }
+  if(queue->n_queued > 0){
+    frame = queue->frames[queue->head];
+    queue->head = (queue->head + 1) % MAX_FRAMES;
+    queue->n_queued--;
+  }
+  pthread_mutex_unlock(&queue->lock);
+  return frame;
+}
+
+void queue_close(frame_queue_t *queue){
+  pthread_mutex_lock(&queue->lock);
+  queue->closed = 1;
+  pthread_cond_broadcast(&queue->not_empty);
+  pthread_mutex_unlock(&queue->lock);
+}
+
+/**
+ Reads one number of a PGM header, skipping white space and comments.
+*/
+
+int header_number(FILE *f){
+  int c, n = 0, digits = 0;
+
+  while((c = getc(f)) != EOF){
+    if(c == '#'){
+      while((c = getc(f)) != EOF && c != '\n');
+    } else if(c != ' ' && c != '\t' && c != '\r' && c != '\n'){
+      break;
+    }
+  }
+  while(c >= '0' && c <= '9' && digits < 9){
+    n = n * 10 + c - '0';
+    digits++;
+    c = getc(f);
+  }
+  // c is the single white space after the number
+  return digits > 0 ? n : -1;
+}
+
+/**
+ Reads the header of the next PGM frame. Returns 0, 1 at the end of the
+ stream, or -1 if it is not a binary PGM header.
+*/
+
+int read_header(int *w, int *h){
+  int c = getc(input), maxval;
+
+  if(c == EOF) return 1;
+  if(c != 'P' || getc(input) != '5') return -1;
+  *w = header_number(input);
+  *h = header_number(input);
+  maxval = header_number(input);
+  if(*w < 1 || *h < 1 || maxval < 1 || maxval > 255) return -1;
+  return 0;
+}
+
+/**
+ Reads the first frame's header, so that the buffers can be sized.
+*/
+
+int first_header(void){
+  int c;
+
+  if(raw) return 0;
+  c = getc(input);
+  if(c == EOF){
+    fprintf(stderr, "the stream is empty\n");
+    return -1;
+  }
+  ungetc(c, input);
+  if(read_header(&width, &height) != 0){
+    fprintf(stderr, "the stream is not binary PGM; give raw frames "
+            "with -s\n");
+    return -1;
+  }
+  return 0;
+}
+
+void *reader(void *unused){
+  long long number = 0;
+  frame_t *frame;
+
+  while((frame = queue_take(&free_frames)) != NULL){
+    size_t size = (size_t)width * height, got;
+
+    if(atomic_load(&stream_failed)) break;
+
+    if(!raw && number > 0){
+      int w, h, status = read_header(&w, &h);
+      if(status == 1) break;
+      if(status != 0 || w != width || h != height){
+        fprintf(stderr, "frame %lld: not a %dx%d binary PGM frame, "
+                "stopping\n", number, width, height);
+        input_failed = 1;
+        break;
+      }
+    }
+    got = fread(frame->in.pixels, 1, size, input);
+    if(got != size){
+      // A raw stream ends between frames; a PGM one after a header is bad
+      if(got > 0 || !raw || ferror(input)){
+        fprintf(stderr, "frame %lld is short, stopping\n", number);
+        input_failed = 1;
+      }
+      break;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &frame->read_at);
+    frame->number = number++;
+    queue_put(&read_frames, frame);
+  }
+  queue_close(&read_frames);
+  return NULL;
+}
+
+void *detector(void *unused){
+  frame_t *frame;
+
+  while((frame = queue_take(&read_frames)) != NULL){
+    frame->failed = atomic_load(&stream_failed);
+    if(frame->failed){
+      // Read before the stream stopped; it is not written either way
+    } else if(use_pipeline &&
+       pipeline_run(&pipeline, &frame->in, &frame->out, 0, height) != 0){
+      fprintf(stderr, "frame %lld: out of memory, stopping\n",
+              frame->number);
+      frame->failed = 1;
+      atomic_store(&stream_failed, 1);
+    } else if(!use_pipeline){
+      detect_edges_rows(&frame->in, &frame->out, 0, height);
+    }
+    queue_put(&done_frames, frame);
+  }
+  pthread_mutex_lock(&detectors_lock);
+  if(--detectors_left == 0) queue_close(&done_frames);
+  pthread_mutex_unlock(&detectors_lock);
+  return NULL;
+}
+
+long long elapsed_ns(struct timespec *start, struct timespec *finish){
+  return (finish->tv_sec - start->tv_sec) * 1000000000LL +
+         (finish->tv_nsec - start->tv_nsec);
+}
+
+void record_latency(frame_t *frame){
+  static long long room;
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  if(n_written == room){
+    room = room ? room * 2 : 4096;
+    latencies = realloc(latencies, room * sizeof(long long));
+    written_at = realloc(written_at, room * sizeof(struct timespec));
+    if(latencies == NULL || written_at == NULL){
+      fprintf(stderr, "out of memory\n");
+      exit(1);
+    }
+  }
+  latencies[n_written] = elapsed_ns(&frame->read_at, &now);
+  written_at[n_written] = now;
+  n_written++;
+}
+
+void *writer(void *unused){
+  frame_t *waiting[MAX_FRAMES] = {NULL};  // Done early, by frame number
+  long long next = 0;
+  frame_t *frame;
+  int stopped = 0;           // Nothing after a failed frame is written
+  int write_failed = 0;
+
+  while((frame = queue_take(&done_frames)) != NULL){
+    waiting[frame->number % n_frames] = frame;
+    // There are never more than n_frames frames about, so none can clash
+    while((frame = waiting[next % n_frames]) != NULL &&
+          frame->number == next){
+      waiting[next % n_frames] = NULL;
+      if(frame->failed) stopped = 1;
+      if(!stopped && output != NULL &&
+         ((!raw && fprintf(output, "P5\n%d %d\n255\n", width, height) < 0) ||
+          fwrite(frame->out.pixels, 1, (size_t)width * height, output) !=
+          (size_t)width * height)){
+        fprintf(stderr, "frame %lld: writing the edges: %s, stopping\n",
+                frame->number, strerror(errno));
+        write_failed = stopped = 1;
+        atomic_store(&stream_failed, 1);
+      }
+      if(!stopped) record_latency(frame);
+      next++;
+      queue_put(&free_frames, frame);
+    }
+  }
+  if(output != NULL && !write_failed && fflush(output) != 0){
+    fprintf(stderr, "writing the edges: %s\n", strerror(errno));
+    atomic_store(&stream_failed, 1);
+  }
+  return NULL;
+}
+
+int compare_ns(const void *a, const void *b){
+  long long x = *(const long long *)a, y = *(const long long *)b;
+  return x < y ? -1 : x > y;
+}
+
+double percentile_ms(long long *sorted, long long n, double p){
+  long long i = p / 100 * (n - 1) + 0.5;
+  return sorted[i] / 1e6;
+}
+
+int main(int argc, char **argv){
+  pthread_t read_thread, write_thread, threads[MAX_THREADS];
+  int n_threads = sysconf(_SC_NPROCESSORS_ONLN) - 2;
+  const char *output_name = NULL;
+  struct timespec start, finish;
+  double seconds;
+  int opt, i;
+
+  n_frames = 0;
+  while((opt = getopt(argc, argv, "s:t:b:o:p:W:")) != -1){
+    switch(opt){
+      case 's':
+        if(sscanf(optarg, "%dx%d", &width, &height) != 2 || width < 1 ||
+           height < 1){
+          fprintf(stderr, "-s takes the frame size as WxH\n");
+          return 1;
+        }
+        raw = 1;
+        break;
+      case 't': n_threads = atoi(optarg); break;
+      case 'b': n_frames = atoi(optarg); break;
+      case 'o': output_name = optarg; break;
+      case 'p':
+        if(pipeline_parse(optarg, &pipeline) != 0) return 1;
+        use_pipeline = 1;
+        break;
+      case 'W': warm_up = atoi(optarg); break;
+      default:
+        fprintf(stderr, "usage: %s [-s WxH] [-t threads] [-b buffers] "
+                "[-o output] [-p pipeline] [-W frames] [input]\n", argv[0]);
+        return 1;
+    }
+  }
+  if(n_threads < 1) n_threads = 1;
+  if(n_threads > MAX_THREADS) n_threads = MAX_THREADS;
+  if(n_frames < 1) n_frames = 2 * n_threads + 2;
+  if(n_frames < 2) n_frames = 2;
+  if(n_frames > MAX_FRAMES) n_frames = MAX_FRAMES;
+  if(warm_up < 0) warm_up = 0;
+
+  if(optind >= argc || strcmp(argv[optind], "-") == 0){
+    input = stdin;
+  } else if((input = fopen(argv[optind], "rb")) == NULL){
+    perror(argv[optind]);
+    return 1;
+  }
+  if(output_name != NULL){
+    output = strcmp(output_name, "-") == 0 ? stdout
+                                           : fopen(output_name, "wb");
+    if(output == NULL){
+      perror(output_name);
+      return 1;
+    }
+  }
+  setvbuf(input, NULL, _IOFBF, 1 << 20);
+  if(first_header() != 0) return 1;
+
+  for(i=0; i<n_frames; i++){
+    if(image_create(&frames[i].in, width, height) != 0 ||
+       image_create(&frames[i].out, width, height) != 0){
+      fprintf(stderr, "out of memory for %d frames of %dx%d\n", n_frames,
+              width, height);
+      return 1;
+    }
+  }
+  queue_init(&free_frames);
+  queue_init(&read_frames);
+  queue_init(&done_frames);
+  for(i=0; i<n_frames; i++){
+    queue_put(&free_frames, &frames[i]);
+  }
+  fprintf(stderr, "%dx%d %s frames, %d detect threads, %d buffers, %s\n",
+          width, height, raw ? "raw" : "PGM", n_threads, n_frames,
+          use_pipeline ? "pipeline" : edge_detect_kernel());
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  detectors_left = n_threads;
+  pthread_create(&read_thread, NULL, reader, NULL);
+  for(i=0; i<n_threads; i++){
+    pthread_create(&threads[i], NULL, detector, NULL);
+  }
+  pthread_create(&write_thread, NULL, writer, NULL);
+
+  pthread_join(read_thread, NULL);
+  for(i=0; i<n_threads; i++){
+    pthread_join(threads[i], NULL);
+  }
+  pthread_join(write_thread, NULL);
+  clock_gettime(CLOCK_MONOTONIC, &finish);
+  seconds = elapsed_ns(&start, &finish) / 1e9;
+
+  fprintf(stderr, "%lld frames in %0.3fs, %0.1f frames/s, %0.1f MPix/s\n",
+          n_written, seconds, n_written / seconds,
+          n_written * (double)width * height / seconds / 1e6);
+  if(n_written > warm_up + 1){
+    long long steady = elapsed_ns(&written_at[warm_up],
+                                  &written_at[n_written - 1]);
+    fprintf(stderr, "steady state after %d frames: %0.1f frames/s\n",
+            warm_up, (n_written - 1 - warm_up) / (steady / 1e9));
+  }
+  if(n_written > 0){
+    qsort(latencies, n_written, sizeof(long long), compare_ns);
+    fprintf(stderr, "latency ms: p50 %0.3f, p90 %0.3f, p99 %0.3f, "
+            "max %0.3f\n", percentile_ms(latencies, n_written, 50),
+            percentile_ms(latencies, n_written, 90),
+            percentile_ms(latencies, n_written, 99),
+            latencies[n_written - 1] / 1e6);
+  }
+  fprintf(stderr, "waits: detect for read %lld, write for detect %lld, "
+          "read for a free buffer %lld\n", read_frames.waits,
+          done_frames.waits, free_frames.waits);
+
+  if(output != NULL && output != stdout && fclose(output) != 0){
+    perror(output_name);
+    atomic_store(&stream_failed, 1);
+  }
+  if(input != stdin) fclose(input);
+  for(i=0; i<n_frames; i++){
+    image_free(&frames[i].in);
+    image_free(&frames[i].out);
+  }
+  free(latencies);
+  free(written_at);
+  return atomic_load(&stream_failed) || input_failed ? 1 : 0;
+}
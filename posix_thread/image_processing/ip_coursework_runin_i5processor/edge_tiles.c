@@ -0,0 +1,310 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <errno.h>
+#include "image_io.h"
+#include "edge_detect.h"
+
+/******************************************************************************
+  Detects the edges of an image that may be larger than memory, such as a
+  satellite picture or a scan of many gigapixels, reading it from a binary
+  PGM file and writing the edges to another:
+    ./edge_tiles [-t threads] [-m megabytes] [-a bands] in.pgm edges.pgm
+
+  Both files are mapped into memory (see image_io.h), so the program can
+  address every pixel, but only a few of them are ever in memory at once.
+  The image is cut into bands of whole rows, the largest tiles that are
+  each one stretch of the file. A band reads the row above and the row
+  below it as well, the one pixel halo of the edge detector, and writes
+  only its own rows, so the threads can take bands in any order. Each
+  thread takes the next band, and the bands are retired in order once
+  done:
+    - the edges of a band start going out to the file as soon as it is
+      done (sync_file_range), and when it is retired the program waits for
+      them to be written and drops them from memory,
+    - the input rows that no band still to come reads are dropped too,
+      both from this process (madvise) and from the page cache
+      (posix_fadvise), which would otherwise fill up with the whole image.
+  A thread waits before taking a band more than 2 x threads bands past the
+  oldest one not retired, so that memory stays bounded however large the
+  image is. As a thread takes a band it asks for the input of the band -a
+  bands later (by default the number of threads) to be read in
+  (MADV_WILLNEED), so that reading overlaps with detecting.
+
+  -m is the memory, in megabytes, that the bands in flight may take up,
+  including those being read ahead (default 256). The bands are sized to
+  fit it, but are never less than one row, so images of rows wider than
+  that take more. At the end the speed and the largest resident memory of
+  the process are printed.
+
+  The edges are synced to the file before the program says it is done; if
+  any of them could not be written it exits with 1.
+
+  Only PGM files are read, as a PPM would be converted to grey in memory.
+
+  Compile with:
+    cc -O2 -o edge_tiles edge_tiles.c edge_detect.c image_io.c -pthread
+******************************************************************************/
+
+#define MAX_THREADS 256
+
+image_t image, results;
+int in_fd, out_fd;
+long page_size;
+int band_rows, n_bands, window, lookahead;
+
+pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t retired_changed = PTHREAD_COND_INITIALIZER;
+int next_band, retired;
+unsigned char *done;
+size_t in_released, out_released;  // File offsets below which all is gone
+int write_error;                    // The first errno writing the edges
+
+/**
+ The part of the file holding rows first to end of an image, as offsets,
+ with start rounded down and finish rounded up to whole pages if outward,
+ otherwise start rounded up and finish rounded down.
+*/
+
+void file_rows(const image_t *im, int first, int end, int outward,
+               size_t *start, size_t *finish) {
+  size_t header = im->pixels - (unsigned char *)im->map;
+  size_t mask = page_size - 1;
+
+  *start = header + (size_t)first * im->stride;
+  *finish = header + (size_t)end * im->stride;
+  if(outward) {
+    *start &= ~mask;
+    *finish = (*finish + mask) & ~mask;
+  } else {
+    *start = (*start + mask) & ~mask;
+    *finish &= ~mask;
+  }
+  if(*finish > im->map_length) *finish = im->map_length;
+}
+
+int band_end(int band) {
+  int end = (band + 1) * band_rows;
+  return end < image.height ? end : image.height;
+}
+
+void prefetch(int band) {
+  size_t start, finish;
+
+  if(band >= n_bands) return;
+  file_rows(&image, band * band_rows - 1 < 0 ? 0 : band * band_rows - 1,
+            band_end(band) + 1 > image.height ? image.height
+                                              : band_end(band) + 1,
+            1, &start, &finish);
+  madvise((char *)image.map + start, finish - start, MADV_WILLNEED);
+}
+
+void failed_write(int error) {
+  pthread_mutex_lock(&lock);
+  if(write_error == 0) write_error = error;
+  pthread_mutex_unlock(&lock);
+}
+
+/**
+ Drops from memory the file offsets from to upto of a mapped file. Edges
+ that could not be written are kept, and the error is noted.
+*/
+
+void release(const image_t *im, int fd, size_t from, size_t upto,
+             int written) {
+  if(upto <= from) return;
+  if(written &&
+     sync_file_range(fd, from, upto - from, SYNC_FILE_RANGE_WAIT_BEFORE |
+                     SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER)
+     != 0) {
+    failed_write(errno);
+    return;
+  }
+  madvise((char *)im->map + from, upto - from, MADV_DONTNEED);
+  posix_fadvise(fd, from, upto - from, POSIX_FADV_DONTNEED);
+}
+
+void *detect_bands(void *arg) {
+  for(;;) {
+    size_t start, finish, in_from, in_upto, out_from, out_upto;
+    int band, first, end;
+
+    pthread_mutex_lock(&lock);
+    band = next_band++;
+    while(band < n_bands && band >= retired + window) {
+      pthread_cond_wait(&retired_changed, &lock);
+    }
+    pthread_mutex_unlock(&lock);
+    if(band >= n_bands) break;
+
+    prefetch(band + lookahead);
+    first = band * band_rows;
+    end = band_end(band);
+    detect_edges_rows(&image, &results, first, end);
+    file_rows(&results, first, end, 1, &start, &finish);
+    if(sync_file_range(out_fd, start, finish - start,
+                       SYNC_FILE_RANGE_WRITE) != 0) {
+      failed_write(errno);
+    }
+
+    // Retire every band done in order; what they free is freed outside
+    // the lock, as waiting for the writes to finish takes a while
+    pthread_mutex_lock(&lock);
+    done[band] = 1;
+    while(retired < n_bands && done[retired]) retired++;
+    in_from = in_released;
+    out_from = out_released;
+    if(retired == n_bands) {
+      in_upto = image.map_length;
+      out_upto = results.map_length;
+    } else if(retired == 0) {
+      in_upto = in_from;
+      out_upto = out_from;
+    } else {
+      // The next band reads the last row of the one before it
+      file_rows(&image, 0, retired * band_rows - 1, 0, &start, &in_upto);
+      file_rows(&results, 0, retired * band_rows, 0, &start, &out_upto);
+    }
+    if(in_upto > in_released) in_released = in_upto;
+    if(out_upto > out_released) out_released = out_upto;
+    pthread_cond_broadcast(&retired_changed);
+    pthread_mutex_unlock(&lock);
+
+    release(&image, in_fd, in_from, in_upto, 0);
+    release(&results, out_fd, out_from, out_upto, 1);
+  }
+  return NULL;
+}
+
+int time_difference(struct timespec *start, struct timespec *finish,
+                    long long int *difference) {
+  long long int ds =  finish->tv_sec - start->tv_sec;
+  long long int dn =  finish->tv_nsec - start->tv_nsec;
+
+  if(dn < 0 ) {
+    ds--;
+    dn += 1000000000;
+  }
+  *difference = ds * 1000000000 + dn;
+  return !(*difference > 0);
+}
+
+int main(int argc, char **argv) {
+  pthread_t threads[MAX_THREADS];
+  int n_threads = sysconf(_SC_NPROCESSORS_ONLN);
+  long megabytes = 256;
+  long long int time_elapsed;
+  struct timespec start, finish;
+  struct rusage usage;
+  double seconds;
+  long band_bytes;
+  int opt, i;
+
+  lookahead = -1;
+  while((opt = getopt(argc, argv, "t:m:a:")) != -1) {
+    switch(opt) {
+      case 't': n_threads = atoi(optarg); break;
+      case 'm': megabytes = atol(optarg); break;
+      case 'a': lookahead = atoi(optarg); break;
+      default:
+        fprintf(stderr, "usage: %s [-t threads] [-m megabytes] [-a bands] "
+                "in.pgm edges.pgm\n", argv[0]);
+        return 1;
+    }
+  }
+  if(argc - optind != 2) {
+    fprintf(stderr, "usage: %s [-t threads] [-m megabytes] [-a bands] "
+            "in.pgm edges.pgm\n", argv[0]);
+    return 1;
+  }
+  if(n_threads < 1) n_threads = 1;
+  if(n_threads > MAX_THREADS) n_threads = MAX_THREADS;
+  if(lookahead < 0) lookahead = n_threads;
+  if(megabytes < 1) megabytes = 1;
+  page_size = sysconf(_SC_PAGESIZE);
+
+  if(image_load(argv[optind], &image) != 0) {
+    return 1;
+  }
+  if(image.map == NULL) {
+    fprintf(stderr, "%s: only PGM files can be worked on in place\n",
+            argv[optind]);
+    return 1;
+  }
+  if(image_create_pgm(argv[optind + 1], &results, image.width,
+                      image.height) != 0) {
+    return 1;
+  }
+  in_fd = open(argv[optind], O_RDONLY);
+  out_fd = open(argv[optind + 1], O_RDONLY);
+  if(in_fd < 0 || out_fd < 0) {
+    perror("open");
+    return 1;
+  }
+  // image_load() asked for read ahead of the whole file; the bands ask
+  // for what they need instead
+  madvise(image.map, image.map_length, MADV_NORMAL);
+
+  // Each band in the window takes its input and its output; each band
+  // being read ahead, its input
+  window = 2 * n_threads;
+  band_bytes = megabytes * 1048576 / (2 * window + lookahead);
+  band_rows = band_bytes / image.width;
+  if(band_rows < 1) band_rows = 1;
+  if(band_rows > image.height) band_rows = image.height;
+  n_bands = (image.height + band_rows - 1) / band_rows;
+  done = calloc(n_bands, 1);
+  if(done == NULL) {
+    fprintf(stderr, "out of memory\n");
+    return 1;
+  }
+
+  printf("image dimensions %dx%d, %d threads, %d bands of %d rows, "
+         "%d read ahead, %s kernel\n", image.width, image.height, n_threads,
+         n_bands, band_rows, lookahead, edge_detect_kernel());
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for(i=0;i<lookahead;i++) {
+    prefetch(i);
+  }
+  for(i=0;i<n_threads;i++) {
+    pthread_create(&threads[i], NULL, detect_bands, NULL);
+  }
+  for(i=0;i<n_threads;i++) {
+    pthread_join(threads[i], NULL);
+  }
+  // Whatever is still only in memory, and any error writing back what
+  // was not, comes out here
+  if(msync(results.map, results.map_length, MS_SYNC) != 0 &&
+     write_error == 0) {
+    write_error = errno;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &finish);
+  time_difference(&start, &finish, &time_elapsed);
+  seconds = time_elapsed / 1.0e9;
+
+  getrusage(RUSAGE_SELF, &usage);
+  printf("Time elapsed was %lldns or %0.9lfs, %0.1f MPix/s, %0.1f MB/s, "
+         "largest resident memory %ld MB\n", time_elapsed, seconds,
+         (double)image.width * image.height / seconds / 1e6,
+         (double)(image.map_length + results.map_length) / seconds / 1e6,
+         usage.ru_maxrss / 1024);
+
+  close(in_fd);
+  close(out_fd);
+  free(done);
+  image_free(&image);
+  image_free(&results);
+  if(write_error != 0) {
+    fprintf(stderr, "%s: %s\n", argv[optind + 1], strerror(write_error));
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,240 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include "image_io.h"
+
+/******************************************************************************
+  The loader and writer behind image_io.h.
+
+  Compile with the program that uses it.
+******************************************************************************/
+
+/**
+ Reads the next number of a PNM header, skipping white space and comments.
+ Returns -1 if there is none.
+*/
+
+static long header_number(const unsigned char *p, size_t length, size_t *at){
+  long n = 0;
+  int digits = 0;
+
+  while(*at < length){
+    if(p[*at] == '#'){
+      while(*at < length && p[*at] != '\n') (*at)++;
+    } else if(isspace(p[*at])){
+      (*at)++;
+    } else {
+      break;
+    }
+  }
+  while(*at < length && isdigit(p[*at]) && digits < 9){
+    n = n * 10 + (p[*at] - '0');
+    (*at)++;
+    digits++;
+  }
+  return digits > 0 ? n : -1;
+}
+
+int image_load(const char *filename, image_t *image){
+  int fd = open(filename, O_RDONLY);
+  struct stat st;
+  unsigned char *p;
+  long width, height, maxval;
+  size_t at = 2, pixel_bytes;
+  int channels;
+
+  memset(image, 0, sizeof(*image));
+  if(fd < 0 || fstat(fd, &st) != 0){
+    perror(filename);
+    if(fd >= 0) close(fd);
+    return -1;
+  }
+  if(st.st_size < 8){
+    fprintf(stderr, "%s: not a PGM or PPM file\n", filename);
+    close(fd);
+    return -1;
+  }
+  p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(p == MAP_FAILED){
+    perror(filename);
+    return -1;
+  }
+  image->map = p;
+  image->map_length = st.st_size;
+
+  if(p[0] != 'P' || (p[1] != '5' && p[1] != '6')){
+    fprintf(stderr, "%s: only binary PGM (P5) and PPM (P6) are read\n",
+            filename);
+    image_free(image);
+    return -1;
+  }
+  channels = p[1] == '5' ? 1 : 3;
+  width = header_number(p, st.st_size, &at);
+  height = header_number(p, st.st_size, &at);
+  maxval = header_number(p, st.st_size, &at);
+  at++;                      // The single white space after maxval
+  if(width < 1 || height < 1 || maxval < 1 || maxval > 255){
+    fprintf(stderr, "%s: bad header, or not 8 bits per sample\n", filename);
+    image_free(image);
+    return -1;
+  }
+  pixel_bytes = (size_t)width * height * channels;
+  if(at + pixel_bytes > (size_t)st.st_size){
+    fprintf(stderr, "%s: file is shorter than its header says\n", filename);
+    image_free(image);
+    return -1;
+  }
+  // The pixels are read in order, once, so ask for read ahead
+  madvise(p, st.st_size, MADV_SEQUENTIAL);
+
+  image->width = width;
+  image->height = height;
+  image->stride = width;
+  if(channels == 1){
+    image->pixels = p + at;
+  } else {
+    const unsigned char *rgb = p + at;
+    size_t i, n = (size_t)width * height;
+    image->buffer = malloc(n);
+    if(image->buffer == NULL){
+      fprintf(stderr, "%s: out of memory\n", filename);
+      image_free(image);
+      return -1;
+    }
+    // ITU-R BT.601 luma, in integers
+    for(i=0; i<n; i++, rgb+=3){
+      image->buffer[i] = (77 * rgb[0] + 150 * rgb[1] + 29 * rgb[2]) >> 8;
+    }
+    image->pixels = image->buffer;
+    munmap(image->map, image->map_length);
+    image->map = NULL;
+  }
+  return 0;
+}
+
+int image_create(image_t *image, int width, int height){
+  memset(image, 0, sizeof(*image));
+  image->buffer = calloc((size_t)width * height, 1);
+  if(image->buffer == NULL) return -1;
+  image->width = width;
+  image->height = height;
+  image->stride = width;
+  image->pixels = image->buffer;
+  return 0;
+}
+
+int image_create_pgm(const char *filename, image_t *image, int width,
+                     int height){
+  char header[64];
+  int header_length = snprintf(header, sizeof(header), "P5\n%d %d\n255\n",
+                               width, height);
+  size_t length = header_length + (size_t)width * height;
+  int fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  unsigned char *p;
+  int error;
+
+  memset(image, 0, sizeof(*image));
+  if(fd < 0){
+    perror(filename);
+    return -1;
+  }
+  // The blocks are taken now, so that a full disk is reported here rather
+  // than as a SIGBUS when a pixel is written through the map
+  error = posix_fallocate(fd, 0, length);
+  if(error != 0){
+    fprintf(stderr, "%s: %s\n", filename, strerror(error));
+    close(fd);
+    return -1;
+  }
+  p = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if(p == MAP_FAILED){
+    perror(filename);
+    return -1;
+  }
+  memcpy(p, header, header_length);
+  image->width = width;
+  image->height = height;
+  image->stride = width;
+  image->pixels = p + header_length;
+  image->map = p;
+  image->map_length = length;
+  return 0;
+}
+
+void image_wrap(image_t *image, unsigned char *pixels, int width, int height,
+                int stride){
+  memset(image, 0, sizeof(*image));
+  image->width = width;
+  image->height = height;
+  image->stride = stride;
+  image->pixels = pixels;
+}
+
+int image_write_pgm(const char *filename, const image_t *image){
+  char header[64];
+  struct iovec iov[2];
+  size_t length = (size_t)image->width * image->height;
+  unsigned char *packed = NULL;
+  ssize_t written, total;
+  int fd, y, error;
+
+  iov[0].iov_base = header;
+  iov[0].iov_len = snprintf(header, sizeof(header), "P5\n%d %d\n255\n",
+                            image->width, image->height);
+  iov[1].iov_base = image->pixels;
+  iov[1].iov_len = length;
+  if(image->stride != image->width){
+    packed = malloc(length);
+    if(packed == NULL) return -1;
+    for(y=0; y<image->height; y++){
+      memcpy(packed + (size_t)y * image->width,
+             image->pixels + (size_t)y * image->stride, image->width);
+    }
+    iov[1].iov_base = packed;
+  }
+
+  fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if(fd < 0){
+    perror(filename);
+    free(packed);
+    return -1;
+  }
+  total = iov[0].iov_len + iov[1].iov_len;
+  written = writev(fd, iov, 2);
+  // A regular file takes it all at once; anything else may need more
+  while(written >= 0 && written < total){
+    ssize_t n;
+    if((size_t)written < iov[0].iov_len){
+      n = write(fd, header + written, iov[0].iov_len - written);
+    } else {
+      n = write(fd, (char *)iov[1].iov_base + (written - iov[0].iov_len),
+                total - written);
+    }
+    written = n < 0 ? -1 : written + n;
+  }
+  free(packed);
+  // The file is closed whether or not the write failed, and the first
+  // error is the one reported
+  error = written < 0 ? errno : 0;
+  if(close(fd) != 0 && error == 0) error = errno;
+  if(error != 0){
+    fprintf(stderr, "%s: %s\n", filename, strerror(error));
+    return -1;
+  }
+  return 0;
+}
+
+void image_free(image_t *image){
+  if(image->map != NULL) munmap(image->map, image->map_length);
+  free(image->buffer);
+  memset(image, 0, sizeof(*image));
+}
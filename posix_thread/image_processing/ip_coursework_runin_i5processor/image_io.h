@@ -0,0 +1,73 @@
+#ifndef IMAGE_IO_H
+#define IMAGE_IO_H
+
+#include <stddef.h>
+
+/******************************************************************************
+  Grey scale images whose size is only known at run time.
+
+  Binary PGM (P5) files are mapped into memory with mmap and used where
+  they lie: the pixels of the image point into the mapping, so nothing is
+  copied however large the file is. Binary PPM (P6) files are mapped the
+  same way and converted to grey once, into a buffer of their own, as the
+  edge detector works on one intensity per pixel.
+
+  stride is the distance in bytes from the start of one row to the start
+  of the next. It is width for every image made here, but code that takes
+  an image_t should use stride to step between rows, so that the same code
+  works on a window into a larger image.
+
+  Only 8 bit files (maxval below 256) are read.
+******************************************************************************/
+
+typedef struct image {
+  int width;
+  int height;
+  int stride;
+  unsigned char *pixels;
+  void *map;                 // The mapped file, or NULL
+  size_t map_length;
+  unsigned char *buffer;     // Pixels allocated here, or NULL
+} image_t;
+
+/**
+ Maps a PGM or PPM file. Returns 0, or -1 with a message on stderr.
+*/
+
+int image_load(const char *filename, image_t *image);
+
+/**
+ Makes an image of width x height pixels, all 0.
+*/
+
+int image_create(image_t *image, int width, int height);
+
+/**
+ Makes a binary PGM file of width x height pixels and maps it, shared, so
+ that what is written to the pixels goes to the file, without the whole
+ image having to be in memory at once. The space for the file is taken
+ up front. It is written out when the image is freed, if not before, but
+ errors writing it only show if it is synced (msync) first. Returns 0, or
+ -1 with a message.
+*/
+
+int image_create_pgm(const char *filename, image_t *image, int width,
+                     int height);
+
+/**
+ Wraps pixels that are held elsewhere, e.g. in a compiled-in array.
+*/
+
+void image_wrap(image_t *image, unsigned char *pixels, int width, int height,
+                int stride);
+
+/**
+ Writes an image as binary PGM. Header and pixels go out in one writev()
+ call when the rows are contiguous. Returns 0, or -1 with a message.
+*/
+
+int image_write_pgm(const char *filename, const image_t *image);
+
+void image_free(image_t *image);
+
+#endif
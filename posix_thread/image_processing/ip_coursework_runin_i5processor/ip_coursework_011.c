@@ -5,6 +5,7 @@
 #include <GL/gl.h>
 #include <malloc.h>
 #include <signal.h>
+#include "image_io.h"
 
 /******************************************************************************
   Displays two grey scale images. On the left is an image that has come from an 
@@ -19,50 +20,62 @@
       represent a pixel's intensity. In this case we want 256 shades of grey,
       which is best stored in eight bits, so GL_UNSIGNED_BYTE is specified as 
       the pixel data type.
+    - The image is the compiled-in 100x72 one below, unless a binary PGM or
+      PPM file is named on the command line. Files are mapped with mmap and
+      the edges are detected straight from the mapping (see image_io.h), so
+      the size of the image is only known at run time.
     
   To compile adapt the code below wo match your filenames:  
-    cc -o ip_coursework ip_coursework_011.c -lglut -lGL -lm 
+    cc -o ip_coursework ip_coursework_011.c image_io.c -lglut -lGL -lm 
+
+  Run with:
+    ./ip_coursework [image.pgm [edges.pgm]]
+  where edges.pgm, if given, receives the result as a binary PGM file.
    
   Dr Kevan Buckley, University of Wolverhampton, 2018
 ******************************************************************************/
-#define width 100 
-#define height 72
-
-unsigned char image[], results[width * height];
+#define default_width 100 
+#define default_height 72
 
-void detect_edges(unsigned char *in, unsigned char *out) {
-  int i;
-  int n_pixels = width * height;
+unsigned char default_image[];
+image_t image, results;
 
-  for(i=0;i<n_pixels;i++) {
-    int x, y; // the pixel of interest
-    int b, d, f, h; // the pixels adjacent to x,y used for the calculation
-    int r; // the result of calculate
-    
-    y = i / width;
-    x = i - (width * y);
+void detect_edges(const image_t *in, image_t *out) {
+  int x, y;
+  int width = in->width, height = in->height, stride = in->stride;
 
-    if (x == 0 || y == 0 || x == width - 1 || y == height - 1) {
-      results[i] = 0;
-    } else {
-      b = i + width;
-      d = i - 1;
-      f = i + 1;
-      h = i - width;
+  for(y=0;y<height;y++) {
+    const unsigned char *row = in->pixels + (size_t)y * stride;
+    unsigned char *out_row = out->pixels + (size_t)y * out->stride;
 
-      r = (in[i] * 4) + (in[b] * -1) + (in[d] * -1) + (in[f] * -1)
-          + (in[h] * -1);
+    for(x=0;x<width;x++) {
+      int b, d, f, h; // the pixels adjacent to x,y used for the calculation
+      int r; // the result of calculate
 
-      if (r > 0) { // if the result is positive this is an edge pixel
-        out[i] = 255;
+      if (x == 0 || y == 0 || x == width - 1 || y == height - 1) {
+        out_row[x] = 0;
       } else {
-        out[i] = 0;
+        b = x + stride;
+        d = x - 1;
+        f = x + 1;
+        h = x - stride;
+
+        r = (row[x] * 4) + (row[b] * -1) + (row[d] * -1) + (row[f] * -1)
+            + (row[h] * -1);
+
+        if (r > 0) { // if the result is positive this is an edge pixel
+          out_row[x] = 255;
+        } else {
+          out_row[x] = 0;
+        }
       }
     }
   }
 }
 
 void tidy_and_exit() {
+  image_free(&image);
+  image_free(&results);
   exit(0);
 }
 
@@ -74,9 +87,13 @@ void sigint_callback(int signal_number){
 static void display() {
   glClear(GL_COLOR_BUFFER_BIT);
   glRasterPos4i(-1, -1, 0, 1);
-  glDrawPixels(width, height, GL_LUMINANCE, GL_UNSIGNED_BYTE, image);
+  glPixelStorei(GL_UNPACK_ROW_LENGTH, image.stride);
+  glDrawPixels(image.width, image.height, GL_LUMINANCE, GL_UNSIGNED_BYTE,
+               image.pixels);
   glRasterPos4i(0, -1, 0, 1);
-  glDrawPixels(width, height, GL_LUMINANCE, GL_UNSIGNED_BYTE, results);
+  glPixelStorei(GL_UNPACK_ROW_LENGTH, results.stride);
+  glDrawPixels(results.width, results.height, GL_LUMINANCE, GL_UNSIGNED_BYTE,
+               results.pixels);
   glFlush();
 }
 
@@ -93,18 +110,36 @@ static void key_pressed(unsigned char key, int x, int y) {
 
 int main(int argc, char **argv) {
   signal(SIGINT, sigint_callback);
+
+  if(argc > 1) {
+    if(image_load(argv[1], &image) != 0) {
+      return 1;
+    }
+  } else {
+    image_wrap(&image, default_image, default_width, default_height,
+               default_width);
+  }
+  if(image_create(&results, image.width, image.height) != 0) {
+    fprintf(stderr, "out of memory\n");
+    return 1;
+  }
  
-  printf("image dimensions %dx%d\n", width, height);
-  detect_edges(image, results);
+  printf("image dimensions %dx%d\n", image.width, image.height);
+  detect_edges(&image, &results);
+
+  if(argc > 2 && image_write_pgm(argv[2], &results) != 0) {
+    return 1;
+  }
 
   glutInit(&argc, argv);
-  glutInitWindowSize(width * 2,height);
+  glutInitWindowSize(image.width * 2, image.height);
   glutInitDisplayMode(GLUT_SINGLE | GLUT_LUMINANCE);
       
   glutCreateWindow("6CS005 Image Progessing Courework");
   glutDisplayFunc(display);
   glutKeyboardFunc(key_pressed);
   glClearColor(0.0, 1.0, 0.0, 1.0); 
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
 
   glutMainLoop(); 
 
@@ -113,7 +148,7 @@ int main(int argc, char **argv) {
   return 0;
 }
 
-unsigned char image[] = {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+unsigned char default_image[] = {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
   0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
   0,0,0,0,0,0,255,255,255,255,255,255,255,255,255,255,255,255,255,
   255,255,255,255,255,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
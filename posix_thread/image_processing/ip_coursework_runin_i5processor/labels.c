@@ -0,0 +1,564 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "labels.h"
+
+/******************************************************************************
+  The connected components behind labels.h.
+
+  While the labels are worked out, each pixel holds the index of another
+  pixel of its component, its parent, in parent[], or NONE if it is
+  background; a root is its own parent. A root is only ever pointed at one
+  with a smaller index, so the root of a component is always its first
+  pixel, and there can be no loops.
+
+  find() halves the path to the root as it goes, pointing each pixel it
+  passes at its grandparent, which is also a pixel of the component
+  whatever other threads have done meanwhile. Once every tree is joined,
+  root() finds roots without writing, so that each thread writes only the
+  parents of its own band.
+
+  Compile with the program that uses it, and -pthread.
+******************************************************************************/
+
+#define NONE UINT32_MAX
+
+const char *label_stage_names[LABEL_STAGES] = {
+  "local", "merge", "number", "measure"
+};
+
+typedef struct label_job {
+  const image_t *in;
+  labelling_t *out;
+  int threshold, connectivity, n_threads;
+  atomic_uint *parent;
+
+  pthread_barrier_t barrier;
+  int *roots;                      // Roots in each band, then the first
+                                   // label of each band
+  atomic_llong *area, *sum_x, *sum_y;
+  atomic_int *x0, *y0, *x1, *y1;
+  atomic_int failed;
+  struct timespec marks[LABEL_STAGES + 1];
+} label_job_t;
+
+typedef struct label_thread {
+  label_job_t *job;
+  int index;
+  int first_row, end_row;
+} label_thread_t;
+
+static uint32_t find(atomic_uint *parent, uint32_t i){
+  uint32_t p;
+
+  while((p = atomic_load_explicit(&parent[i], memory_order_relaxed)) != i){
+    uint32_t g = atomic_load_explicit(&parent[p], memory_order_relaxed);
+    if(g != p) atomic_store_explicit(&parent[i], g, memory_order_relaxed);
+    i = g;
+  }
+  return i;
+}
+
+static uint32_t root(atomic_uint *parent, uint32_t i){
+  uint32_t p;
+
+  while((p = atomic_load_explicit(&parent[i], memory_order_relaxed)) != i){
+    i = p;
+  }
+  return i;
+}
+
+/**
+ Joins the trees of a and b, pointing the later root at the earlier.
+*/
+
+static void join(atomic_uint *parent, uint32_t a, uint32_t b){
+  for(;;){
+    uint32_t expected;
+
+    a = find(parent, a);
+    b = find(parent, b);
+    if(a == b) return;
+    if(a < b){
+      uint32_t t = a;
+      a = b;
+      b = t;
+    }
+    expected = a;
+    if(atomic_compare_exchange_weak(&parent[a], &expected, b)) return;
+  }
+}
+
+/**
+ Joins two trees of the band, which no other thread is working on.
+*/
+
+static uint32_t join_local(atomic_uint *parent, uint32_t a, uint32_t b){
+  if(a == NONE) return b;
+  if(a == b) return a;
+  if(a < b){
+    atomic_store_explicit(&parent[b], a, memory_order_relaxed);
+    return a;
+  }
+  atomic_store_explicit(&parent[a], b, memory_order_relaxed);
+  return b;
+}
+
+static uint32_t parent_of(atomic_uint *parent, uint32_t i){
+  return atomic_load_explicit(&parent[i], memory_order_relaxed);
+}
+
+/**
+ Labels a band a row at a time. A pixel joins the tree of the pixel to its
+ left, found as it was made; only when the pixels above belong to another
+ tree are two trees joined. In 8 connectivity the pixels above to the
+ left and right need only be looked at if the one straight above is
+ background, as otherwise they are joined to it already.
+*/
+
+static void label_band(label_job_t *job, int first_row, int end_row){
+  atomic_uint *parent = job->parent;
+  int width = job->in->width;
+  int x, y;
+
+  for(y=first_row; y<end_row; y++){
+    const unsigned char *row = job->in->pixels + (size_t)y * job->in->stride;
+    uint32_t left = NONE;            // The root of the pixel to the left
+
+    for(x=0; x<width; x++){
+      uint32_t i = (uint32_t)y * width + x, r = left;
+
+      if(row[x] <= job->threshold){
+        atomic_store_explicit(&parent[i], NONE, memory_order_relaxed);
+        left = NONE;
+        continue;
+      }
+      if(y > first_row){
+        uint32_t up = i - width;
+        if(parent_of(parent, up) != NONE){
+          r = join_local(parent, r, find(parent, up));
+        } else if(job->connectivity == 8){
+          if(x > 0 && parent_of(parent, up - 1) != NONE){
+            r = join_local(parent, r, find(parent, up - 1));
+          }
+          if(x < width - 1 && parent_of(parent, up + 1) != NONE){
+            r = join_local(parent, r, find(parent, up + 1));
+          }
+        }
+      }
+      atomic_store_explicit(&parent[i], r == NONE ? i : r,
+                            memory_order_relaxed);
+      left = r == NONE ? i : r;
+    }
+  }
+}
+
+/**
+ Joins the components of row y to those of the row above, in another band.
+*/
+
+static void merge_row(label_job_t *job, int y){
+  atomic_uint *parent = job->parent;
+  int width = job->in->width;
+  int x, dx;
+
+  for(x=0; x<width; x++){
+    uint32_t i = (uint32_t)y * width + x;
+
+    if(parent[i] == NONE) continue;
+    for(dx=-1; dx<=1; dx++){
+      if(dx != 0 && (job->connectivity == 4 || x + dx < 0 ||
+                     x + dx >= width)){
+        continue;
+      }
+      if(parent[i - width + dx] != NONE) join(parent, i, i - width + dx);
+    }
+  }
+}
+
+static void atomic_min(atomic_int *a, int v){
+  int old = atomic_load_explicit(a, memory_order_relaxed);
+  while(v < old && !atomic_compare_exchange_weak(a, &old, v));
+}
+
+static void atomic_max(atomic_int *a, int v){
+  int old = atomic_load_explicit(a, memory_order_relaxed);
+  while(v > old && !atomic_compare_exchange_weak(a, &old, v));
+}
+
+/**
+ Adds the run of pixels x0 to x1 (ends included) of row y to label l.
+*/
+
+static void measure_run(label_job_t *job, uint32_t l, int y, int x0, int x1){
+  long long n = x1 - x0 + 1;
+
+  l--;
+  atomic_fetch_add_explicit(&job->area[l], n, memory_order_relaxed);
+  atomic_fetch_add_explicit(&job->sum_x[l], n * (x0 + x1) / 2,
+                            memory_order_relaxed);
+  atomic_fetch_add_explicit(&job->sum_y[l], n * y, memory_order_relaxed);
+  atomic_min(&job->x0[l], x0);
+  atomic_min(&job->y0[l], y);
+  atomic_max(&job->x1[l], x1);
+  atomic_max(&job->y1[l], y);
+}
+
+static void measure_band(label_job_t *job, int first_row, int end_row){
+  const uint32_t *labels = job->out->labels;
+  int width = job->in->width;
+  int x, y, start;
+
+  for(y=first_row; y<end_row; y++){
+    const uint32_t *row = labels + (size_t)y * width;
+    for(x=0; x<width; x=start){
+      start = x + 1;
+      if(row[x] == 0) continue;
+      while(start < width && row[start] == row[x]) start++;
+      measure_run(job, row[x], y, x, start - 1);
+    }
+  }
+}
+
+/**
+ Makes the arrays the components are measured in, once they are counted.
+*/
+
+static int make_measures(label_job_t *job, int n){
+  int i;
+
+  job->area = calloc(n + 1, sizeof(atomic_llong));
+  job->sum_x = calloc(n + 1, sizeof(atomic_llong));
+  job->sum_y = calloc(n + 1, sizeof(atomic_llong));
+  job->x0 = malloc((n + 1) * sizeof(atomic_int));
+  job->y0 = malloc((n + 1) * sizeof(atomic_int));
+  job->x1 = malloc((n + 1) * sizeof(atomic_int));
+  job->y1 = malloc((n + 1) * sizeof(atomic_int));
+  job->out->components = calloc(n + 1, sizeof(component_t));
+  if(job->area == NULL || job->sum_x == NULL || job->sum_y == NULL ||
+     job->x0 == NULL || job->y0 == NULL || job->x1 == NULL ||
+     job->y1 == NULL || job->out->components == NULL){
+    return -1;
+  }
+  for(i=0; i<n; i++){
+    atomic_init(&job->x0[i], job->in->width);
+    atomic_init(&job->y0[i], job->in->height);
+    atomic_init(&job->x1[i], -1);
+    atomic_init(&job->y1[i], -1);
+  }
+  job->out->n_components = n;
+  return 0;
+}
+
+static void stage_done(label_thread_t *t, int stage){
+  pthread_barrier_wait(&t->job->barrier);
+  if(t->index == 0) clock_gettime(CLOCK_MONOTONIC, &t->job->marks[stage]);
+}
+
+static void *label_thread(void *arg){
+  label_thread_t *t = arg;
+  label_job_t *job = t->job;
+  atomic_uint *parent = job->parent;
+  uint32_t *labels = job->out->labels;
+  int width = job->in->width;
+  size_t first = (size_t)t->first_row * width;
+  size_t end = (size_t)t->end_row * width;
+  size_t i;
+  int n, l;
+
+  stage_done(t, 0);
+  label_band(job, t->first_row, t->end_row);
+  stage_done(t, 1);
+  if(t->first_row > 0 && t->first_row < t->end_row){
+    merge_row(job, t->first_row);
+  }
+  stage_done(t, 2);
+
+  // Every pixel is pointed at its root and the roots of the band counted;
+  // then, given the roots of the bands before, they are numbered
+  for(i=first, n=0; i<end; i++){
+    uint32_t p = atomic_load_explicit(&parent[i], memory_order_relaxed);
+    if(p == NONE) continue;
+    p = root(parent, p);
+    atomic_store_explicit(&parent[i], p, memory_order_relaxed);
+    n += p == i;
+  }
+  job->roots[t->index] = n;
+  pthread_barrier_wait(&job->barrier);
+  if(t->index == 0){
+    int k, total = 0;
+    for(k=0; k<job->n_threads; k++){
+      int roots = job->roots[k];
+      job->roots[k] = total;
+      total += roots;
+    }
+    if(make_measures(job, total) != 0) atomic_store(&job->failed, 1);
+  }
+  pthread_barrier_wait(&job->barrier);
+  for(i=first, l=job->roots[t->index]; i<end; i++){
+    if(atomic_load_explicit(&parent[i], memory_order_relaxed) == i){
+      labels[i] = ++l;
+    }
+  }
+  pthread_barrier_wait(&job->barrier);
+  for(i=first; i<end; i++){
+    uint32_t p = atomic_load_explicit(&parent[i], memory_order_relaxed);
+    if(p == NONE){
+      labels[i] = 0;
+    } else if(p != i){
+      labels[i] = labels[p];
+    }
+  }
+  stage_done(t, 3);
+
+  if(!atomic_load(&job->failed)) measure_band(job, t->first_row, t->end_row);
+  stage_done(t, 4);
+  return NULL;
+}
+
+static long long nanoseconds(const struct timespec *start,
+                             const struct timespec *finish){
+  return (finish->tv_sec - start->tv_sec) * 1000000000LL +
+         (finish->tv_nsec - start->tv_nsec);
+}
+
+static void finish_components(labelling_t *out, const long long *area,
+                              const long long *sum_x, const long long *sum_y){
+  int c;
+
+  for(c=0; c<out->n_components; c++){
+    out->components[c].area = area[c];
+    out->components[c].cx = (double)sum_x[c] / area[c];
+    out->components[c].cy = (double)sum_y[c] / area[c];
+  }
+}
+
+int label_components(const image_t *in, int threshold, int connectivity,
+                     int n_threads, labelling_t *out, label_times_t *times){
+  label_job_t job;
+  label_thread_t *threads;
+  pthread_t *ids;
+  size_t n = (size_t)in->width * in->height;
+  int i, failed;
+
+  memset(out, 0, sizeof(*out));
+  memset(&job, 0, sizeof(job));
+  if(n_threads < 1) n_threads = 1;
+  if(n >= NONE) return -1;
+  job.in = in;
+  job.out = out;
+  job.threshold = threshold;
+  job.connectivity = connectivity == 4 ? 4 : 8;
+  job.n_threads = n_threads;
+  out->width = in->width;
+  out->height = in->height;
+  out->labels = malloc(n * sizeof(uint32_t));
+  job.parent = malloc(n * sizeof(atomic_uint));
+  job.roots = malloc(n_threads * sizeof(int));
+  threads = calloc(n_threads, sizeof(label_thread_t));
+  ids = malloc(n_threads * sizeof(pthread_t));
+  failed = out->labels == NULL || job.parent == NULL || job.roots == NULL ||
+           threads == NULL || ids == NULL;
+
+  if(!failed){
+    pthread_barrier_init(&job.barrier, NULL, n_threads);
+    for(i=0; i<n_threads; i++){
+      threads[i].job = &job;
+      threads[i].index = i;
+      threads[i].first_row = (long)in->height * i / n_threads;
+      threads[i].end_row = (long)in->height * (i + 1) / n_threads;
+      if(i > 0) pthread_create(&ids[i], NULL, label_thread, &threads[i]);
+    }
+    label_thread(&threads[0]);
+    for(i=1; i<n_threads; i++){
+      pthread_join(ids[i], NULL);
+    }
+    pthread_barrier_destroy(&job.barrier);
+    failed = atomic_load(&job.failed);
+  }
+
+  if(!failed){
+    // The atomic arrays are read as plain ones now that the threads are done
+    for(i=0; i<out->n_components; i++){
+      component_t *c = &out->components[i];
+      c->x0 = job.x0[i];
+      c->y0 = job.y0[i];
+      c->x1 = job.x1[i];
+      c->y1 = job.y1[i];
+    }
+    finish_components(out, (long long *)job.area, (long long *)job.sum_x,
+                      (long long *)job.sum_y);
+    if(times != NULL){
+      for(i=0; i<LABEL_STAGES; i++){
+        times->stage[i] = nanoseconds(&job.marks[i], &job.marks[i + 1]);
+      }
+    }
+  }
+
+  free(threads);
+  free(ids);
+  free(job.parent);
+  free(job.roots);
+  free(job.area);
+  free(job.sum_x);
+  free(job.sum_y);
+  free(job.x0);
+  free(job.y0);
+  free(job.x1);
+  free(job.y1);
+  if(failed){
+    labelling_free(out);
+    return -1;
+  }
+  return 0;
+}
+
+typedef struct fill {
+  size_t *stack;
+  size_t n, max;
+} fill_t;
+
+static int fill_push(fill_t *f, size_t at){
+  if(f->n == f->max){
+    size_t max = f->max ? f->max * 2 : 4096;
+    size_t *stack = realloc(f->stack, max * sizeof(size_t));
+    if(stack == NULL) return -1;
+    f->stack = stack;
+    f->max = max;
+  }
+  f->stack[f->n++] = at;
+  return 0;
+}
+
+/**
+ Labels the component whose first pixel is i as l, filling it from there,
+ and measures it.
+*/
+
+static int fill(const image_t *in, int threshold, int connectivity,
+                labelling_t *out, fill_t *f, size_t i, uint32_t l,
+                long long *sum_x, long long *sum_y){
+  component_t *c = &out->components[l - 1];
+  int width = in->width, height = in->height;
+  int dx, dy;
+
+  c->x0 = c->x1 = i % width;
+  c->y0 = c->y1 = i / width;
+  *sum_x = *sum_y = 0;
+  out->labels[i] = l;
+  if(fill_push(f, i) != 0) return -1;
+  while(f->n > 0){
+    size_t at = f->stack[--f->n];
+    int x = at % width, y = at / width;
+
+    c->area++;
+    *sum_x += x;
+    *sum_y += y;
+    if(x < c->x0) c->x0 = x;
+    if(x > c->x1) c->x1 = x;
+    if(y < c->y0) c->y0 = y;
+    if(y > c->y1) c->y1 = y;
+    for(dy=-1; dy<=1; dy++){
+      for(dx=-1; dx<=1; dx++){
+        size_t next = at + (long)dy * width + dx;
+        if(dx == 0 && dy == 0) continue;
+        if(connectivity == 4 && dx != 0 && dy != 0) continue;
+        if(x + dx < 0 || x + dx >= width || y + dy < 0 ||
+           y + dy >= height || out->labels[next] != 0 ||
+           in->pixels[(size_t)(y + dy) * in->stride + x + dx] <= threshold){
+          continue;
+        }
+        out->labels[next] = l;
+        if(fill_push(f, next) != 0) return -1;
+      }
+    }
+  }
+  return 0;
+}
+
+int label_components_reference(const image_t *in, int threshold,
+                               int connectivity, labelling_t *out){
+  int width = in->width;
+  size_t n = (size_t)width * in->height, i;
+  long long *sum_x = NULL, *sum_y = NULL;
+  fill_t f = {NULL, 0, 0};
+  int max_components = 0, failed = 0;
+
+  memset(out, 0, sizeof(*out));
+  out->width = width;
+  out->height = in->height;
+  out->labels = calloc(n, sizeof(uint32_t));
+  failed = out->labels == NULL;
+
+  for(i=0; i<n && !failed; i++){
+    if(out->labels[i] != 0 ||
+       in->pixels[(i / width) * in->stride + i % width] <= threshold){
+      continue;
+    }
+    if(out->n_components == max_components){
+      component_t *components;
+      max_components = max_components ? max_components * 2 : 1024;
+      components = realloc(out->components,
+                           max_components * sizeof(component_t));
+      if(components != NULL) out->components = components;
+      sum_x = realloc(sum_x, max_components * sizeof(long long));
+      sum_y = realloc(sum_y, max_components * sizeof(long long));
+      if(components == NULL || sum_x == NULL || sum_y == NULL){
+        failed = 1;
+        break;
+      }
+    }
+    out->n_components++;
+    memset(&out->components[out->n_components - 1], 0, sizeof(component_t));
+    failed = fill(in, threshold, connectivity == 4 ? 4 : 8, out, &f, i,
+                  out->n_components, &sum_x[out->n_components - 1],
+                  &sum_y[out->n_components - 1]) != 0;
+  }
+  if(!failed){
+    long long *area = malloc((out->n_components + 1) * sizeof(long long));
+    int c;
+    failed = area == NULL;
+    for(c=0; c<out->n_components && !failed; c++){
+      area[c] = out->components[c].area;
+    }
+    if(!failed) finish_components(out, area, sum_x, sum_y);
+    free(area);
+  }
+
+  free(f.stack);
+  free(sum_x);
+  free(sum_y);
+  if(failed){
+    labelling_free(out);
+    return -1;
+  }
+  return 0;
+}
+
+int labelling_same(const labelling_t *a, const labelling_t *b){
+  int c;
+
+  if(a->width != b->width || a->height != b->height ||
+     a->n_components != b->n_components ||
+     memcmp(a->labels, b->labels,
+            (size_t)a->width * a->height * sizeof(uint32_t)) != 0){
+    return 0;
+  }
+  for(c=0; c<a->n_components; c++){
+    const component_t *p = &a->components[c], *q = &b->components[c];
+    if(p->area != q->area || p->x0 != q->x0 || p->y0 != q->y0 ||
+       p->x1 != q->x1 || p->y1 != q->y1 || p->cx != q->cx ||
+       p->cy != q->cy){
+      return 0;
+    }
+  }
+  return 1;
+}
+
+void labelling_free(labelling_t *l){
+  free(l->labels);
+  free(l->components);
+  memset(l, 0, sizeof(*l));
+}
@@ -0,0 +1,75 @@
+#ifndef LABELS_H
+#define LABELS_H
+
+#include <stdint.h>
+#include "image_io.h"
+
+/******************************************************************************
+  Connected components: every group of touching foreground pixels, such as
+  a blob of a thresholded image or a line of an edge map, is given its own
+  number, and its size, bounding box and centre are measured.
+
+  A pixel is foreground if it is above threshold (0 for an edge map) and
+  touches the foreground pixels to its left, right, above and below (4
+  connectivity) or those and the four diagonal ones too (8 connectivity).
+  Background pixels are labelled 0, and the components 1, 2, 3 ... in the
+  order their first pixels come, row by row, so that the labels are the
+  same however the work was shared out.
+
+  label_components() shares the work between threads in bands of rows:
+    local    each thread labels its own band, joining the pixels of each
+             component into a tree whose root is its first pixel
+    merge    each thread joins the trees of the last row of the band above
+             to those of its first row. Trees of different bands may be
+             joined by several threads at once, so a root is pointed at
+             the other with a compare and swap, which fails if another
+             thread has just done so, and then is tried again
+    number   every pixel is pointed straight at its root, and the roots
+             are numbered in order
+    measure  the components are measured a run of pixels at a time, with
+             atomic adds, minimums and maximums
+  label_components_reference() does the same with one thread the plain
+  way, filling each component in turn, to check the other against.
+******************************************************************************/
+
+#define LABEL_STAGES 4
+
+typedef struct component {
+  long long area;
+  int x0, y0, x1, y1;        // The bounding box, ends included
+  double cx, cy;             // The centre, the mean of the pixels
+} component_t;
+
+typedef struct labelling {
+  int width, height;
+  uint32_t *labels;          // width x height, 0 for the background
+  int n_components;
+  component_t *components;   // That of label l is components[l - 1]
+} labelling_t;
+
+typedef struct label_times {
+  long long stage[LABEL_STAGES];       // Nanoseconds, in the order above
+} label_times_t;
+
+extern const char *label_stage_names[LABEL_STAGES];
+
+/**
+ Labels the pixels of in above threshold, with connectivity 4 or 8, on
+ n_threads threads. times may be NULL. Returns 0, or -1 if out of memory.
+*/
+
+int label_components(const image_t *in, int threshold, int connectivity,
+                     int n_threads, labelling_t *out, label_times_t *times);
+
+int label_components_reference(const image_t *in, int threshold,
+                               int connectivity, labelling_t *out);
+
+/**
+ Returns 1 if two labellings have the same labels and components.
+*/
+
+int labelling_same(const labelling_t *a, const labelling_t *b);
+
+void labelling_free(labelling_t *l);
+
+#endif
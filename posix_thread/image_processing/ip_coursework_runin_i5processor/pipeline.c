@@ -0,0 +1,262 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pipeline.h"
+
+/******************************************************************************
+  The pipelines behind pipeline.h.
+
+  The stages are grouped into passes: pass 0 is the pointwise stages at the
+  start, and every stencil starts a new pass along with the pointwise
+  stages that follow it. Each pass but the last keeps a ring of the 2r + 1
+  rows that the stencil of the next pass reads, r being its radius; the
+  last pass writes straight into the output.
+
+  Compile with the program that uses it, along with convolve.c and -lm.
+******************************************************************************/
+
+typedef struct pass {
+  const stage_t *stencil;    // NULL for pass 0
+  const stage_t *pointwise[PIPELINE_MAX];
+  int n_pointwise;
+  int halo;                  // Rows needed above and below the strip
+} pass_t;
+
+int pipeline_parse(const char *spec, pipeline_t *p){
+  char text[1024], *save = NULL, *s;
+
+  memset(p, 0, sizeof(*p));
+  snprintf(text, sizeof(text), "%s", spec);
+  for(s=strtok_r(text, "|", &save); s; s=strtok_r(NULL, "|", &save)){
+    stage_t *stage = &p->stages[p->n_stages];
+
+    if(p->n_stages == PIPELINE_MAX){
+      fprintf(stderr, "%s: more than %d stages\n", spec, PIPELINE_MAX);
+      return -1;
+    }
+    if(strncmp(s, "threshold", 9) == 0 && (s[9] == '\0' || s[9] == ':')){
+      stage->kind = STAGE_THRESHOLD;
+      stage->threshold = s[9] == ':' ? atoi(s + 10) : 128;
+    } else if(strcmp(s, "invert") == 0){
+      stage->kind = STAGE_INVERT;
+    } else if(strcmp(s, "erode") == 0 || strcmp(s, "dilate") == 0){
+      stage->kind = s[0] == 'e' ? STAGE_ERODE : STAGE_DILATE;
+      stage->radius = 1;
+    } else {
+      stage->kind = STAGE_CONVOLVE;
+      if(convolution_parse(strcmp(s, "edges") == 0 ? "laplacian4" : s,
+                           &stage->kernel) != 0){
+        return -1;
+      }
+      stage->radius = stage->kernel.size / 2;
+    }
+    p->halo += stage->radius;
+    p->n_stages++;
+  }
+  if(p->n_stages == 0){
+    fprintf(stderr, "%s: no stages\n", spec);
+    return -1;
+  }
+  return 0;
+}
+
+void pipeline_describe(const pipeline_t *p, char *text, size_t size){
+  static const char *kinds[] = {"threshold", "invert", "erode", "dilate"};
+  size_t used = 0;
+  int s;
+
+  text[0] = '\0';
+  for(s=0; s<p->n_stages && used < size; s++){
+    const stage_t *stage = &p->stages[s];
+    used += snprintf(text + used, size - used, "%s%s", s ? " | " : "",
+                     stage->kind == STAGE_CONVOLVE ? stage->kernel.name
+                                                   : kinds[stage->kind]);
+  }
+}
+
+static int make_passes(const pipeline_t *p, pass_t *passes){
+  int n = 1, s, halo = p->halo;
+
+  memset(passes, 0, sizeof(pass_t) * (PIPELINE_MAX + 1));
+  passes[0].halo = halo;
+  for(s=0; s<p->n_stages; s++){
+    const stage_t *stage = &p->stages[s];
+    if(stage->radius > 0){
+      halo -= stage->radius;
+      passes[n].stencil = stage;
+      passes[n].halo = halo;
+      n++;
+    } else {
+      pass_t *pass = &passes[n - 1];
+      pass->pointwise[pass->n_pointwise++] = stage;
+    }
+  }
+  return n;
+}
+
+static void pointwise_row(const stage_t *stage, unsigned char *row,
+                          int width){
+  int x;
+
+  if(stage->kind == STAGE_THRESHOLD){
+    for(x=0; x<width; x++) row[x] = row[x] > stage->threshold ? 255 : 0;
+  } else {
+    for(x=0; x<width; x++) row[x] = 255 - row[x];
+  }
+}
+
+static void morphology_line(const stage_t *stage,
+                            const unsigned char *const *rows,
+                            unsigned char *out_row, int width){
+  int x, i;
+
+  for(x=0; x<width; x++){
+    int left = x > 0 ? x - 1 : 0, right = x < width - 1 ? x + 1 : x;
+    int v = rows[1][x];
+    for(i=0; i<3; i++){
+      int a = rows[i][left], b = rows[i][x], c = rows[i][right];
+      if(stage->kind == STAGE_ERODE){
+        if(a < v) v = a;
+        if(b < v) v = b;
+        if(c < v) v = c;
+      } else {
+        if(a > v) v = a;
+        if(b > v) v = b;
+        if(c > v) v = c;
+      }
+    }
+    out_row[x] = v;
+  }
+}
+
+static void stencil_line(const stage_t *stage,
+                         const unsigned char *const *rows,
+                         unsigned char *out_row, int width, int y,
+                         int height){
+  if(stage->kind == STAGE_CONVOLVE){
+    convolve_line(rows, out_row, width, y, height, &stage->kernel);
+  } else {
+    morphology_line(stage, rows, out_row, width);
+  }
+}
+
+/**
+ Where pass k keeps row y: a ring of just the rows the next pass reads.
+*/
+
+static unsigned char *ring_row(unsigned char *ring, const pass_t *next,
+                               int y, int width){
+  int rows = 2 * next->stencil->radius + 1;
+  return ring + (size_t)(y % rows) * width;
+}
+
+int pipeline_run(const pipeline_t *p, const image_t *in, image_t *out,
+                 int first_row, int end_row){
+  pass_t passes[PIPELINE_MAX + 1];
+  unsigned char *ring[PIPELINE_MAX + 1];
+  int lag[PIPELINE_MAX + 1];
+  const unsigned char *rows[KERNEL_MAX];
+  int width = in->width, height = in->height;
+  int n_passes = make_passes(p, passes);
+  // With no pointwise stages first, pass 0 is the input itself
+  int copy_input = passes[0].n_pointwise > 0;
+  int k, t, i, failed = 0;
+
+  lag[0] = 0;
+  for(k=0; k<n_passes; k++){
+    ring[k] = NULL;
+    if(k > 0) lag[k] = lag[k - 1] + passes[k].stencil->radius;
+    if(k == n_passes - 1 || (k == 0 && !copy_input)) continue;
+    ring[k] = malloc((size_t)(2 * passes[k + 1].stencil->radius + 1) * width);
+    if(ring[k] == NULL) failed = 1;
+  }
+
+  // Row t of pass 0 is made, then row t - lag[k] of each pass k, which by
+  // then has every row it needs from pass k - 1
+  for(t=first_row - p->halo; t<end_row + p->halo && !failed; t++){
+    for(k=0; k<n_passes; k++){
+      const pass_t *pass = &passes[k];
+      int y = t - lag[k];
+      unsigned char *row;
+
+      if(y < 0 || y >= height || y < first_row - pass->halo ||
+         y >= end_row + pass->halo){
+        continue;
+      }
+      if(k == n_passes - 1){
+        row = out->pixels + (size_t)y * out->stride;
+      } else if(k == 0 && !copy_input){
+        continue;
+      } else {
+        row = ring_row(ring[k], &passes[k + 1], y, width);
+      }
+
+      if(k == 0){
+        memcpy(row, in->pixels + (size_t)y * in->stride, width);
+      } else {
+        int r = pass->stencil->radius;
+        for(i=0; i<2*r+1; i++){
+          int yy = y + i - r;
+          yy = yy < 0 ? 0 : yy >= height ? height - 1 : yy;
+          rows[i] = k == 1 && !copy_input
+                    ? in->pixels + (size_t)yy * in->stride
+                    : ring_row(ring[k - 1], pass, yy, width);
+        }
+        stencil_line(pass->stencil, rows, row, width, y, height);
+      }
+      for(i=0; i<pass->n_pointwise; i++){
+        pointwise_row(pass->pointwise[i], row, width);
+      }
+    }
+  }
+
+  for(k=0; k<n_passes; k++){
+    free(ring[k]);
+  }
+  return failed ? -1 : 0;
+}
+
+int pipeline_run_unfused(const pipeline_t *p, const image_t *in,
+                         image_t *out){
+  image_t between[2];
+  const image_t *from = in;
+  const unsigned char *rows[KERNEL_MAX];
+  int width = in->width, height = in->height;
+  int s, y, i;
+
+  if(image_create(&between[0], width, height) != 0) return -1;
+  if(image_create(&between[1], width, height) != 0){
+    image_free(&between[0]);
+    return -1;
+  }
+  for(s=0; s<p->n_stages; s++){
+    const stage_t *stage = &p->stages[s];
+    image_t *to = s == p->n_stages - 1 ? out : &between[s % 2];
+
+    for(y=0; y<height; y++){
+      unsigned char *row = to->pixels + (size_t)y * to->stride;
+
+      if(stage->radius == 0){
+        memcpy(row, from->pixels + (size_t)y * from->stride, width);
+        pointwise_row(stage, row, width);
+        continue;
+      }
+      for(i=0; i<2*stage->radius+1; i++){
+        int yy = y + i - stage->radius;
+        yy = yy < 0 ? 0 : yy >= height ? height - 1 : yy;
+        rows[i] = from->pixels + (size_t)yy * from->stride;
+      }
+      stencil_line(stage, rows, row, width, y, height);
+    }
+    from = to;
+  }
+  image_free(&between[0]);
+  image_free(&between[1]);
+  return 0;
+}
+
+void pipeline_traffic(const pipeline_t *p, int width, int height,
+                      long long *unfused, long long *fused){
+  *unfused = 2LL * p->n_stages * width * height;
+  *fused = 2LL * width * height;
+}
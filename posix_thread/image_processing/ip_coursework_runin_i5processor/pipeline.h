@@ -0,0 +1,92 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "image_io.h"
+#include "convolve.h"
+
+/******************************************************************************
+  A chain of image operations, run as one pass over the image.
+
+  A pipeline is written as its stages separated by |, e.g.
+    threshold:128|gaussian3|edges|dilate
+  where a stage is one of
+    threshold:t    255 where the pixel is above t, else 0 (t is 128 if left
+                   out)
+    invert         255 - the pixel
+    erode, dilate  the smallest or largest pixel of the 3x3 around it
+    edges          the edge detector of ip_coursework_011.c
+    any kernel convolve.h knows, such as sobel_x or 3:1,2,1,2,4,2,1,2,1/16
+
+  Run one stage after the other, every stage would read a whole image and
+  write a whole image, which for large images means out to memory and back
+  each time. pipeline_run() instead goes down the image a row at a time,
+  running every stage as soon as the rows it needs are there. A stage that
+  looks at the r rows around a pixel (a stencil) is run r rows behind the
+  stage before it, which keeps only the 2r + 1 rows the stencil reads: a
+  few rows per stage, which stay in the L1 or L2 cache. Threshold and
+  invert are done on a row as it is made, so they need no rows of their
+  own. Only the input and the output then go to memory.
+
+  A thread given a band of rows works out the halo rows around its band,
+  the sum of the radii above and below, as well; nothing else is done
+  twice.
+
+  The result is the same as running the stages one after the other, which
+  pipeline_run_unfused() does, so that the two can be compared.
+******************************************************************************/
+
+#define PIPELINE_MAX 16
+
+enum { STAGE_THRESHOLD, STAGE_INVERT, STAGE_ERODE, STAGE_DILATE,
+       STAGE_CONVOLVE };
+
+typedef struct stage {
+  int kind;
+  int threshold;
+  int radius;                // Rows needed above and below; 0 if pointwise
+  convolution_t kernel;
+} stage_t;
+
+typedef struct pipeline {
+  int n_stages;
+  stage_t stages[PIPELINE_MAX];
+  int halo;                  // Sum of the radii of all the stages
+} pipeline_t;
+
+/**
+ Makes a pipeline from its description. Returns 0, or -1 with a message
+ on stderr.
+*/
+
+int pipeline_parse(const char *spec, pipeline_t *p);
+
+void pipeline_describe(const pipeline_t *p, char *text, size_t size);
+
+/**
+ Runs the pipeline, fused, for rows first_row to end_row of out. Threads
+ may share an image as long as their rows do not overlap. Returns 0, or -1
+ if out of memory.
+*/
+
+int pipeline_run(const pipeline_t *p, const image_t *in, image_t *out,
+                 int first_row, int end_row);
+
+/**
+ Runs the stages one after the other over the whole image, through images
+ in between. Returns 0, or -1 if out of memory.
+*/
+
+int pipeline_run_unfused(const pipeline_t *p, const image_t *in,
+                         image_t *out);
+
+/**
+ The bytes read from and written to memory for one image by each way of
+ running the pipeline: every image in between goes out to memory and back
+ when the stages are not fused, and only the input and the output do when
+ they are.
+*/
+
+void pipeline_traffic(const pipeline_t *p, int width, int height,
+                      long long *unfused, long long *fused);
+
+#endif
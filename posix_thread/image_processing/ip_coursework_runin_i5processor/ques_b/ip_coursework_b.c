@@ -1,11 +1,18 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
+#include <unistd.h>
 #include <GL/glut.h>
 #include <GL/gl.h>
 #include <malloc.h>
 #include <signal.h>
 #include <pthread.h>
+#include <stdatomic.h>
+#include "../image_io.h"
+#include "../edge_detect.h"
+#include "../thread_pool.h"
+#include "../bit_image.h"
 
 /******************************************************************************
   Displays two grey scale images. On the left is an image that has come from an 
@@ -20,100 +27,239 @@
       represent a pixel's intensity. In this case we want 256 shades of grey,
       which is best stored in eight bits, so GL_UNSIGNED_BYTE is specified as 
       the pixel data type.
+    - The image is the compiled-in 100x72 one below, unless a binary PGM or
+      PPM file is named on the command line (see ../image_io.h).
+    - The work can be shared between the threads in five ways (-s):
+        interleaved  thread k does pixels k, k+n, k+2n ... of n threads. All
+                     threads write to every cache line of the results, so
+                     the line moves between cores on nearly every write.
+        rows         thread k does the k-th band of height/n whole rows.
+        tiles        the image is cut into tiles sized to fit the L1 (or,
+                     with -L 2, the L2) cache, and thread k does tiles k,
+                     k+n, k+2n ...
+        dynamic      the same tiles, but each thread takes the next tile
+                     not yet done, so a thread that is slowed down does
+                     fewer of them.
+        packed       as rows, but on the image packed to one bit per pixel
+                     (see ../bit_image.h), 64 pixels to a word; the edges
+                     are unpacked to bytes for the display. The image is
+                     packed once, beforehand, as a thresholded image could
+                     be kept packed. The edges are only the same as those
+                     of the other ways if the image is all 0 and 255.
+      By default every way is run, -r times each, and the fastest time of
+      each is reported in millions of pixels (MPix) per second, together
+      with whether its edges are the same as those of the first.
+    - All but the interleaved way use ../edge_detect.h, whose inner loop is
+      SSE2, AVX2 or AVX-512 when the processor has them. -k scalar, sse2,
+      avx2 or avx512 picks one, so that they can be timed and compared.
+    - Each call of edges() starts and joins its threads, which for a frame
+      of video costs more than the edges do. -P starts a pool of threads
+      once (see ../thread_pool.h) and hands each call to it instead. It
+      first times, for 1 to -t threads, a call that does nothing, which is
+      the cost of handing out the work, against the rows way, and uses the
+      number of threads that is fastest overall, which for a small image
+      can be fewer than there are cores.
     
   To compile adapt the code below wo match your filenames:  
-    cc -o ip_coursework ip_coursework_b.c -lglut -lGL -lm 
+    cc -O2 -o ip_coursework ip_coursework_b.c ../image_io.c ../edge_detect.c ../thread_pool.c ../bit_image.c -lglut -lGL -lm -pthread
+
+  Run with:
+    ./ip_coursework [-t threads] [-s strategy] [-L cache level] [-r repeats]
+                    [-k kernel] [-P] [-n] [image.pgm [edges.pgm]]
+  -t defaults to all online cores, -r to 1; -n exits without a window.
    
   Dr Kevan Buckley, University of Wolverhampton, 2018
 ******************************************************************************/
-#define width 100 
-#define height 72
+#define default_width 100 
+#define default_height 72
+#define MAX_THREADS 256
+#define DISPATCH_RUNS 1000
 
-unsigned char image[], results[width * height];
+unsigned char default_image[];
+image_t image, results;
 
 typedef struct arguments {
-unsigned char *input;
-unsigned char *output;
+  const image_t *input;
+  image_t *output;
   int start;
   int stride;
 }
 arguments_t;
 
-void edges(unsigned char *image,unsigned char *results) {
-  pthread_t t1, t2, t3, t4;
-
-  arguments_t t1_arguments;
-  t1_arguments.start = 0;
-  t1_arguments.stride = 4;
-  t1_arguments.input = image;
-  t1_arguments.output = results;
-
-
-  arguments_t t2_arguments;
-  t2_arguments.start = 1;
-  t2_arguments.stride = 4;
-  t2_arguments.input = image;
-  t2_arguments.output = results;
+typedef struct frame_job {
+  const image_t *input;
+  image_t *output;
+  void *(*worker)(arguments_t *args);
+}
+frame_job_t;
+
+int tile_width, tile_height, tiles_across, n_tiles;
+atomic_int next_tile;
+thread_pool_t *pool;
+bit_image_t packed, packed_edges;
+
+void *detect_edges(arguments_t *args);
+void *detect_rows(arguments_t *args);
+void *detect_tiles(arguments_t *args);
+void *detect_dynamic(arguments_t *args);
+void *detect_packed(arguments_t *args);
+
+struct strategy {
+  const char *name;
+  void *(*worker)(arguments_t *args);
+} strategies[] = {
+  {"interleaved", detect_edges},
+  {"rows", detect_rows},
+  {"tiles", detect_tiles},
+  {"dynamic", detect_dynamic},
+  {"packed", detect_packed},
+};
+#define N_STRATEGIES (int)(sizeof(strategies) / sizeof(strategies[0]))
+
+/**
+ Chooses tiles of whole cache lines that, with the row above and below,
+ take up about half of a cache of cache_bytes for input and output.
+*/
+
+void choose_tiles(const image_t *image, long cache_bytes) {
+  long target = cache_bytes / 2;
+  int side = 64;
+
+  while((long)(side + 64) * (side + 64) * 2 <= target) side += 64;
+  tile_width = side < image->width ? side : image->width;
+  tile_height = target / (2 * tile_width);
+  if(tile_height < 1) tile_height = 1;
+  if(tile_height > image->height) tile_height = image->height;
+  tiles_across = (image->width + tile_width - 1) / tile_width;
+  n_tiles = tiles_across * ((image->height + tile_height - 1) / tile_height);
+}
 
-  arguments_t t3_arguments;
-  t3_arguments.start = 2;
-  t3_arguments.stride = 4;
-  t3_arguments.input = image;
-  t3_arguments.output = results;
+/**
+ Runs a strategy's worker as one of the threads of the pool.
+*/
 
-  arguments_t t4_arguments;
-  t4_arguments.start = 3;
-  t4_arguments.stride = 4;
-  t4_arguments.input = image;
-  t4_arguments.output = results;
+void run_worker(void *arg, int index, int n_threads) {
+  frame_job_t *job = arg;
+  arguments_t args;
 
-  void *detect_edges();
- 
-  pthread_create(&t1, NULL, detect_edges, &t1_arguments);
-  pthread_create(&t2, NULL, detect_edges, &t2_arguments);
-  pthread_create(&t3, NULL, detect_edges, &t3_arguments);
-  pthread_create(&t4, NULL, detect_edges, &t4_arguments);
-
-  pthread_join(t1, NULL);
-  pthread_join(t2, NULL);
-  pthread_join(t3, NULL);
-  pthread_join(t4, NULL);
+  args.start = index;
+  args.stride = n_threads;
+  args.input = job->input;
+  args.output = job->output;
+  job->worker(&args);
 }
 
+void edges(const image_t *image, image_t *results, int n_threads,
+           void *(*worker)(arguments_t *args)) {
+  pthread_t threads[MAX_THREADS];
+  arguments_t arguments[MAX_THREADS];
+  int i;
 
+  atomic_store(&next_tile, 0);
+  if(pool != NULL) {
+    frame_job_t job = {image, results, worker};
+    pool_run(pool, n_threads, run_worker, &job);
+    return;
+  }
+  for(i=0;i<n_threads;i++) {
+    arguments[i].start = i;
+    arguments[i].stride = n_threads;
+    arguments[i].input = image;
+    arguments[i].output = results;
+    pthread_create(&threads[i], NULL, (void *(*)(void *))worker,
+                   &arguments[i]);
+  }
+  for(i=0;i<n_threads;i++) {
+    pthread_join(threads[i], NULL);
+  }
+}
 
 void *detect_edges(arguments_t *args) {
-  int i;
-  unsigned char *in = args->input;
-  unsigned char *out =args->output;
-  int n_pixels = width * height;
+  long i;
+  int width = args->input->width, height = args->input->height;
+  int stride = args->input->stride;
+  long n_pixels = (long)width * height;
 
   for(i=args->start;i<n_pixels;i+=args->stride) {
     int x, y; // the pixel of interest
-    int b, d, f, h; // the pixels adjacent to x,y used for the calculation
+    long b, d, f, h; // the pixels adjacent to x,y used for the calculation
     int r; // the result of calculate
+    const unsigned char *in;
+    unsigned char *out;
    
     y = i / width;
-    x = i - (width * y);
+    x = i - ((long)width * y);
+    // Rows of the images may be further apart than width
+    in = args->input->pixels + (long)y * stride + x;
+    out = args->output->pixels + (long)y * args->output->stride + x;
 
     if (x == 0 || y == 0 || x == width - 1 || y == height - 1) {
-      results[i] = 0;
+      out[0] = 0;
     } else {
-      b = i + width;
-      d = i - 1;
-      f = i + 1;
-      h = i - width;
+      b = stride;
+      d = -1;
+      f = 1;
+      h = -stride;
 
-      r = (in[i] * 4) + (in[b] * -1) + (in[d] * -1) + (in[f] * -1)
+      r = (in[0] * 4) + (in[b] * -1) + (in[d] * -1) + (in[f] * -1)
           + (in[h] * -1);
 
       if (r > 0) { // if the result is positive this is an edge pixel
-        out[i] = 255;
+        out[0] = 255;
       } else {
-        out[i] = 0;
+        out[0] = 0;
       }
     }
   }
+  return NULL;
+}
+
+void *detect_rows(arguments_t *args) {
+  long height = args->input->height;
+  int first = height * args->start / args->stride;
+  int end = height * (args->start + 1) / args->stride;
+
+  detect_edges_rows(args->input, args->output, first, end);
+  return NULL;
+}
+
+void detect_one_tile(arguments_t *args, int tile) {
+  int x0 = (tile % tiles_across) * tile_width;
+  int y0 = (tile / tiles_across) * tile_height;
+  int x1 = x0 + tile_width, y1 = y0 + tile_height;
+
+  if(x1 > args->input->width) x1 = args->input->width;
+  if(y1 > args->input->height) y1 = args->input->height;
+  detect_edges_tile(args->input, args->output, x0, y0, x1, y1);
+}
+
+void *detect_tiles(arguments_t *args) {
+  int tile;
+
+  for(tile=args->start;tile<n_tiles;tile+=args->stride) {
+    detect_one_tile(args, tile);
+  }
+  return NULL;
+}
+
+void *detect_dynamic(arguments_t *args) {
+  int tile;
+
+  while((tile = atomic_fetch_add_explicit(&next_tile, 1,
+                                          memory_order_relaxed)) < n_tiles) {
+    detect_one_tile(args, tile);
+  }
+  return NULL;
+}
+
+void *detect_packed(arguments_t *args) {
+  long height = args->input->height;
+  int first = height * args->start / args->stride;
+  int end = height * (args->start + 1) / args->stride;
+
+  bit_detect_edges_rows(&packed, &packed_edges, first, end);
+  bit_image_unpack_rows(&packed_edges, args->output, first, end);
+  return NULL;
 }
 
 int time_difference(struct timespec *start, struct timespec *finish,
@@ -129,7 +275,138 @@ int time_difference(struct timespec *start, struct timespec *finish,
   return !(*difference > 0);
 }
 
+/**
+ Runs one strategy repeats times and returns its fastest time.
+*/
+
+long long int time_strategy(int s, int n_threads, int repeats) {
+  struct timespec start, finish;
+  long long int time_elapsed, best = 0;
+  int r;
+
+  for(r=0;r<repeats;r++) {
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    edges(&image, &results, n_threads, strategies[s].worker);
+    clock_gettime(CLOCK_MONOTONIC, &finish);
+    time_difference(&start, &finish, &time_elapsed);
+    if(r == 0 || time_elapsed < best) best = time_elapsed;
+  }
+  return best;
+}
+
+/**
+ Packs the image to one bit per pixel for the packed way, saying how long
+ that took and whether the image is all 0 and 255.
+*/
+
+int pack_image() {
+  struct timespec start, finish;
+  long long int time_elapsed;
+  long i, n = (long)image.width * image.height, binary = 1;
+
+  if(bit_image_create(&packed, image.width, image.height) != 0 ||
+     bit_image_create(&packed_edges, image.width, image.height) != 0) {
+    return -1;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  bit_image_pack_rows(&image, &packed, 0, image.height);
+  clock_gettime(CLOCK_MONOTONIC, &finish);
+  time_difference(&start, &finish, &time_elapsed);
+
+  for(i=0;i<n && binary;i++) {
+    int v = image.pixels[(i / image.width) * image.stride + i % image.width];
+    binary = v == 0 || v == 255;
+  }
+  printf("packed to %ld bytes from %ld in %lldns%s\n",
+         (long)packed.words * 8 * packed.height, n, time_elapsed,
+         binary ? "" : ", but the image is not all 0 and 255");
+  return 0;
+}
+
+void nothing(void *arg, int index, int n_threads) {
+}
+
+void *do_nothing(void *arg) {
+  return NULL;
+}
+
+/**
+ The average time to hand a job that does nothing to n_threads threads and
+ wait for them: from the pool, or by starting and joining the threads.
+*/
+
+long long int time_dispatch(int n_threads, int use_pool) {
+  pthread_t threads[MAX_THREADS];
+  struct timespec start, finish;
+  long long int time_elapsed;
+  int runs = use_pool ? DISPATCH_RUNS : DISPATCH_RUNS / 10;
+  int r, i;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for(r=0;r<runs;r++) {
+    if(use_pool) {
+      pool_run(pool, n_threads, nothing, NULL);
+      continue;
+    }
+    for(i=0;i<n_threads;i++) {
+      pthread_create(&threads[i], NULL, do_nothing, NULL);
+    }
+    for(i=0;i<n_threads;i++) {
+      pthread_join(threads[i], NULL);
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &finish);
+  time_difference(&start, &finish, &time_elapsed);
+  return time_elapsed / runs;
+}
+
+/**
+ Prints the dispatch and edge detection times of the pool for 1 to
+ max_threads threads and returns the number that was fastest in all.
+*/
+
+int choose_threads(int max_threads, int repeats) {
+  long long int best = 0;
+  int n, best_n = 1, rows = 1;
+
+  printf("threads  create/join  pool dispatch  edges (rows)      in all\n");
+  for(n=1;n<=max_threads;n++) {
+    long long int create = time_dispatch(n, 0);
+    long long int dispatch = time_dispatch(n, 1);
+    long long int total = time_strategy(rows, n, repeats);
+    long long int kernel = total > dispatch ? total - dispatch : 0;
+
+    printf("%7d  %9lldns  %11lldns  %10lldns  %8lldns\n", n, create,
+           dispatch, kernel, total);
+    if(n == 1 || total < best) {
+      best = total;
+      best_n = n;
+    }
+  }
+  printf("using %d of %d threads\n", best_n, max_threads);
+  return best_n;
+}
+
+int same_edges(const image_t *a, const image_t *b) {
+  int y;
+
+  for(y=0;y<a->height;y++) {
+    if(memcmp(a->pixels + (size_t)y * a->stride,
+              b->pixels + (size_t)y * b->stride, a->width) != 0) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
 void tidy_and_exit() {
+  image_free(&image);
+  image_free(&results);
+  bit_image_free(&packed);
+  bit_image_free(&packed_edges);
+  if(pool != NULL) {
+    pool_destroy(pool);
+  }
   exit(0);
 }
 
@@ -141,9 +418,13 @@ void sigint_callback(int signal_number){
 static void display() {
   glClear(GL_COLOR_BUFFER_BIT);
   glRasterPos4i(-1, -1, 0, 1);
-  glDrawPixels(width, height, GL_LUMINANCE, GL_UNSIGNED_BYTE, image);
+  glPixelStorei(GL_UNPACK_ROW_LENGTH, image.stride);
+  glDrawPixels(image.width, image.height, GL_LUMINANCE, GL_UNSIGNED_BYTE,
+               image.pixels);
   glRasterPos4i(0, -1, 0, 1);
-  glDrawPixels(width, height, GL_LUMINANCE, GL_UNSIGNED_BYTE, results);
+  glPixelStorei(GL_UNPACK_ROW_LENGTH, results.stride);
+  glDrawPixels(results.width, results.height, GL_LUMINANCE, GL_UNSIGNED_BYTE,
+               results.pixels);
   glFlush();
 }
 
@@ -159,30 +440,127 @@ static void key_pressed(unsigned char key, int x, int y) {
 }
 
 int main(int argc, char **argv) {
+  int n_threads = sysconf(_SC_NPROCESSORS_ONLN);
+  int repeats = 1, cache_level = 1, no_window = 0, use_pool = 0;
+  const char *strategy = "all";
+  long cache_bytes;
+  image_t first;
+  int opt, s, ran = 0;
+
   signal(SIGINT, sigint_callback);
- 
-  printf("image dimensions %dx%d\n", width, height);
 
- struct timespec start, finish;  
-  long long int time_elapsed;
+  while((opt = getopt(argc, argv, "t:s:L:r:k:Pn")) != -1) {
+    switch(opt) {
+      case 't': n_threads = atoi(optarg); break;
+      case 's': strategy = optarg; break;
+      case 'L': cache_level = atoi(optarg); break;
+      case 'r': repeats = atoi(optarg); break;
+      case 'k':
+        if(edge_detect_use(optarg) != 0) {
+          fprintf(stderr, "no %s kernel on this processor\n", optarg);
+          return 1;
+        }
+        break;
+      case 'P': use_pool = 1; break;
+      case 'n': no_window = 1; break;
+      default:
+        fprintf(stderr, "usage: %s [-t threads] [-s all|interleaved|rows|"
+                "tiles|dynamic|packed] [-L 1|2] [-r repeats] [-k kernel] "
+                "[-P] [-n] [image.pgm [edges.pgm]]\n", argv[0]);
+        return 1;
+    }
+  }
+  if(n_threads < 1) n_threads = 1;
+  if(n_threads > MAX_THREADS) n_threads = MAX_THREADS;
+  if(repeats < 1) repeats = 1;
 
-  clock_gettime(CLOCK_MONOTONIC, &start);
+  if(argc > optind) {
+    if(image_load(argv[optind], &image) != 0) {
+      return 1;
+    }
+  } else {
+    image_wrap(&image, default_image, default_width, default_height,
+               default_width);
+  }
+  if(image_create(&results, image.width, image.height) != 0 ||
+     image_create(&first, image.width, image.height) != 0) {
+    fprintf(stderr, "out of memory\n");
+    return 1;
+  }
+
+  cache_bytes = sysconf(cache_level == 2 ? _SC_LEVEL2_CACHE_SIZE
+                                         : _SC_LEVEL1_DCACHE_SIZE);
+  if(cache_bytes <= 0) cache_bytes = cache_level == 2 ? 262144 : 32768;
+  choose_tiles(&image, cache_bytes);
+
+  if(pack_image() != 0) {
+    fprintf(stderr, "out of memory\n");
+    return 1;
+  }
+
+  if(use_pool) {
+    pool = pool_create(n_threads, -1);
+    if(pool == NULL) {
+      fprintf(stderr, "cannot start %d threads\n", n_threads);
+      return 1;
+    }
+    n_threads = choose_threads(n_threads, repeats);
+  }
  
-  edges(image, results);
+  printf("image dimensions %dx%d, %d threads, %d tiles of %dx%d for "
+         "L%d, %s kernel\n", image.width, image.height, n_threads, n_tiles,
+         tile_width, tile_height, cache_level == 2 ? 2 : 1,
+         edge_detect_kernel());
 
-clock_gettime(CLOCK_MONOTONIC, &finish);
-  time_difference(&start, &finish, &time_elapsed);
-  printf("Time elapsed was %lldns or %0.9lfs\n", time_elapsed,
-         (time_elapsed/1.0e9));
+  for(s=0;s<N_STRATEGIES;s++) {
+    long long int time_elapsed;
+
+    if(strcmp(strategy, "all") != 0 &&
+       strcmp(strategy, strategies[s].name) != 0) {
+      continue;
+    }
+    memset(results.pixels, 0x55, (size_t)results.width * results.height);
+    time_elapsed = time_strategy(s, n_threads, repeats);
+    printf("%-12s Time elapsed was %lldns or %0.9lfs, %0.1f MPix/s", 
+           strategies[s].name, time_elapsed, (time_elapsed/1.0e9),
+           (double)image.width * image.height / (time_elapsed/1.0e9) / 1e6);
+    if(ran++ == 0) {
+      memcpy(first.pixels, results.pixels,
+             (size_t)results.width * results.height);
+      printf("\n");
+    } else {
+      printf(", %s\n", same_edges(&first, &results) ? "same edges"
+                                                    : "DIFFERENT EDGES");
+    }
+  }
+  image_free(&first);
+  if(pool != NULL) {
+    pool_stats_t stats;
+    pool_get_stats(pool, &stats);
+    printf("pool: %lld jobs, %lld sleeps, %lld wakes\n", stats.jobs,
+           stats.sleeps, stats.wakes);
+  }
+  if(ran == 0) {
+    fprintf(stderr, "no strategy called %s\n", strategy);
+    return 1;
+  }
+
+  if(argc > optind + 1 && image_write_pgm(argv[optind + 1], &results) != 0) {
+    return 1;
+  }
+  if(no_window) {
+    tidy_and_exit();
+  }
 
   glutInit(&argc, argv);
-  glutInitWindowSize(width * 2,height);
+  glutInitWindowSize(image.width * 2, image.height);
   glutInitDisplayMode(GLUT_SINGLE | GLUT_LUMINANCE);
      
   glutCreateWindow("6CS005 Image Progessing Courework");
   glutDisplayFunc(display);
   glutKeyboardFunc(key_pressed);
   glClearColor(0.0, 1.0, 0.0, 1.0);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
 
   glutMainLoop();
 
@@ -192,8 +570,7 @@ clock_gettime(CLOCK_MONOTONIC, &finish);
 }
 
 
-
-unsigned char image[] = {255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,
+unsigned char default_image[] = {255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,
   255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,
   255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,
   255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,
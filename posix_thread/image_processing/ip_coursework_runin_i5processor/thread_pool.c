@@ -0,0 +1,196 @@
+#include <stdlib.h>
+#include <limits.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include "thread_pool.h"
+
+/******************************************************************************
+  The pool behind thread_pool.h.
+
+  Two numbers are waited on, each of them a futex:
+    generation   changed by pool_run() for every job; the threads wait
+                 for it to change. Its low bits are the number of threads
+                 the job is for, so that a thread that takes no part need
+                 not look at the job, which may be being replaced by then.
+                 pool_destroy() publishes a job for 0 threads, which
+                 tells them all to exit
+    remaining    the threads still running the current job; the caller
+                 waits for it to reach 0
+  A thread that is about to sleep first counts itself in sleepers (or sets
+  caller_asleep), then checks the number again inside the futex call. The
+  one that changes the number changes it before looking at the count, so
+  either the sleeper sees the change and does not sleep, or the changer
+  sees the sleeper and wakes it.
+
+  Compile with the program that uses it, and -pthread.
+******************************************************************************/
+
+#define MAX_POOL 256
+#define DEFAULT_SPIN 20000
+#define ACTIVE_BITS 9              // Enough for MAX_POOL
+
+#if defined(__x86_64__) || defined(__i386__)
+#define cpu_relax() __builtin_ia32_pause()
+#else
+#define cpu_relax() do {} while(0)
+#endif
+
+struct thread_pool {
+  int n_threads;
+  int spin;
+  pthread_t threads[MAX_POOL];
+
+  atomic_int generation;
+  atomic_int remaining;
+  atomic_int sleepers;
+  atomic_int caller_asleep;
+
+  pool_job_t job;
+  void *arg;
+
+  atomic_llong jobs;
+  atomic_llong sleeps;
+  atomic_llong wakes;
+};
+
+typedef struct worker_start {
+  thread_pool_t *pool;
+  int index;
+} worker_start_t;
+
+static void futex_wait(atomic_int *word, int value){
+  syscall(SYS_futex, (int *)word, FUTEX_WAIT_PRIVATE, value, NULL, NULL, 0);
+}
+
+static void futex_wake(atomic_int *word, int n){
+  syscall(SYS_futex, (int *)word, FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0);
+}
+
+/**
+ Waits for *word to be something other than value: spins, then sleeps.
+*/
+
+static void wait_while(thread_pool_t *pool, atomic_int *word, int value,
+                       atomic_int *asleep){
+  int i;
+
+  for(i=0; i<pool->spin; i++){
+    if(atomic_load_explicit(word, memory_order_acquire) != value) return;
+    cpu_relax();
+  }
+  while(atomic_load(word) == value){
+    atomic_fetch_add(asleep, 1);
+    atomic_fetch_add_explicit(&pool->sleeps, 1, memory_order_relaxed);
+    futex_wait(word, value);
+    atomic_fetch_sub(asleep, 1);
+  }
+}
+
+static void *pool_worker(void *start){
+  worker_start_t *w = start;
+  thread_pool_t *pool = w->pool;
+  int index = w->index, seen = 0, n_active;
+
+  free(w);
+  for(;;){
+    wait_while(pool, &pool->generation, seen, &pool->sleepers);
+    seen = atomic_load_explicit(&pool->generation, memory_order_acquire);
+    n_active = seen & ((1 << ACTIVE_BITS) - 1);
+    if(n_active == 0) break;
+    if(index >= n_active) continue;
+
+    pool->job(pool->arg, index, n_active);
+
+    if(atomic_fetch_sub(&pool->remaining, 1) == 1 &&
+       atomic_load(&pool->caller_asleep)){
+      atomic_fetch_add_explicit(&pool->wakes, 1, memory_order_relaxed);
+      futex_wake(&pool->remaining, 1);
+    }
+  }
+  return NULL;
+}
+
+thread_pool_t *pool_create(int n_threads, int spin){
+  thread_pool_t *pool = calloc(1, sizeof(thread_pool_t));
+  int i;
+
+  if(pool == NULL) return NULL;
+  if(n_threads < 1) n_threads = 1;
+  if(n_threads > MAX_POOL) n_threads = MAX_POOL;
+  pool->n_threads = n_threads;
+  pool->spin = spin >= 0 ? spin : DEFAULT_SPIN;
+  if(sysconf(_SC_NPROCESSORS_ONLN) < 2) pool->spin = 0;
+
+  for(i=1; i<n_threads; i++){
+    worker_start_t *w = malloc(sizeof(worker_start_t));
+    w->pool = pool;
+    w->index = i;
+    if(pthread_create(&pool->threads[i], NULL, pool_worker, w) != 0){
+      free(w);
+      pool->n_threads = i;
+      pool_destroy(pool);
+      return NULL;
+    }
+  }
+  return pool;
+}
+
+/**
+ Publishes a new generation for a job on n_active threads.
+*/
+
+static void next_generation(thread_pool_t *pool, int n_active){
+  unsigned g = atomic_load(&pool->generation);
+
+  g = ((g >> ACTIVE_BITS) + 1) << ACTIVE_BITS | n_active;
+  atomic_store(&pool->generation, (int)g);
+}
+
+void pool_run(thread_pool_t *pool, int n_threads, pool_job_t job, void *arg){
+  int last;
+
+  if(n_threads < 1) n_threads = 1;
+  if(n_threads > pool->n_threads) n_threads = pool->n_threads;
+  pool->job = job;
+  pool->arg = arg;
+  atomic_store(&pool->remaining, n_threads - 1);
+  atomic_fetch_add_explicit(&pool->jobs, 1, memory_order_relaxed);
+
+  if(n_threads > 1){
+    next_generation(pool, n_threads);
+    if(atomic_load(&pool->sleepers) > 0){
+      atomic_fetch_add_explicit(&pool->wakes, 1, memory_order_relaxed);
+      futex_wake(&pool->generation, INT_MAX);
+    }
+  }
+
+  job(arg, 0, n_threads);
+
+  while((last = atomic_load(&pool->remaining)) != 0){
+    wait_while(pool, &pool->remaining, last, &pool->caller_asleep);
+  }
+}
+
+int pool_size(thread_pool_t *pool){
+  return pool->n_threads;
+}
+
+void pool_get_stats(thread_pool_t *pool, pool_stats_t *stats){
+  stats->jobs = atomic_load(&pool->jobs);
+  stats->sleeps = atomic_load(&pool->sleeps);
+  stats->wakes = atomic_load(&pool->wakes);
+}
+
+void pool_destroy(thread_pool_t *pool){
+  int i;
+
+  next_generation(pool, 0);
+  futex_wake(&pool->generation, INT_MAX);
+  for(i=1; i<pool->n_threads; i++){
+    pthread_join(pool->threads[i], NULL);
+  }
+  free(pool);
+}
@@ -0,0 +1,60 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+/******************************************************************************
+  Threads that are started once and then given one job after another, for
+  programs that run the same short job many times a second, such as edge
+  detection on every frame of a video, where starting and joining threads
+  for each frame would cost more than the frame itself.
+
+  A job is a function that every thread runs once, with its own index, and
+  the calling thread runs it as thread 0. pool_run() returns when every
+  thread has finished: it works as a barrier at the end of each frame.
+
+  Between jobs the threads wait on a generation number that pool_run()
+  increases. A waiting thread first spins, reading the number, which
+  notices a new job within a fraction of a microsecond, and only after
+  spin tries does it go to sleep on a futex. The caller waits for the last
+  thread to finish the same way. The futex calls are only made when a
+  thread is asleep, so back to back jobs make no system calls at all.
+  Spinning is no use with one core, where it is turned off.
+
+  A job can be run on fewer threads than the pool has; the others do not
+  take part. For a small frame that can be faster, as fewer threads have
+  to be woken and waited for.
+
+  Linux only, as it uses futexes.
+******************************************************************************/
+
+typedef struct thread_pool thread_pool_t;
+
+typedef void (*pool_job_t)(void *arg, int index, int n_threads);
+
+typedef struct pool_stats {
+  long long jobs;
+  long long sleeps;          // Times a thread gave up spinning and slept
+  long long wakes;           // futex wake calls made
+} pool_stats_t;
+
+/**
+ Starts n_threads - 1 threads; the caller of pool_run() is the last one.
+ spin is how many times to read before sleeping, or -1 for the default.
+ Returns NULL if the threads cannot be started.
+*/
+
+thread_pool_t *pool_create(int n_threads, int spin);
+
+/**
+ Runs job on threads 0 to n_threads - 1, n_threads being at most the size
+ of the pool, and waits for all of them to finish.
+*/
+
+void pool_run(thread_pool_t *pool, int n_threads, pool_job_t job, void *arg);
+
+int pool_size(thread_pool_t *pool);
+
+void pool_get_stats(thread_pool_t *pool, pool_stats_t *stats);
+
+void pool_destroy(thread_pool_t *pool);
+
+#endif
@@ -0,0 +1,503 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <crypt.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/utsname.h>
+#include "crack_kernels.h"
+
+/******************************************************************************
+  Benchmarks the parts that decide how fast the crack programs run, so that
+  machines and versions can be compared by numbers rather than by the
+  "Time elapsed" line:
+
+    latency_ns     one crypt() call on one thread, per scheme
+    hashes_per_s   all threads hashing, per scheme
+    scaling        $6$ hashes/s with 1, 2, 4 .. N threads, and the speed up
+                   over one thread
+    lookup_ns      comparing a hash against T targets of the same salt, the
+                   scan done for every hash in password_attack, for growing T
+
+  The generators and the scan are password_attack's own, from
+  crack_kernels.h, so a change to them shows up here.
+    generate       mask candidates built per second with no hashing at all,
+                   by the generic generator and by the specialised kernel
+
+  Every figure is measured several times and the median kept. The spread,
+  (max - min) / median, is kept too so that a compare can tell noise from a
+  real change.
+
+  Results are written as JSON, with the machine they were measured on:
+    ./crack_bench -o i5.json
+
+  Two result files can then be compared. Every figure that got worse by more
+  than the threshold (default 5%), and by more than the spread of either
+  run, is flagged, and the exit status is 1 if any was:
+    ./crack_bench -c i5_before.json i5_after.json [-n percent]
+
+  Other options: -t threads (most threads, default all online cores),
+  -r repeats (default 5), -m ms (length of one measurement, default 200).
+
+  Compile with:
+    cc -o crack_bench crack_bench.c -lcrypt -pthread
+******************************************************************************/
+
+#define MAX_THREADS 256
+#define MAX_REPEATS 64
+#define MAX_RESULTS 256
+#define MAX_NAME 64
+#define HASH_LENGTH 86
+
+typedef struct result {
+  char name[MAX_NAME];
+  char unit[16];
+  int higher_is_better;
+  double value;              // Median of the repeats
+  double spread;             // (max - min) / median
+} result_t;
+
+result_t results[MAX_RESULTS];
+int n_results;
+
+int repeats = 5;
+long long measure_ns = 200000000LL;
+
+const char *schemes[][2] = {
+  { "md5",            "$1$KB$" },
+  { "sha256",         "$5$KB$" },
+  { "sha512",         "$6$KB$" },
+  { "sha512_r1000",   "$6$rounds=1000$KB$" },
+};
+#define N_SCHEMES (int)(sizeof(schemes) / sizeof(schemes[0]))
+
+//Calculating time
+
+int time_difference(struct timespec *start, struct timespec *finish,
+                    long long int *difference) {
+  long long int ds =  finish->tv_sec - start->tv_sec;
+  long long int dn =  finish->tv_nsec - start->tv_nsec;
+  if(dn < 0 ) {
+    ds--;
+    dn += 1000000000;
+  }
+  *difference = ds * 1000000000 + dn;
+  return !(*difference > 0);
+}
+
+long long int elapsed_since(struct timespec *start){
+  struct timespec now;
+  long long int difference;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  time_difference(start, &now, &difference);
+  return difference;
+}
+
+int compare_doubles(const void *a, const void *b){
+  double x = *(const double *)a, y = *(const double *)b;
+  return x < y ? -1 : x > y;
+}
+
+void add_result(const char *name, const char *unit, int higher_is_better,
+                double *samples, int n){
+  result_t *r = &results[n_results++];
+
+  qsort(samples, n, sizeof(double), compare_doubles);
+  snprintf(r->name, sizeof(r->name), "%s", name);
+  snprintf(r->unit, sizeof(r->unit), "%s", unit);
+  r->higher_is_better = higher_is_better;
+  r->value = samples[n / 2];
+  r->spread = r->value > 0 ? (samples[n - 1] - samples[0]) / r->value : 0;
+  fprintf(stderr, "%-28s %14.2f %-10s spread %5.1f%%\n", r->name, r->value,
+          r->unit, 100 * r->spread);
+}
+
+/**
+ Hashing threads for latency, hashes/s and scaling.
+*/
+
+typedef struct hash_arguments {
+  const char *setting;
+  struct crypt_data data;
+  long long hashes;
+} hash_arguments_t;
+
+void *hash_thread(void *arg){
+  hash_arguments_t *args = arg;
+  struct timespec start;
+
+  args->hashes = 0;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  do {
+    crypt_r("AB12", args->setting, &args->data);
+    args->hashes++;
+  } while(elapsed_since(&start) < measure_ns);
+  return NULL;
+}
+
+double hashes_per_second(const char *setting, int n_threads,
+                         hash_arguments_t *args){
+  pthread_t threads[MAX_THREADS];
+  struct timespec start;
+  long long total = 0;
+  int i;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for(i=0; i<n_threads; i++){
+    args[i].setting = setting;
+    pthread_create(&threads[i], NULL, hash_thread, &args[i]);
+  }
+  for(i=0; i<n_threads; i++){
+    pthread_join(threads[i], NULL);
+    total += args[i].hashes;
+  }
+  return total / (elapsed_since(&start) / 1.0e9);
+}
+
+void bench_hashing(int max_threads){
+  hash_arguments_t *args = calloc(max_threads, sizeof(hash_arguments_t));
+  double samples[MAX_REPEATS], single = 0, single_spread = 0;
+  char name[MAX_NAME];
+  int s, r, n;
+
+  for(s=0; s<N_SCHEMES; s++){
+    for(r=0; r<repeats; r++){
+      samples[r] = 1.0e9 / hashes_per_second(schemes[s][1], 1, args);
+    }
+    snprintf(name, sizeof(name), "latency_ns/%s", schemes[s][0]);
+    add_result(name, "ns", 0, samples, repeats);
+  }
+  for(s=0; s<N_SCHEMES; s++){
+    for(r=0; r<repeats; r++){
+      samples[r] = hashes_per_second(schemes[s][1], max_threads, args);
+    }
+    snprintf(name, sizeof(name), "hashes_per_s/%s", schemes[s][0]);
+    add_result(name, "hashes/s", 1, samples, repeats);
+  }
+
+  for(n=1; ; n = n * 2 < max_threads ? n * 2 : max_threads){
+    for(r=0; r<repeats; r++){
+      samples[r] = hashes_per_second("$6$KB$", n, args);
+    }
+    snprintf(name, sizeof(name), "scaling/sha512/%d_threads", n);
+    add_result(name, "hashes/s", 1, samples, repeats);
+    if(n == 1){
+      single = results[n_results - 1].value;
+      single_spread = results[n_results - 1].spread;
+    } else {
+      double speed_up = results[n_results - 1].value / single;
+      double spread = results[n_results - 1].spread + single_spread;
+      snprintf(name, sizeof(name), "scaling/sha512/%d_threads_speedup", n);
+      add_result(name, "x", 1, &speed_up, 1);
+      // A ratio is as noisy as both of the figures it comes from
+      results[n_results - 1].spread = spread;
+    }
+    if(n == max_threads) break;
+  }
+  free(args);
+}
+
+/**
+ The target scan of password_attack, scan_salt(): a hash is compared with
+ every uncracked target of its salt. The hash looked up is never among the
+ targets, which is the usual case and the slowest.
+*/
+
+char **bench_targets;
+int bench_matches;
+volatile unsigned char candidate_sink;
+
+int target_live(int t){
+  return 1;
+}
+
+const char *target_hash(int t){
+  return bench_targets[t];
+}
+
+void found(int t, const char *plain, long long index, const char *enc){
+  bench_matches++;
+}
+
+/**
+ Takes the place of hashing for the mask kernels, so that generate times
+ candidate construction alone.
+*/
+
+void check_candidate(const char *plain, long long index,
+                     struct crypt_data *data){
+  candidate_sink ^= plain[0];
+}
+
+void bench_lookup(){
+  static const char alphabet[] =
+    "./0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+  int counts[] = { 1, 10, 100, 1000, 10000 };
+  double samples[MAX_REPEATS];
+  char name[MAX_NAME], query[HASH_LENGTH + 8];
+  int *members;
+  int c, r, t, i;
+
+  srand(1);
+  bench_targets = malloc(10000 * sizeof(char *));
+  members = malloc(10000 * sizeof(int));
+  for(t=0; t<10000; t++){
+    bench_targets[t] = malloc(HASH_LENGTH + 8);
+    strcpy(bench_targets[t], "$6$KB$");
+    for(i=6; i<HASH_LENGTH + 6; i++){
+      bench_targets[t][i] = alphabet[rand() % 64];
+    }
+    bench_targets[t][HASH_LENGTH + 6] = '\0';
+    members[t] = t;
+  }
+  strcpy(query, bench_targets[0]);
+  query[HASH_LENGTH + 5] = query[HASH_LENGTH + 5] == '.' ? '/' : '.';
+
+  for(c=0; c<(int)(sizeof(counts) / sizeof(counts[0])); c++){
+    for(r=0; r<repeats; r++){
+      struct timespec start;
+      long long lookups = 0;
+      clock_gettime(CLOCK_MONOTONIC, &start);
+      do {
+        scan_salt(query, members, counts[c], "", 0);
+        lookups++;
+      } while((lookups & 255) != 0 || elapsed_since(&start) < measure_ns);
+      samples[r] = elapsed_since(&start) / (double)lookups;
+    }
+    snprintf(name, sizeof(name), "lookup_ns/%d_targets", counts[c]);
+    add_result(name, "ns", 0, samples, repeats);
+  }
+  for(t=0; t<10000; t++){
+    free(bench_targets[t]);
+  }
+  free(bench_targets);
+  free(members);
+}
+
+/**
+ Builds mask candidates with password_attack's generators, without hashing
+ them: generate/ is the generic generator, kernel/ the specialised kernel
+ for the mask, which is what password_attack uses unless run with -g.
+*/
+
+void bench_generate(){
+  const char *masks[] = { "?u?u?d?d", "?u?u?u?d?d" };
+  double samples[MAX_REPEATS];
+  char name[MAX_NAME];
+  mask_t mask;
+  mask_kernel_t kernel;
+  long long keyspace;
+  int m, r, specialised;
+
+  for(m=0; m<2; m++){
+    parse_mask(masks[m], &mask);
+    keyspace = mask_keyspace(&mask);
+    kernel = find_mask_kernel(masks[m]);
+    for(specialised=0; specialised<=(kernel != NULL); specialised++){
+      for(r=0; r<repeats; r++){
+        struct timespec start;
+        long long candidates = 0, first = 0, count;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        do {
+          count = keyspace - first < 65536 ? keyspace - first : 65536;
+          if(specialised){
+            kernel(first, count, NULL);
+          } else {
+            run_mask_chunk(&mask, first, count, 0, NULL);
+          }
+          first = (first + count) % keyspace;
+          candidates += count;
+        } while(elapsed_since(&start) < measure_ns);
+        samples[r] = candidates / (elapsed_since(&start) / 1.0e9);
+      }
+      snprintf(name, sizeof(name), "%s/%s",
+               specialised ? "kernel" : "generate", masks[m]);
+      add_result(name, "candidates/s", 1, samples, repeats);
+    }
+  }
+}
+
+/**
+ Writes a string as a JSON string, escaping what needs it.
+*/
+
+void json_string(FILE *f, const char *s){
+  fputc('"', f);
+  for(; *s; s++){
+    if(*s == '"' || *s == '\\') fputc('\\', f);
+    if((unsigned char)*s >= ' ') fputc(*s, f);
+  }
+  fputc('"', f);
+}
+
+void cpu_model(char *model, int size){
+  FILE *f = fopen("/proc/cpuinfo", "r");
+  char line[256];
+
+  snprintf(model, size, "unknown");
+  if(f == NULL) return;
+  while(fgets(line, sizeof(line), f) != NULL){
+    char *colon = strchr(line, ':');
+    if(strncmp(line, "model name", 10) == 0 && colon != NULL){
+      colon += 2;
+      colon[strcspn(colon, "\n")] = '\0';
+      snprintf(model, size, "%s", colon);
+      break;
+    }
+  }
+  fclose(f);
+}
+
+void write_json(FILE *f, int max_threads){
+  struct utsname machine;
+  char host[256], model[256], date[64];
+  time_t now = time(NULL);
+  int i;
+
+  uname(&machine);
+  gethostname(host, sizeof(host));
+  host[sizeof(host) - 1] = '\0';
+  cpu_model(model, sizeof(model));
+  strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+
+  fprintf(f, "{\n  \"machine\": {\n    \"host\": ");
+  json_string(f, host);
+  fprintf(f, ",\n    \"cpu\": ");
+  json_string(f, model);
+  fprintf(f, ",\n    \"cores\": %ld,\n    \"threads\": %d,\n    \"kernel\": ",
+          sysconf(_SC_NPROCESSORS_ONLN), max_threads);
+  json_string(f, machine.release);
+  fprintf(f, ",\n    \"arch\": ");
+  json_string(f, machine.machine);
+  fprintf(f, ",\n    \"compiler\": ");
+  json_string(f, __VERSION__);
+  fprintf(f, ",\n    \"date\": \"%s\",\n    \"repeats\": %d,\n"
+          "    \"measure_ms\": %lld\n  },\n  \"results\": [\n", date, repeats,
+          measure_ns / 1000000);
+  // One result per line, which is what compare reads back
+  for(i=0; i<n_results; i++){
+    fprintf(f, "    {\"name\": \"%s\", \"value\": %.9g, \"unit\": \"%s\", "
+            "\"better\": \"%s\", \"spread\": %.4f}%s\n", results[i].name,
+            results[i].value, results[i].unit,
+            results[i].higher_is_better ? "higher" : "lower",
+            results[i].spread, i + 1 < n_results ? "," : "");
+  }
+  fprintf(f, "  ]\n}\n");
+}
+
+/**
+ Reads the results of a file written by write_json().
+*/
+
+int read_json(const char *filename, result_t *out){
+  FILE *f = fopen(filename, "r");
+  char line[512], better[16];
+  int n = 0;
+
+  if(f == NULL){
+    perror(filename);
+    exit(2);
+  }
+  while(fgets(line, sizeof(line), f) != NULL && n < MAX_RESULTS){
+    if(sscanf(line, " {\"name\": \"%63[^\"]\", \"value\": %lf, "
+              "\"unit\": \"%15[^\"]\", \"better\": \"%15[^\"]\", "
+              "\"spread\": %lf", out[n].name, &out[n].value, out[n].unit,
+              better, &out[n].spread) == 5){
+      out[n].higher_is_better = strcmp(better, "higher") == 0;
+      n++;
+    }
+  }
+  fclose(f);
+  return n;
+}
+
+int compare(const char *before_file, const char *after_file,
+            double threshold){
+  result_t *before = calloc(MAX_RESULTS, sizeof(result_t));
+  result_t *after = calloc(MAX_RESULTS, sizeof(result_t));
+  int n_before = read_json(before_file, before);
+  int n_after = read_json(after_file, after);
+  int i, j, regressions = 0;
+
+  printf("%-34s %14s %14s %9s %8s\n", "benchmark", "before", "after",
+         "change", "noise");
+  for(i=0; i<n_after; i++){
+    double change, noise, worse;
+    for(j=0; j<n_before && strcmp(before[j].name, after[i].name) != 0; j++);
+    if(j == n_before || before[j].value == 0) continue;
+    change = (after[i].value - before[j].value) / before[j].value;
+    worse = after[i].higher_is_better ? -change : change;
+    noise = threshold;
+    if(before[j].spread > noise) noise = before[j].spread;
+    if(after[i].spread > noise) noise = after[i].spread;
+    printf("%-34s %14.2f %14.2f %+8.1f%% %7.1f%%%s\n", after[i].name,
+           before[j].value, after[i].value, 100 * change, 100 * noise,
+           worse > noise ? "  REGRESSION" : "");
+    if(worse > noise) regressions++;
+  }
+  printf("%d regression%s beyond the noise threshold\n", regressions,
+         regressions == 1 ? "" : "s");
+  free(before);
+  free(after);
+  return regressions > 0;
+}
+
+int main(int argc, char *argv[]){
+  int max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+  double threshold = 5;
+  const char *output = NULL;
+  int compare_mode = 0;
+  struct timespec start, finish;
+  long long int time_elapsed;
+  FILE *f = stdout;
+  int opt;
+
+  while((opt = getopt(argc, argv, "t:r:m:o:cn:")) != -1){
+    switch(opt){
+      case 't': max_threads = atoi(optarg); break;
+      case 'r': repeats = atoi(optarg); break;
+      case 'm': measure_ns = atoll(optarg) * 1000000LL; break;
+      case 'o': output = optarg; break;
+      case 'c': compare_mode = 1; break;
+      case 'n': threshold = atof(optarg); break;
+      default:
+        fprintf(stderr, "usage: %s [-t threads] [-r repeats] [-m ms] "
+                "[-o results.json]\n       %s -c before.json after.json "
+                "[-n percent]\n", argv[0], argv[0]);
+        return 2;
+    }
+  }
+  if(compare_mode){
+    if(argc - optind != 2){
+      fprintf(stderr, "compare needs two result files\n");
+      return 2;
+    }
+    return compare(argv[optind], argv[optind + 1], threshold / 100);
+  }
+  if(max_threads < 1) max_threads = 1;
+  if(max_threads > MAX_THREADS) max_threads = MAX_THREADS;
+  if(repeats < 1) repeats = 1;
+  if(repeats > MAX_REPEATS) repeats = MAX_REPEATS;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  bench_hashing(max_threads);
+  bench_lookup();
+  bench_generate();
+
+  if(output != NULL){
+    f = fopen(output, "w");
+    if(f == NULL){
+      perror(output);
+      return 2;
+    }
+  }
+  write_json(f, max_threads);
+  if(f != stdout) fclose(f);
+
+  clock_gettime(CLOCK_MONOTONIC, &finish);
+  time_difference(&start, &finish, &time_elapsed);
+  fprintf(stderr, "Time elapsed was %lldns or %0.9lfs\n", time_elapsed,
+          (time_elapsed/1.0e9));
+  return 0;
+}
@@ -0,0 +1,183 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "crack_lib.h"
+#include "crack_protocol.h"
+
+/******************************************************************************
+  Sends one job to crack_daemon and prints the passwords it found, in the
+  same format as the other crack programs.
+
+  Compile with:
+    cc -o crack_client crack_client.c
+
+  Check hashes against a mask at high priority:
+    ./crack_client -m '?u?u?d?d' -p 10 '$6$KB$...' '$6$KB$...'
+
+  Check a hash against a wordlist, giving up after 500ms:
+    ./crack_client -w words.txt -T 500 '$6$KB$...'
+
+  Print the daemon's latency figures:
+    ./crack_client -S
+
+  Other options: -s socket, -t threads (most workers the job may use).
+******************************************************************************/
+
+int read_all(int fd, void *buffer, size_t length){
+  char *p = buffer;
+  while(length > 0){
+    ssize_t n = read(fd, p, length);
+    if(n <= 0) return -1;
+    p += n;
+    length -= n;
+  }
+  return 0;
+}
+
+int write_all(int fd, const void *buffer, size_t length){
+  const char *p = buffer;
+  while(length > 0){
+    ssize_t n = write(fd, p, length);
+    if(n <= 0) return -1;
+    p += n;
+    length -= n;
+  }
+  return 0;
+}
+
+char *read_file(const char *filename, uint32_t *length){
+  FILE *f = fopen(filename, "rb");
+  char *text;
+  long size;
+
+  if(f == NULL){
+    perror(filename);
+    exit(1);
+  }
+  fseek(f, 0, SEEK_END);
+  size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  text = malloc(size + 1);
+  if(fread(text, 1, size, f) != (size_t)size){
+    perror(filename);
+    exit(1);
+  }
+  fclose(f);
+  *length = size;
+  return text;
+}
+
+int main(int argc, char *argv[]){
+  const char *socket_path = CRACK_DEFAULT_SOCKET;
+  struct sockaddr_un address = {0};
+  crack_request_t request = {0};
+  crack_response_t response;
+  char *spec = NULL;
+  const char *status;
+  int stats_only = 0;
+  int fd, opt, i;
+
+  request.magic = CRACK_MAGIC;
+  request.type = CRACK_REQUEST_SUBMIT;
+  while((opt = getopt(argc, argv, "s:m:w:p:t:T:S")) != -1){
+    switch(opt){
+      case 's': socket_path = optarg; break;
+      case 'm':
+        request.attack = CRACK_ATTACK_MASK;
+        spec = optarg;
+        request.spec_length = strlen(spec);
+        break;
+      case 'w':
+        request.attack = CRACK_ATTACK_WORDLIST;
+        spec = read_file(optarg, &request.spec_length);
+        break;
+      case 'p': request.priority = atoi(optarg); break;
+      case 't': request.threads = atoi(optarg); break;
+      case 'T': request.timeout_ms = atoi(optarg); break;
+      case 'S': stats_only = 1; break;
+      default:
+        fprintf(stderr, "usage: %s [-s socket] (-m mask | -w wordlist) "
+                "[-p priority] [-t threads] [-T timeout_ms] hash... | -S\n",
+                argv[0]);
+        return 1;
+    }
+  }
+  if(!stats_only && (spec == NULL || optind == argc)){
+    fprintf(stderr, "a mask or wordlist and at least one hash are needed\n");
+    return 1;
+  }
+
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  address.sun_family = AF_UNIX;
+  snprintf(address.sun_path, sizeof(address.sun_path), "%s", socket_path);
+  if(connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0){
+    perror(socket_path);
+    return 1;
+  }
+
+  if(stats_only){
+    crack_stats_t stats;
+    request.type = CRACK_REQUEST_STATS;
+    if(write_all(fd, &request, sizeof(request)) != 0 ||
+       read_all(fd, &response, sizeof(response)) != 0 ||
+       read_all(fd, &stats, sizeof(stats)) != 0){
+      fprintf(stderr, "lost connection to the daemon\n");
+      return 1;
+    }
+    printf("%llu jobs on %u workers, latency p50 %.3fms p99 %.3fms "
+           "max %.3fms\n", (unsigned long long)stats.jobs, stats.workers,
+           stats.p50_us / 1000.0, stats.p99_us / 1000.0,
+           stats.max_us / 1000.0);
+    return 0;
+  }
+
+  request.n_targets = argc - optind;
+  if(write_all(fd, &request, sizeof(request)) != 0 ||
+     write_all(fd, spec, request.spec_length) != 0){
+    fprintf(stderr, "lost connection to the daemon\n");
+    return 1;
+  }
+  for(i=optind; i<argc; i++){
+    uint16_t length = strlen(argv[i]);
+    write_all(fd, &length, sizeof(length));
+    write_all(fd, argv[i], length);
+  }
+
+  if(read_all(fd, &response, sizeof(response)) != 0 ||
+     response.magic != CRACK_MAGIC){
+    fprintf(stderr, "lost connection to the daemon\n");
+    return 1;
+  }
+  if(response.status == CRACK_RESPONSE_BAD_REQUEST){
+    fprintf(stderr, "the daemon rejected the job\n");
+    return 1;
+  }
+  for(i=0; i<response.n_results; i++){
+    crack_hit_t hit;
+    if(read_all(fd, &hit, sizeof(hit)) != 0) break;
+    if(hit.target >= request.n_targets){
+      fprintf(stderr, "the daemon sent a result for hash %u of %u\n",
+              hit.target + 1, request.n_targets);
+      return 1;
+    }
+    hit.plain[sizeof(hit.plain) - 1] = '\0';
+    printf("#%-8llu%s %s\n", (unsigned long long)hit.index + 1, hit.plain,
+           argv[optind + hit.target]);
+  }
+  if(response.status != CRACK_RESPONSE_CANCELLED){
+    status = "done";
+  } else if(request.timeout_ms > 0 &&
+            response.latency_us >= request.timeout_ms * 1000ULL){
+    status = "timed out";
+  } else {
+    // Cancelled by the daemon, e.g. as it shut down
+    status = "cancelled";
+  }
+  printf("%s, %llu solutions explored, %.3fms\n", status,
+         (unsigned long long)response.tried, response.latency_us / 1000.0);
+  close(fd);
+  return 0;
+}
@@ -0,0 +1,449 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "crack_lib.h"
+#include "crack_protocol.h"
+
+/******************************************************************************
+  A long running cracking service. One crack_lib worker pool is created at
+  start up and kept for the life of the process, so jobs pay neither for
+  process start up nor for creating threads. Jobs arrive on a Unix domain
+  socket using the protocol in crack_protocol.h. Every connection gets a
+  thread that reads requests, submits them to the pool and writes back the
+  results once the job has finished.
+
+  Scheduling is done by the pool: higher priority jobs are always served
+  first, and jobs of equal priority share the workers in turn.
+
+  The time from receiving a request to the job finishing is recorded for
+  the last LATENCY_SAMPLES jobs. p50 and p99 are available through a stats
+  request, and are printed to stderr on SIGUSR1 and on exit (SIGINT or
+  SIGTERM).
+
+  On exit the jobs still running are cancelled and no more requests are
+  read. Clients waiting for a job get a cancelled response, unless they
+  have not read it after CLOSE_GRACE_MS, when their connections are cut.
+  The pool is only destroyed once every connection thread has finished
+  with it.
+
+  Compile with:
+    cc -o crack_daemon crack_daemon.c crack_lib.c -lcrypt -pthread
+
+  Run with:
+    ./crack_daemon [-s socket] [-t threads]
+******************************************************************************/
+
+#define LATENCY_SAMPLES 10000
+#define CLOSE_GRACE_MS 1000
+
+crack_pool_t *pool;
+int n_workers;
+
+pthread_mutex_t latency_lock = PTHREAD_MUTEX_INITIALIZER;
+uint64_t latency_us[LATENCY_SAMPLES];
+uint64_t n_jobs;
+
+volatile sig_atomic_t stats_requested;
+volatile sig_atomic_t stop_requested;
+
+typedef struct connection {
+  int fd;
+  crack_job_t *job;           // The job being waited for, or NULL
+  struct connection *next;
+} connection_t;
+
+// The live connections, so they can be shut down before the pool is
+pthread_mutex_t connections_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t connections_closed = PTHREAD_COND_INITIALIZER;
+connection_t *connections;
+int closing;
+
+//Calculating time
+
+int time_difference(struct timespec *start, struct timespec *finish,
+                    long long int *difference) {
+  long long int ds =  finish->tv_sec - start->tv_sec;
+  long long int dn =  finish->tv_nsec - start->tv_nsec;
+  if(dn < 0 ) {
+    ds--;
+    dn += 1000000000;
+  }
+  *difference = ds * 1000000000 + dn;
+  return !(*difference > 0);
+}
+
+int compare_latency(const void *a, const void *b){
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+void record_latency(uint64_t us){
+  pthread_mutex_lock(&latency_lock);
+  latency_us[n_jobs % LATENCY_SAMPLES] = us;
+  n_jobs++;
+  pthread_mutex_unlock(&latency_lock);
+}
+
+void latency_stats(crack_stats_t *stats){
+  static uint64_t sorted[LATENCY_SAMPLES];
+  static pthread_mutex_t sorted_lock = PTHREAD_MUTEX_INITIALIZER;
+  int n;
+
+  pthread_mutex_lock(&sorted_lock);
+  pthread_mutex_lock(&latency_lock);
+  n = n_jobs < LATENCY_SAMPLES ? n_jobs : LATENCY_SAMPLES;
+  memcpy(sorted, latency_us, n * sizeof(uint64_t));
+  stats->jobs = n_jobs;
+  pthread_mutex_unlock(&latency_lock);
+
+  // Nearest rank percentiles
+  qsort(sorted, n, sizeof(uint64_t), compare_latency);
+  stats->p50_us = n ? sorted[(n * 50 + 99) / 100 - 1] : 0;
+  stats->p99_us = n ? sorted[(n * 99 + 99) / 100 - 1] : 0;
+  stats->max_us = n ? sorted[n - 1] : 0;
+  stats->workers = n_workers;
+  pthread_mutex_unlock(&sorted_lock);
+}
+
+void print_stats(){
+  crack_stats_t stats;
+  latency_stats(&stats);
+  fprintf(stderr, "%llu jobs, latency p50 %.3fms p99 %.3fms max %.3fms\n",
+          (unsigned long long)stats.jobs, stats.p50_us / 1000.0,
+          stats.p99_us / 1000.0, stats.max_us / 1000.0);
+}
+
+int read_all(int fd, void *buffer, size_t length){
+  char *p = buffer;
+  while(length > 0){
+    ssize_t n = read(fd, p, length);
+    if(n <= 0) return -1;
+    p += n;
+    length -= n;
+  }
+  return 0;
+}
+
+int write_all(int fd, const void *buffer, size_t length){
+  const char *p = buffer;
+  while(length > 0){
+    ssize_t n = write(fd, p, length);
+    if(n <= 0) return -1;
+    p += n;
+    length -= n;
+  }
+  return 0;
+}
+
+int send_error(int fd){
+  crack_response_t response = {0};
+  response.magic = CRACK_MAGIC;
+  response.status = CRACK_RESPONSE_BAD_REQUEST;
+  return write_all(fd, &response, sizeof(response));
+}
+
+/**
+ Splits a '\n' separated wordlist in place. Returns the number of words.
+*/
+
+long long split_words(char *text, const char ***words_out){
+  long long n = 1, i = 0;
+  const char **words;
+  char *p;
+
+  for(p=text; *p; p++){
+    if(*p == '\n') n++;
+  }
+  words = malloc(n * sizeof(char *));
+  for(p=text; p!=NULL; ){
+    char *end = strchr(p, '\n');
+    if(end != NULL) *end++ = '\0';
+    if(*p) words[i++] = p;
+    p = end;
+  }
+  *words_out = words;
+  return i;
+}
+
+/**
+ Reads the rest of a submit request, runs the job on the pool and writes
+ the response. Returns -1 if the connection should be closed.
+*/
+
+int handle_submit(connection_t *connection, crack_request_t *request,
+                  struct timespec *start){
+  int fd = connection->fd;
+  crack_job_spec_t spec = {0};
+  crack_response_t response = {0};
+  crack_job_t *job;
+  const crack_result_t *results;
+  struct timespec finish;
+  long long int time_elapsed;
+  char *spec_text, **targets;
+  const char **words = NULL;
+  int i, n, status;
+
+  if(request->n_targets > CRACK_MAX_TARGETS ||
+     request->spec_length > CRACK_MAX_SPEC){
+    send_error(fd);
+    return -1;
+  }
+  spec_text = malloc(request->spec_length + 1);
+  targets = calloc(request->n_targets, sizeof(char *));
+  if(read_all(fd, spec_text, request->spec_length) != 0) goto fail;
+  spec_text[request->spec_length] = '\0';
+  for(i=0; i<request->n_targets; i++){
+    uint16_t length;
+    if(read_all(fd, &length, sizeof(length)) != 0) goto fail;
+    targets[i] = malloc(length + 1);
+    if(read_all(fd, targets[i], length) != 0) goto fail;
+    targets[i][length] = '\0';
+  }
+
+  spec.targets = (const char **)targets;
+  spec.n_targets = request->n_targets;
+  spec.attack = request->attack;
+  spec.threads = request->threads;
+  spec.priority = request->priority;
+  if(request->attack == CRACK_ATTACK_WORDLIST){
+    spec.n_words = split_words(spec_text, &words);
+    spec.words = words;
+  } else {
+    spec.mask = spec_text;
+  }
+
+  job = crack_submit(pool, &spec);
+  if(job == NULL){
+    send_error(fd);
+    goto done;
+  }
+  // Published so that shutting down can cancel it
+  pthread_mutex_lock(&connections_lock);
+  if(closing){
+    crack_job_cancel(job);
+  } else {
+    connection->job = job;
+  }
+  pthread_mutex_unlock(&connections_lock);
+  if(request->timeout_ms > 0){
+    status = crack_job_timedwait(job, request->timeout_ms / 1000.0);
+    if(status == CRACK_RUNNING){
+      crack_job_cancel(job);
+    }
+  }
+  status = crack_job_wait(job);
+  pthread_mutex_lock(&connections_lock);
+  connection->job = NULL;
+  pthread_mutex_unlock(&connections_lock);
+  clock_gettime(CLOCK_MONOTONIC, &finish);
+  time_difference(start, &finish, &time_elapsed);
+  record_latency(time_elapsed / 1000);
+
+  n = crack_job_results(job, &results);
+  response.magic = CRACK_MAGIC;
+  response.status = status == CRACK_CANCELLED ? CRACK_RESPONSE_CANCELLED :
+                                                CRACK_RESPONSE_DONE;
+  response.n_results = n;
+  response.latency_us = time_elapsed / 1000;
+  response.tried = crack_job_tried(job);
+  if(write_all(fd, &response, sizeof(response)) != 0) n = -1;
+  for(i=0; i<n; i++){
+    crack_hit_t hit = {0};
+    hit.target = results[i].target;
+    hit.index = results[i].index;
+    strcpy(hit.plain, results[i].plain);
+    if(write_all(fd, &hit, sizeof(hit)) != 0) break;
+  }
+  crack_job_release(job);
+
+done:
+  for(i=0; i<request->n_targets; i++){
+    free(targets[i]);
+  }
+  free(targets);
+  free(words);
+  free(spec_text);
+  return 0;
+
+fail:
+  for(i=0; i<request->n_targets; i++){
+    free(targets[i]);
+  }
+  free(targets);
+  free(spec_text);
+  return -1;
+}
+
+void *connection_thread(void *arg){
+  connection_t *connection = arg, **link;
+  int fd = connection->fd;
+  crack_request_t request;
+  struct timespec start;
+
+  while(read_all(fd, &request, sizeof(request)) == 0){
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if(request.magic != CRACK_MAGIC){
+      send_error(fd);
+      break;
+    }
+    if(request.type == CRACK_REQUEST_STATS){
+      crack_response_t response = {0};
+      crack_stats_t stats;
+      response.magic = CRACK_MAGIC;
+      latency_stats(&stats);
+      if(write_all(fd, &response, sizeof(response)) != 0 ||
+         write_all(fd, &stats, sizeof(stats)) != 0){
+        break;
+      }
+    } else if(request.type == CRACK_REQUEST_SUBMIT){
+      if(handle_submit(connection, &request, &start) != 0) break;
+    } else {
+      send_error(fd);
+      break;
+    }
+  }
+
+  pthread_mutex_lock(&connections_lock);
+  for(link=&connections; *link!=connection; link=&(*link)->next);
+  *link = connection->next;
+  close(fd);
+  free(connection);
+  pthread_cond_signal(&connections_closed);
+  pthread_mutex_unlock(&connections_lock);
+  return NULL;
+}
+
+/**
+ Cancels the job of every connection and stops reading from it, then waits
+ for the connection threads to finish. Threads still writing a response
+ after CLOSE_GRACE_MS have their sockets shut for writing as well.
+*/
+
+void close_connections(){
+  connection_t *connection;
+  struct timespec deadline;
+  int how = SHUT_RD;
+
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += CLOSE_GRACE_MS / 1000;
+  deadline.tv_nsec += CLOSE_GRACE_MS % 1000 * 1000000L;
+  if(deadline.tv_nsec >= 1000000000){
+    deadline.tv_sec++;
+    deadline.tv_nsec -= 1000000000;
+  }
+  pthread_mutex_lock(&connections_lock);
+  closing = 1;
+  for(connection=connections; connection!=NULL;
+      connection=connection->next){
+    // The next read of the thread fails, so it leaves once it has
+    // answered the request it is working on
+    shutdown(connection->fd, SHUT_RD);
+    if(connection->job != NULL){
+      crack_job_cancel(connection->job);
+    }
+  }
+  while(connections != NULL){
+    if(how == SHUT_RD &&
+       pthread_cond_timedwait(&connections_closed, &connections_lock,
+                              &deadline) == ETIMEDOUT){
+      how = SHUT_RDWR;
+      for(connection=connections; connection!=NULL;
+          connection=connection->next){
+        shutdown(connection->fd, SHUT_RDWR);
+      }
+    } else if(how == SHUT_RDWR){
+      pthread_cond_wait(&connections_closed, &connections_lock);
+    }
+  }
+  pthread_mutex_unlock(&connections_lock);
+}
+
+void signal_callback(int signal_number){
+  if(signal_number == SIGUSR1){
+    stats_requested = 1;
+  } else {
+    stop_requested = 1;
+  }
+}
+
+int main(int argc, char *argv[]){
+  const char *socket_path = CRACK_DEFAULT_SOCKET;
+  struct sockaddr_un address = {0};
+  struct sigaction action = {0};
+  connection_t *connection;
+  int listen_fd, fd, opt;
+  pthread_t thread;
+
+  n_workers = sysconf(_SC_NPROCESSORS_ONLN);
+  while((opt = getopt(argc, argv, "s:t:")) != -1){
+    switch(opt){
+      case 's': socket_path = optarg; break;
+      case 't': n_workers = atoi(optarg); break;
+      default:
+        fprintf(stderr, "usage: %s [-s socket] [-t threads]\n", argv[0]);
+        return 1;
+    }
+  }
+  if(n_workers < 1) n_workers = 1;
+
+  // No SA_RESTART, so accept() returns EINTR and the flags get looked at
+  action.sa_handler = signal_callback;
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+  sigaction(SIGUSR1, &action, NULL);
+  signal(SIGPIPE, SIG_IGN);
+
+  listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  address.sun_family = AF_UNIX;
+  snprintf(address.sun_path, sizeof(address.sun_path), "%s", socket_path);
+  unlink(socket_path);
+  if(listen_fd < 0 ||
+     bind(listen_fd, (struct sockaddr *)&address, sizeof(address)) != 0 ||
+     listen(listen_fd, 64) != 0){
+    perror(socket_path);
+    return 1;
+  }
+
+  pool = crack_pool_create(n_workers);
+  fprintf(stderr, "listening on %s with %d workers\n", socket_path,
+          n_workers);
+
+  while(!stop_requested){
+    fd = accept(listen_fd, NULL, NULL);
+    if(stats_requested){
+      stats_requested = 0;
+      print_stats();
+    }
+    if(fd < 0) continue;
+    connection = calloc(1, sizeof(connection_t));
+    connection->fd = fd;
+    pthread_mutex_lock(&connections_lock);
+    connection->next = connections;
+    connections = connection;
+    pthread_mutex_unlock(&connections_lock);
+    if(pthread_create(&thread, NULL, connection_thread, connection) != 0){
+      pthread_mutex_lock(&connections_lock);
+      connections = connection->next;
+      pthread_mutex_unlock(&connections_lock);
+      close(fd);
+      free(connection);
+      continue;
+    }
+    pthread_detach(thread);
+  }
+
+  close(listen_fd);
+  unlink(socket_path);
+  // No connection thread may be using the pool while it is destroyed
+  close_connections();
+  print_stats();
+  crack_pool_destroy(pool);
+  return 0;
+}
@@ -0,0 +1,231 @@
+#ifndef CRACK_KERNELS_H
+#define CRACK_KERNELS_H
+
+#include <string.h>
+#include <crypt.h>
+#include "crack_mask.h"
+
+/******************************************************************************
+  The inner loops of password_attack: the mask candidate generators, generic
+  and specialised, and the scan of a salt's targets for a hash. Masks
+  themselves are in crack_mask.h. crack_bench includes this file too, so
+  that what it times is the code that is shipped rather than a copy of it.
+
+  Everything here is static and built into the program that includes it,
+  so that check_candidate() can still be inlined into the kernels. That
+  program defines the functions declared below, which the kernels call for
+  every candidate and the scan for every target.
+******************************************************************************/
+
+typedef void (*mask_kernel_t)(long long first, long long count,
+                              struct crypt_data *data);
+
+/**
+ Defined by the program: hashes a candidate and looks the hash up, e.g. with
+ scan_salt().
+*/
+
+void check_candidate(const char *plain, long long index,
+                     struct crypt_data *data);
+
+/**
+ Defined by the program: whether target t is still to be cracked, its hash,
+ and what to do when a candidate matches it.
+*/
+
+int target_live(int t);
+const char *target_hash(int t);
+void found(int t, const char *plain, long long index, const char *enc);
+
+/**
+ Compares the hash of a candidate with every live target of its salt.
+*/
+
+static inline void scan_salt(const char *enc, const int *members,
+                             int n_members, const char *plain,
+                             long long index){
+  int m;
+  for(m=0; m<n_members; m++){
+    int t = members[m];
+    if(target_live(t) && strcmp(target_hash(t), enc) == 0){
+      found(t, plain, index, enc);
+    }
+  }
+}
+
+/**
+ Tries count candidates of a mask from candidate first. Candidates are
+ reported with base added to their index.
+*/
+
+static inline void run_mask_chunk(mask_t *mask, long long first,
+                                  long long count, long long base,
+                                  struct crypt_data *data){
+  int digit[MAX_CANDIDATE];
+  char plain[MAX_CANDIDATE];
+  long long c;
+
+  mask_decode(mask, first, digit, plain);
+  plain[mask->length] = '\0';
+
+  for(c=0; c<count; c++){
+    check_candidate(plain, base + first + c, data);
+    mask_step(mask, digit, plain);
+  }
+}
+
+/**
+ Specialised mask kernels. mask_kernel() is always inlined into a small
+ wrapper per mask whose length, charsets and charset sizes are static
+ constants, so the compiler sees fixed loop bounds and a fixed candidate
+ length and unrolls candidate construction. This is what C offers in place
+ of templates.
+
+ Each kernel is named by its mask tokens, e.g. K4(u,u,d,d) is ?u?u?d?d.
+ More kernels can be built in at compile time, e.g. for ?l?l?l?l?d?d:
+   cc -D'EXTRA_MASK_KERNELS(K3,K4,K5,K6)=K6(l,l,l,l,d,d)' ...
+*/
+
+#define MASK_CHARSET_u charset_upper
+#define MASK_CHARSET_l charset_lower
+#define MASK_CHARSET_d charset_digit
+#define MASK_CHARSET_s charset_special
+#define MASK_CHARSET_a charset_all
+#define MASK_SPEC_u "?u"
+#define MASK_SPEC_l "?l"
+#define MASK_SPEC_d "?d"
+#define MASK_SPEC_s "?s"
+#define MASK_SPEC_a "?a"
+
+#define MAX_KERNEL_LENGTH 6
+
+#ifndef EXTRA_MASK_KERNELS
+#define EXTRA_MASK_KERNELS(K3, K4, K5, K6)
+#endif
+
+#define MASK_KERNELS(K3, K4, K5, K6) \
+  K4(u,u,d,d) \
+  K5(u,u,u,d,d) \
+  EXTRA_MASK_KERNELS(K3, K4, K5, K6)
+
+static inline __attribute__((always_inline))
+void mask_kernel(const int length, const char *const *charset,
+                 const int *size, long long first, long long count,
+                 struct crypt_data *data){
+  int digit[MAX_KERNEL_LENGTH];
+  char plain[MAX_KERNEL_LENGTH + 1];
+  long long index = first;
+  long long c = 0;
+  int i;
+
+  for(i=length-1; i>=0; i--){
+    digit[i] = index % size[i];
+    index /= size[i];
+    plain[i] = charset[i][digit[i]];
+  }
+  plain[length] = '\0';
+
+  while(c < count){
+    // The last position runs over its whole charset without any carries
+    for(; digit[length-1] < size[length-1] && c < count;
+        digit[length-1]++, c++){
+      plain[length-1] = charset[length-1][digit[length-1]];
+      check_candidate(plain, first + c, data);
+    }
+    digit[length-1] = 0;
+    plain[length-1] = charset[length-1][0];
+    for(i=length-2; i>=0; i--){
+      if(++digit[i] < size[i]){
+        plain[i] = charset[i][digit[i]];
+        break;
+      }
+      digit[i] = 0;
+      plain[i] = charset[i][0];
+    }
+  }
+}
+
+#define KERNEL_SIZE(t) (int)sizeof(MASK_CHARSET_##t) - 1
+
+#define DEFINE_KERNEL_3(a,b,c) \
+  static void mask_kernel_##a##b##c(long long first, long long count, \
+                                    struct crypt_data *data){ \
+    static const char *const charset[] = { MASK_CHARSET_##a, \
+      MASK_CHARSET_##b, MASK_CHARSET_##c }; \
+    static const int size[] = { KERNEL_SIZE(a), KERNEL_SIZE(b), \
+      KERNEL_SIZE(c) }; \
+    mask_kernel(3, charset, size, first, count, data); \
+  }
+
+#define DEFINE_KERNEL_4(a,b,c,d) \
+  static void mask_kernel_##a##b##c##d(long long first, long long count, \
+                                       struct crypt_data *data){ \
+    static const char *const charset[] = { MASK_CHARSET_##a, \
+      MASK_CHARSET_##b, MASK_CHARSET_##c, MASK_CHARSET_##d }; \
+    static const int size[] = { KERNEL_SIZE(a), KERNEL_SIZE(b), \
+      KERNEL_SIZE(c), KERNEL_SIZE(d) }; \
+    mask_kernel(4, charset, size, first, count, data); \
+  }
+
+#define DEFINE_KERNEL_5(a,b,c,d,e) \
+  static void mask_kernel_##a##b##c##d##e(long long first, long long count, \
+                                          struct crypt_data *data){ \
+    static const char *const charset[] = { MASK_CHARSET_##a, \
+      MASK_CHARSET_##b, MASK_CHARSET_##c, MASK_CHARSET_##d, \
+      MASK_CHARSET_##e }; \
+    static const int size[] = { KERNEL_SIZE(a), KERNEL_SIZE(b), \
+      KERNEL_SIZE(c), KERNEL_SIZE(d), KERNEL_SIZE(e) }; \
+    mask_kernel(5, charset, size, first, count, data); \
+  }
+
+#define DEFINE_KERNEL_6(a,b,c,d,e,f) \
+  static void mask_kernel_##a##b##c##d##e##f(long long first, \
+                                             long long count, \
+                                             struct crypt_data *data){ \
+    static const char *const charset[] = { MASK_CHARSET_##a, \
+      MASK_CHARSET_##b, MASK_CHARSET_##c, MASK_CHARSET_##d, \
+      MASK_CHARSET_##e, MASK_CHARSET_##f }; \
+    static const int size[] = { KERNEL_SIZE(a), KERNEL_SIZE(b), \
+      KERNEL_SIZE(c), KERNEL_SIZE(d), KERNEL_SIZE(e), KERNEL_SIZE(f) }; \
+    mask_kernel(6, charset, size, first, count, data); \
+  }
+
+MASK_KERNELS(DEFINE_KERNEL_3, DEFINE_KERNEL_4, DEFINE_KERNEL_5,
+             DEFINE_KERNEL_6)
+
+#define KERNEL_ENTRY_3(a,b,c) \
+  { MASK_SPEC_##a MASK_SPEC_##b MASK_SPEC_##c, mask_kernel_##a##b##c },
+#define KERNEL_ENTRY_4(a,b,c,d) \
+  { MASK_SPEC_##a MASK_SPEC_##b MASK_SPEC_##c MASK_SPEC_##d, \
+    mask_kernel_##a##b##c##d },
+#define KERNEL_ENTRY_5(a,b,c,d,e) \
+  { MASK_SPEC_##a MASK_SPEC_##b MASK_SPEC_##c MASK_SPEC_##d MASK_SPEC_##e, \
+    mask_kernel_##a##b##c##d##e },
+#define KERNEL_ENTRY_6(a,b,c,d,e,f) \
+  { MASK_SPEC_##a MASK_SPEC_##b MASK_SPEC_##c MASK_SPEC_##d MASK_SPEC_##e \
+    MASK_SPEC_##f, mask_kernel_##a##b##c##d##e##f },
+
+static struct {
+  const char *spec;
+  mask_kernel_t kernel;
+} mask_kernels[] = {
+  MASK_KERNELS(KERNEL_ENTRY_3, KERNEL_ENTRY_4, KERNEL_ENTRY_5, KERNEL_ENTRY_6)
+  { NULL, NULL }
+};
+
+/**
+ Returns the specialised kernel for a mask, or NULL when there is none and
+ the generic generator has to be used.
+*/
+
+static inline mask_kernel_t find_mask_kernel(const char *spec){
+  int i;
+  for(i=0; mask_kernels[i].spec != NULL; i++){
+    if(strcmp(mask_kernels[i].spec, spec) == 0){
+      return mask_kernels[i].kernel;
+    }
+  }
+  return NULL;
+}
+
+#endif
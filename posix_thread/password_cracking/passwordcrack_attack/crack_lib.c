@@ -0,0 +1,440 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <crypt.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "crack_lib.h"
+#include "crack_mask.h"
+
+/******************************************************************************
+  Implementation of the cracking library described in crack_lib.h.
+
+  All scheduling state is protected by the pool mutex. A worker holds it
+  only to pick a job and claim a chunk of CHUNK candidates; the hashing is
+  done without it. Hits are recorded under the job's own mutex.
+******************************************************************************/
+
+#define CHUNK 16              // Candidates claimed by a worker at a time
+
+#if MAX_CANDIDATE != CRACK_MAX_CANDIDATE
+#error "crack_mask.h and crack_lib.h disagree on the longest candidate"
+#endif
+
+typedef struct salt_group {
+  char setting[CRYPT_OUTPUT_SIZE];
+  int *members;
+  int n_members;
+  atomic_int remaining;
+} salt_group_t;
+
+struct crack_job {
+  crack_pool_t *pool;
+  crack_job_t *next_job;      // Pool's list of unfinished jobs
+
+  char **targets;
+  atomic_int *cracked;
+  int n_targets;
+  salt_group_t *groups;
+  int n_groups;
+  atomic_int remaining;
+
+  int attack;
+  mask_t mask;
+  const char **words;
+  long long keyspace;
+  int threads;
+  int priority;
+  crack_progress_fn progress;
+  void *user;
+
+  // Protected by the pool mutex
+  long long next;             // Next unclaimed keyspace index
+  int active;                 // Workers running a chunk of this job
+  long long served;           // Chunks handed out, for round robin
+  int status;
+
+  atomic_llong tried;
+  atomic_int cancelled;
+  atomic_int references;      // The pool's and the caller's
+
+  pthread_mutex_t lock;       // Protects results and done
+  pthread_cond_t done;
+  crack_result_t *results;
+  int n_results;
+};
+
+struct crack_pool {
+  pthread_t *threads;
+  int n_threads;
+  pthread_mutex_t lock;
+  pthread_cond_t work;
+  crack_job_t *jobs;
+  int shutdown;
+};
+
+static void setting_of(const char *hash, char *setting){
+  const char *end = strrchr(hash, '$');
+  int length = end ? end - hash + 1 : (int)strlen(hash);
+  if(length >= CRYPT_OUTPUT_SIZE) length = CRYPT_OUTPUT_SIZE - 1;
+  memcpy(setting, hash, length);
+  setting[length] = '\0';
+}
+
+static void release_job(crack_job_t *job){
+  int g;
+  if(atomic_fetch_sub(&job->references, 1) != 1) return;
+  for(g=0; g<job->n_groups; g++){
+    free(job->groups[g].members);
+  }
+  for(g=0; g<job->n_targets; g++){
+    free(job->targets[g]);
+  }
+  free(job->groups);
+  free(job->targets);
+  free(job->cracked);
+  free(job->results);
+  pthread_mutex_destroy(&job->lock);
+  pthread_cond_destroy(&job->done);
+  free(job);
+}
+
+static void check_candidate(crack_job_t *job, const char *plain,
+                            long long index, struct crypt_data *data){
+  int g, m;
+  char *enc;
+
+  for(g=0; g<job->n_groups; g++){
+    if(atomic_load_explicit(&job->groups[g].remaining,
+                            memory_order_relaxed) == 0){
+      continue;
+    }
+    enc = crypt_r(plain, job->groups[g].setting, data);
+    if(enc == NULL) continue;
+    for(m=0; m<job->groups[g].n_members; m++){
+      int t = job->groups[g].members[m];
+      int expected = 0;
+      if(strcmp(job->targets[t], enc) != 0) continue;
+      if(!atomic_compare_exchange_strong(&job->cracked[t], &expected, 1)){
+        continue;
+      }
+      pthread_mutex_lock(&job->lock);
+      job->results[job->n_results].target = t;
+      job->results[job->n_results].index = index;
+      strcpy(job->results[job->n_results].plain, plain);
+      job->n_results++;
+      pthread_mutex_unlock(&job->lock);
+      atomic_fetch_sub(&job->groups[g].remaining, 1);
+      atomic_fetch_sub(&job->remaining, 1);
+    }
+  }
+}
+
+static void run_chunk(crack_job_t *job, long long first, long long count,
+                      struct crypt_data *data){
+  mask_t *mask = &job->mask;
+  int digit[MAX_CANDIDATE];
+  char plain[MAX_CANDIDATE];
+  long long c;
+
+  if(job->attack == CRACK_ATTACK_WORDLIST){
+    for(c=0; c<count; c++){
+      // A word too long for crack_result_t could not be reported, so it is
+      // counted as tried but never hashed
+      if(strnlen(job->words[first + c], CRACK_MAX_CANDIDATE) ==
+         CRACK_MAX_CANDIDATE){
+        continue;
+      }
+      check_candidate(job, job->words[first + c], first + c, data);
+    }
+    return;
+  }
+
+  mask_decode(mask, first, digit, plain);
+  plain[mask->length] = '\0';
+  for(c=0; c<count; c++){
+    check_candidate(job, plain, first + c, data);
+    mask_step(mask, digit, plain);
+  }
+}
+
+static int job_exhausted(crack_job_t *job){
+  return job->next >= job->keyspace || atomic_load(&job->cancelled) ||
+         atomic_load(&job->remaining) == 0;
+}
+
+/**
+ Picks the job a worker should claim its next chunk from: the highest
+ priority job that has work left and is below its thread budget, and among
+ those the one that has been served least. Called with the pool locked.
+*/
+
+static crack_job_t *pick_job(crack_pool_t *pool){
+  crack_job_t *job, *best = NULL;
+
+  for(job=pool->jobs; job!=NULL; job=job->next_job){
+    if(job_exhausted(job)) continue;
+    if(job->threads > 0 && job->active >= job->threads) continue;
+    if(best == NULL || job->priority > best->priority ||
+       (job->priority == best->priority && job->served < best->served)){
+      best = job;
+    }
+  }
+  return best;
+}
+
+/**
+ Removes a finished job from the pool and wakes anyone waiting for it.
+ Called with the pool locked, once the last active worker has left it.
+*/
+
+static void finish_job(crack_pool_t *pool, crack_job_t *job){
+  crack_job_t **link;
+
+  for(link=&pool->jobs; *link!=NULL; link=&(*link)->next_job){
+    if(*link == job){
+      *link = job->next_job;
+      break;
+    }
+  }
+  pthread_mutex_lock(&job->lock);
+  job->status = atomic_load(&job->cancelled) ? CRACK_CANCELLED : CRACK_DONE;
+  pthread_cond_broadcast(&job->done);
+  pthread_mutex_unlock(&job->lock);
+  // Wake workers idling on a job that could not take more threads
+  pthread_cond_broadcast(&pool->work);
+  release_job(job);
+}
+
+static void *worker(void *arg){
+  crack_pool_t *pool = arg;
+  struct crypt_data *data = calloc(1, sizeof(struct crypt_data));
+  crack_job_t *job;
+  long long first, count;
+
+  pthread_mutex_lock(&pool->lock);
+  while(!pool->shutdown){
+    job = pick_job(pool);
+    if(job == NULL){
+      pthread_cond_wait(&pool->work, &pool->lock);
+      continue;
+    }
+    first = job->next;
+    count = job->keyspace - first < CHUNK ? job->keyspace - first : CHUNK;
+    job->next += count;
+    job->active++;
+    job->served++;
+    pthread_mutex_unlock(&pool->lock);
+
+    run_chunk(job, first, count, data);
+    atomic_fetch_add(&job->tried, count);
+    if(job->progress != NULL){
+      job->progress(job, atomic_load(&job->tried), job->keyspace,
+                    job->n_targets - atomic_load(&job->remaining), job->user);
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    job->active--;
+    if(job_exhausted(job) && job->active == 0 &&
+       job->status == CRACK_RUNNING){
+      finish_job(pool, job);
+    }
+  }
+  pthread_mutex_unlock(&pool->lock);
+  free(data);
+  return NULL;
+}
+
+crack_pool_t *crack_pool_create(int n_threads){
+  crack_pool_t *pool = calloc(1, sizeof(crack_pool_t));
+  int i;
+
+  if(n_threads < 1) n_threads = 1;
+  pool->n_threads = n_threads;
+  pool->threads = calloc(n_threads, sizeof(pthread_t));
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->work, NULL);
+  for(i=0; i<n_threads; i++){
+    pthread_create(&pool->threads[i], NULL, worker, pool);
+  }
+  return pool;
+}
+
+void crack_pool_destroy(crack_pool_t *pool){
+  crack_job_t *job;
+  int i;
+
+  pthread_mutex_lock(&pool->lock);
+  for(job=pool->jobs; job!=NULL; job=job->next_job){
+    atomic_store(&job->cancelled, 1);
+  }
+  pool->shutdown = 1;
+  pthread_cond_broadcast(&pool->work);
+  pthread_mutex_unlock(&pool->lock);
+  for(i=0; i<pool->n_threads; i++){
+    pthread_join(pool->threads[i], NULL);
+  }
+  // No workers are left, so whatever is still listed has none active
+  while(pool->jobs != NULL){
+    finish_job(pool, pool->jobs);
+  }
+  pthread_mutex_destroy(&pool->lock);
+  pthread_cond_destroy(&pool->work);
+  free(pool->threads);
+  free(pool);
+}
+
+crack_job_t *crack_submit(crack_pool_t *pool, const crack_job_spec_t *spec){
+  crack_job_t *job = calloc(1, sizeof(crack_job_t));
+  crack_job_t *other;
+  char setting[CRYPT_OUTPUT_SIZE];
+  int i, g, peers = 0;
+
+  job->attack = spec->attack;
+  if(spec->attack == CRACK_ATTACK_MASK){
+    if(spec->mask == NULL || parse_mask(spec->mask, &job->mask) != 0 ||
+       (job->keyspace = mask_keyspace(&job->mask)) < 0){
+      free(job);
+      return NULL;
+    }
+  } else if(spec->attack == CRACK_ATTACK_WORDLIST && spec->words != NULL){
+    job->words = spec->words;
+    job->keyspace = spec->n_words;
+  } else {
+    free(job);
+    return NULL;
+  }
+
+  job->pool = pool;
+  job->n_targets = spec->n_targets;
+  job->targets = calloc(spec->n_targets, sizeof(char *));
+  job->cracked = calloc(spec->n_targets, sizeof(atomic_int));
+  job->groups = calloc(spec->n_targets, sizeof(salt_group_t));
+  job->results = calloc(spec->n_targets, sizeof(crack_result_t));
+  for(i=0; i<spec->n_targets; i++){
+    job->targets[i] = strdup(spec->targets[i]);
+    setting_of(spec->targets[i], setting);
+    for(g=0; g<job->n_groups; g++){
+      if(strcmp(job->groups[g].setting, setting) == 0) break;
+    }
+    if(g == job->n_groups){
+      strcpy(job->groups[g].setting, setting);
+      job->groups[g].members = calloc(spec->n_targets, sizeof(int));
+      job->n_groups++;
+    }
+    job->groups[g].members[job->groups[g].n_members++] = i;
+    atomic_fetch_add(&job->groups[g].remaining, 1);
+  }
+  atomic_init(&job->remaining, spec->n_targets);
+  atomic_init(&job->tried, 0);
+  atomic_init(&job->cancelled, 0);
+  atomic_init(&job->references, 2);
+  job->threads = spec->threads;
+  job->priority = spec->priority;
+  job->progress = spec->progress;
+  job->user = spec->user;
+  job->status = CRACK_RUNNING;
+  pthread_mutex_init(&job->lock, NULL);
+  pthread_cond_init(&job->done, NULL);
+
+  pthread_mutex_lock(&pool->lock);
+  // Start level with the jobs already queued at this priority, otherwise a
+  // new job would have the workers to itself until it had caught up
+  for(other=pool->jobs; other!=NULL; other=other->next_job){
+    if(other->priority == job->priority &&
+       (peers++ == 0 || other->served < job->served)){
+      job->served = other->served;
+    }
+  }
+  job->next_job = pool->jobs;
+  pool->jobs = job;
+  if(pool->shutdown){
+    atomic_store(&job->cancelled, 1);
+  }
+  if(job_exhausted(job)){
+    // Nothing to do, e.g. no targets or an empty wordlist
+    finish_job(pool, job);
+  } else {
+    pthread_cond_broadcast(&pool->work);
+  }
+  pthread_mutex_unlock(&pool->lock);
+  return job;
+}
+
+int crack_job_status(crack_job_t *job){
+  int status;
+  pthread_mutex_lock(&job->lock);
+  status = job->status;
+  pthread_mutex_unlock(&job->lock);
+  return status;
+}
+
+int crack_job_wait(crack_job_t *job){
+  int status;
+  pthread_mutex_lock(&job->lock);
+  while(job->status == CRACK_RUNNING){
+    pthread_cond_wait(&job->done, &job->lock);
+  }
+  status = job->status;
+  pthread_mutex_unlock(&job->lock);
+  return status;
+}
+
+int crack_job_timedwait(crack_job_t *job, double seconds){
+  struct timespec deadline;
+  int status;
+
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += (time_t)seconds;
+  deadline.tv_nsec += (long)((seconds - (time_t)seconds) * 1.0e9);
+  if(deadline.tv_nsec >= 1000000000){
+    deadline.tv_sec++;
+    deadline.tv_nsec -= 1000000000;
+  }
+  pthread_mutex_lock(&job->lock);
+  while(job->status == CRACK_RUNNING){
+    if(pthread_cond_timedwait(&job->done, &job->lock, &deadline) ==
+       ETIMEDOUT){
+      break;
+    }
+  }
+  status = job->status;
+  pthread_mutex_unlock(&job->lock);
+  return status;
+}
+
+void crack_job_cancel(crack_job_t *job){
+  crack_pool_t *pool = job->pool;
+
+  if(crack_job_status(job) != CRACK_RUNNING) return;
+  pthread_mutex_lock(&pool->lock);
+  atomic_store(&job->cancelled, 1);
+  // With a worker on the job, the worker finishes it after its chunk
+  if(job->active == 0 && job->status == CRACK_RUNNING){
+    finish_job(pool, job);
+  }
+  pthread_mutex_unlock(&pool->lock);
+}
+
+int crack_job_results(crack_job_t *job, const crack_result_t **results){
+  int n;
+  pthread_mutex_lock(&job->lock);
+  *results = job->results;
+  n = job->n_results;
+  pthread_mutex_unlock(&job->lock);
+  return n;
+}
+
+long long crack_job_tried(crack_job_t *job){
+  return atomic_load(&job->tried);
+}
+
+long long crack_job_keyspace(crack_job_t *job){
+  return job->keyspace;
+}
+
+void crack_job_release(crack_job_t *job){
+  release_job(job);
+}
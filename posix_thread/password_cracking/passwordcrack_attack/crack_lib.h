@@ -0,0 +1,112 @@
+#ifndef CRACK_LIB_H
+#define CRACK_LIB_H
+
+/******************************************************************************
+  A small library for cracking crypt(3) hashes from another program. A pool
+  of worker threads is created once, and any number of jobs can then be
+  submitted to it. Each job gets a handle that works like a future: the
+  caller can wait for the job, wait with a timeout, poll it, or cancel it.
+
+  Jobs share the pool. Workers claim small chunks of candidates, and for
+  every chunk they pick the runnable job with the highest priority. Jobs of
+  equal priority are served in turn. A high priority job therefore starts
+  within one chunk of being submitted, even behind a long running audit.
+
+  Compile a program using it with:
+    cc -o program program.c crack_lib.c -lcrypt -pthread
+******************************************************************************/
+
+#define CRACK_MAX_CANDIDATE 64
+
+enum crack_attack {
+  CRACK_ATTACK_MASK,      // Brute force over a mask such as ?u?u?d?d
+  CRACK_ATTACK_WORDLIST   // Every word of an in-memory list
+};
+
+enum crack_status {
+  CRACK_RUNNING,          // Queued or being worked on
+  CRACK_DONE,             // Keyspace exhausted or every target cracked
+  CRACK_CANCELLED
+};
+
+typedef struct crack_pool crack_pool_t;
+typedef struct crack_job crack_job_t;
+
+typedef struct crack_result {
+  int target;             // Index into the job's targets
+  long long index;        // Keyspace index of the candidate that matched
+  char plain[CRACK_MAX_CANDIDATE];
+} crack_result_t;
+
+/**
+ Called by a worker after each chunk it finishes. Callbacks for one job can
+ run on several workers at the same time and must not block for long.
+*/
+
+typedef void (*crack_progress_fn)(crack_job_t *job, long long tried,
+                                  long long keyspace, int cracked,
+                                  void *user);
+
+typedef struct crack_job_spec {
+  const char **targets;   // Hashes, copied on submit
+  int n_targets;
+  int attack;             // enum crack_attack
+  const char *mask;       // CRACK_ATTACK_MASK
+  const char **words;     // CRACK_ATTACK_WORDLIST, must outlive the job.
+                          // Words of CRACK_MAX_CANDIDATE characters or
+                          // more are skipped
+  long long n_words;
+  int threads;            // Most workers at once, 0 for the whole pool
+  int priority;           // Higher is served first
+  crack_progress_fn progress;
+  void *user;
+} crack_job_spec_t;
+
+crack_pool_t *crack_pool_create(int n_threads);
+
+/**
+ Cancels every job that is still running, waits for the workers to stop
+ and frees the pool. Handles that have not been released stay valid.
+*/
+
+void crack_pool_destroy(crack_pool_t *pool);
+
+/**
+ Returns a handle for the new job, or NULL if the spec is invalid, which
+ includes a mask of more candidates than a long long holds. The handle
+ must be given back with crack_job_release().
+*/
+
+crack_job_t *crack_submit(crack_pool_t *pool, const crack_job_spec_t *spec);
+
+int crack_job_status(crack_job_t *job);
+int crack_job_wait(crack_job_t *job);
+
+/**
+ Waits at most seconds for the job to finish and returns its status, which
+ is CRACK_RUNNING if the time ran out.
+*/
+
+int crack_job_timedwait(crack_job_t *job, double seconds);
+
+/**
+ Asks the workers to stop the job. They notice between two chunks, so the
+ job is only finished once crack_job_wait() returns. Must not be called at
+ the same time as crack_pool_destroy().
+*/
+
+void crack_job_cancel(crack_job_t *job);
+
+/**
+ Points results at the hits found so far and returns how many there are.
+ The array is only stable once the job has finished.
+*/
+
+int crack_job_results(crack_job_t *job, const crack_result_t **results);
+
+long long crack_job_tried(crack_job_t *job);
+long long crack_job_keyspace(crack_job_t *job);
+
+void crack_job_release(crack_job_t *job);
+
+#endif
@@ -0,0 +1,121 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "crack_lib.h"
+
+/******************************************************************************
+  Shows how crack_lib is driven from another program. A bulk audit of the
+  challenge set below is submitted at low priority, then a single hash is
+  checked interactively at high priority on the same pool. The interactive
+  check does not wait for the audit: it takes the workers as soon as they
+  finish their current chunk.
+
+  The audit is cancelled if it has not finished after the number of seconds
+  given as the first argument (default 10).
+
+  Compile with:
+    cc -o crack_lib_example crack_lib_example.c crack_lib.c -lcrypt -pthread
+
+  Run with:
+    ./crack_lib_example 10
+******************************************************************************/
+
+const char *encrypted_passwords[] = {
+"$6$KB$3MiAO5oLs/.coZCPQ2QYOy8Ozo3v7QzGdwBEv3N7E0pJen3CJ63DmYXIZz6KEsykHmGsu3Dh1KCNe0niN0wvx/",
+"$6$KB$jyDvGJlpBoZ7V0LmBQMe8IRWBBOs5iptBLdOhT4LNJClRiXwfx4ul/IlCXEgzYOUjIhmBUJKNfHPVmJP3dueR1",
+"$6$KB$iyAdOw/ziDVBE0sXz8H3YRvGMVpqgV0DTg0dVbtPUyheOGYQGWP0C0g4hXnGTMZtUT0NXtmeaMY1Q6ykJqcTw0",
+"$6$KB$Uz4cD9uzcYjtg9/zNnA4wdLtqlTWw42taHPdqzfJYQOmv2Ct79UJ8e11XtqdxzH3E58trHonpZFDOwYRwJPGs1"
+};
+
+// "AB12" with salt $6$KB$, the kind of one-off check a login service makes
+const char *interactive_hash[] = {
+"$6$KB$pHaXMshzu3t0UyJh8lnlMHLVHuI8InftKprtj.gXIfP3R4Rke8wf8Lv3jd36e7sA/Fha6Qv63PfXX0vgqx8Iv1"
+};
+
+const char *interactive_words[] = { "password", "letmein", "AB12", "qwerty" };
+
+void audit_progress(crack_job_t *job, long long tried, long long keyspace,
+                    int cracked, void *user){
+  // Report roughly every 1% so the output stays readable
+  if(tried % (keyspace / 100 + 1) < 16){
+    fprintf(stderr, "\raudit %5.1f%% %d cracked", 100.0 * tried / keyspace,
+            cracked);
+  }
+}
+
+//Calculating time
+
+int time_difference(struct timespec *start, struct timespec *finish,
+                    long long int *difference) {
+  long long int ds =  finish->tv_sec - start->tv_sec;
+  long long int dn =  finish->tv_nsec - start->tv_nsec;
+  if(dn < 0 ) {
+    ds--;
+    dn += 1000000000;
+  }
+  *difference = ds * 1000000000 + dn;
+  return !(*difference > 0);
+}
+
+void print_results(const char *name, crack_job_t *job, const char **hashes){
+  const crack_result_t *results;
+  int n = crack_job_results(job, &results);
+  int i;
+
+  printf("%s: %s, %lld/%lld candidates tried\n", name,
+         crack_job_status(job) == CRACK_CANCELLED ? "cancelled" : "done",
+         crack_job_tried(job), crack_job_keyspace(job));
+  for(i=0; i<n; i++){
+    printf("#%-8lld%s %s\n", results[i].index + 1, results[i].plain,
+           hashes[results[i].target]);
+  }
+}
+
+int main(int argc, char *argv[]){
+  double audit_seconds = argc > 1 ? atof(argv[1]) : 10;
+  crack_pool_t *pool = crack_pool_create(sysconf(_SC_NPROCESSORS_ONLN));
+  crack_job_spec_t audit = {0}, check = {0};
+  crack_job_t *audit_job, *check_job;
+  struct timespec start, finish;
+  long long int time_elapsed;
+
+  audit.targets = encrypted_passwords;
+  audit.n_targets = 4;
+  audit.attack = CRACK_ATTACK_MASK;
+  audit.mask = "?u?u?d?d";
+  audit.priority = 0;
+  audit.progress = audit_progress;
+  audit_job = crack_submit(pool, &audit);
+
+  check.targets = interactive_hash;
+  check.n_targets = 1;
+  check.attack = CRACK_ATTACK_WORDLIST;
+  check.words = interactive_words;
+  check.n_words = 4;
+  check.threads = 1;
+  check.priority = 10;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  check_job = crack_submit(pool, &check);
+  crack_job_wait(check_job);
+  clock_gettime(CLOCK_MONOTONIC, &finish);
+  time_difference(&start, &finish, &time_elapsed);
+  fprintf(stderr, "\n");
+  print_results("interactive check", check_job, interactive_hash);
+  printf("interactive check took %0.9lfs while the audit was running\n",
+         time_elapsed / 1.0e9);
+
+  if(crack_job_timedwait(audit_job, audit_seconds) == CRACK_RUNNING){
+    crack_job_cancel(audit_job);
+    crack_job_wait(audit_job);
+  }
+  fprintf(stderr, "\n");
+  print_results("audit", audit_job, encrypted_passwords);
+
+  crack_job_release(check_job);
+  crack_job_release(audit_job);
+  crack_pool_destroy(pool);
+  return 0;
+}
@@ -0,0 +1,71 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <crypt.h>
+#include "crack_lib.h"
+
+/******************************************************************************
+  Checks that crack_lib copes with wordlist words too long for a result.
+  A wordlist holding a word of CRACK_MAX_CANDIDATE characters, one of 200
+  and the longest word that fits is submitted along with the hashes of all
+  three. Only the word that fits may be found; the others must be skipped
+  rather than copied into the result. Prints PASS or FAIL and exits with 0
+  or 1.
+
+  Compile with:
+    cc -fsanitize=address -o crack_lib_test crack_lib_test.c crack_lib.c \
+      -lcrypt -pthread
+******************************************************************************/
+
+int main(){
+  char longest[CRACK_MAX_CANDIDATE];
+  char too_long[CRACK_MAX_CANDIDATE + 1];
+  char far_too_long[201];
+  const char *words[] = { too_long, "password", far_too_long, longest };
+  char *hashes[3];
+  crack_pool_t *pool = crack_pool_create(2);
+  crack_job_spec_t spec = {0};
+  crack_job_t *job;
+  const crack_result_t *results;
+  int n, i, failed = 0;
+
+  memset(longest, 'a', sizeof(longest) - 1);
+  longest[sizeof(longest) - 1] = '\0';
+  memset(too_long, 'b', sizeof(too_long) - 1);
+  too_long[sizeof(too_long) - 1] = '\0';
+  memset(far_too_long, 'c', sizeof(far_too_long) - 1);
+  far_too_long[sizeof(far_too_long) - 1] = '\0';
+  hashes[0] = strdup(crypt(too_long, "$6$KB$"));
+  hashes[1] = strdup(crypt(far_too_long, "$6$KB$"));
+  hashes[2] = strdup(crypt(longest, "$6$KB$"));
+
+  spec.targets = (const char **)hashes;
+  spec.n_targets = 3;
+  spec.attack = CRACK_ATTACK_WORDLIST;
+  spec.words = words;
+  spec.n_words = 4;
+  job = crack_submit(pool, &spec);
+  if(job == NULL || crack_job_wait(job) != CRACK_DONE){
+    printf("FAIL: job did not finish\n");
+    return 1;
+  }
+
+  n = crack_job_results(job, &results);
+  if(n != 1 || results[0].target != 2 || strcmp(results[0].plain, longest)){
+    printf("FAIL: expected only the %d character word to be found\n",
+           CRACK_MAX_CANDIDATE - 1);
+    failed = 1;
+  }
+  if(crack_job_tried(job) != 4){
+    printf("FAIL: %lld of 4 words tried\n", crack_job_tried(job));
+    failed = 1;
+  }
+
+  crack_job_release(job);
+  crack_pool_destroy(pool);
+  for(i=0; i<3; i++){
+    free(hashes[i]);
+  }
+  printf("%s\n", failed ? "FAIL" : "PASS");
+  return failed;
+}
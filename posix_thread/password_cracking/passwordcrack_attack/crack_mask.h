@@ -0,0 +1,128 @@
+#ifndef CRACK_MASK_H
+#define CRACK_MASK_H
+
+#include <string.h>
+#include <limits.h>
+
+/******************************************************************************
+  Masks such as "?u?u?d?d", shared by crack_lib and password_attack (and,
+  through crack_kernels.h, crack_bench): the charsets, the parser and the
+  generic way of stepping through the candidates of a mask.
+
+  A mask holds one charset per position. The charsets of ?u, ?l, ?d, ?s
+  and ?a are the ones below, and a literal character is a charset of its
+  own from mask_literals, so a mask owns no memory and can be copied or
+  moved like any other struct.
+******************************************************************************/
+
+#define MAX_CANDIDATE 64     // Longest candidate, including the '\0'
+
+static const char charset_upper[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+static const char charset_lower[] = "abcdefghijklmnopqrstuvwxyz";
+static const char charset_digit[] = "0123456789";
+static const char charset_special[] = " !\"#$%&'()*+,-./:;<=>?@[\\]^_`{|}~";
+static const char charset_all[] =
+  "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789"
+  " !\"#$%&'()*+,-./:;<=>?@[\\]^_`{|}~";
+
+#define MASK_LITERALS_4(c) {(c), 0}, {(c) + 1, 0}, {(c) + 2, 0}, {(c) + 3, 0}
+#define MASK_LITERALS_16(c) MASK_LITERALS_4(c), MASK_LITERALS_4((c) + 4), \
+  MASK_LITERALS_4((c) + 8), MASK_LITERALS_4((c) + 12)
+#define MASK_LITERALS_64(c) MASK_LITERALS_16(c), MASK_LITERALS_16((c) + 16), \
+  MASK_LITERALS_16((c) + 32), MASK_LITERALS_16((c) + 48)
+
+// Every byte as a one character string, the charset of a literal
+static const unsigned char mask_literals[256][2] = {
+  MASK_LITERALS_64(0), MASK_LITERALS_64(64), MASK_LITERALS_64(128),
+  MASK_LITERALS_64(192)
+};
+
+typedef struct mask {
+  int length;
+  const char *charset[MAX_CANDIDATE];
+  int size[MAX_CANDIDATE];
+} mask_t;
+
+/**
+ Turns a mask such as "?u?u?d?d" into one charset per position. Returns 0,
+ or -1 if the mask is empty, too long or has an unknown ?x.
+*/
+
+static inline int parse_mask(const char *spec, mask_t *mask){
+  const char *p;
+
+  mask->length = 0;
+  for(p=spec; *p; p++){
+    const char *charset;
+    if(mask->length == MAX_CANDIDATE - 1) return -1;
+    if(*p == '?' && p[1] != '\0'){
+      p++;
+      switch(*p){
+        case 'u': charset = charset_upper; break;
+        case 'l': charset = charset_lower; break;
+        case 'd': charset = charset_digit; break;
+        case 's': charset = charset_special; break;
+        case 'a': charset = charset_all; break;
+        case '?': charset = "?"; break;
+        default: return -1;
+      }
+    } else {
+      charset = (const char *)mask_literals[(unsigned char)*p];
+    }
+    mask->charset[mask->length] = charset;
+    mask->size[mask->length] = strlen(charset);
+    mask->length++;
+  }
+  return mask->length > 0 ? 0 : -1;
+}
+
+/**
+ Number of candidates of a mask, or -1 if there are more than a long long
+ holds.
+*/
+
+static inline long long mask_keyspace(mask_t *mask){
+  long long keyspace = 1;
+  int i;
+  for(i=0; i<mask->length; i++){
+    if(keyspace > LLONG_MAX / mask->size[i]) return -1;
+    keyspace *= mask->size[i];
+  }
+  return keyspace;
+}
+
+/**
+ Generic mask generator. The first candidate of a chunk is decoded from its
+ index as a mixed radix number, after that the positions are stepped like an
+ odometer.
+*/
+
+static inline void mask_decode(mask_t *mask, long long index, int *digit,
+                               char *out){
+  int i;
+  for(i=mask->length-1; i>=0; i--){
+    digit[i] = index % mask->size[i];
+    index /= mask->size[i];
+    out[i] = mask->charset[i][digit[i]];
+  }
+}
+
+/**
+ Steps to the next candidate of a mask, writing only the positions that
+ change. Returns 0 after the last candidate, when it wraps to the first.
+*/
+
+static inline int mask_step(mask_t *mask, int *digit, char *out){
+  int i;
+  for(i=mask->length-1; i>=0; i--){
+    if(++digit[i] < mask->size[i]){
+      out[i] = mask->charset[i][digit[i]];
+      return 1;
+    }
+    digit[i] = 0;
+    out[i] = mask->charset[i][0];
+  }
+  return 0;
+}
+
+#endif
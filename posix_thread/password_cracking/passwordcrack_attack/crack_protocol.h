@@ -0,0 +1,84 @@
+#ifndef CRACK_PROTOCOL_H
+#define CRACK_PROTOCOL_H
+
+#include <stdint.h>
+
+/******************************************************************************
+  The protocol spoken between crack_daemon and its clients over a Unix
+  domain socket. Both ends always run on the same machine, so integers are
+  sent in host byte order.
+
+  A client may send any number of requests on one connection. Every
+  request gets exactly one response.
+
+  Submit request:
+    crack_request_t, then spec_length bytes of attack spec (the mask, or
+    the words of a wordlist separated by '\n'), then n_targets hashes,
+    each sent as a uint16_t length followed by that many bytes.
+
+  Submit response:
+    crack_response_t, then n_results crack_hit_t.
+
+  Stats request:
+    crack_request_t with only magic and type set.
+
+  Stats response:
+    crack_response_t, then crack_stats_t.
+******************************************************************************/
+
+#define CRACK_MAGIC 0x324b5243   // "CRK2"
+#define CRACK_DEFAULT_SOCKET "/tmp/crack_daemon.sock"
+
+#define CRACK_MAX_TARGETS 1024
+#define CRACK_MAX_SPEC (1 << 20)
+
+enum crack_request_type {
+  CRACK_REQUEST_SUBMIT = 1,
+  CRACK_REQUEST_STATS = 2
+};
+
+enum crack_response_status {
+  CRACK_RESPONSE_DONE = 0,
+  CRACK_RESPONSE_CANCELLED = 1,
+  CRACK_RESPONSE_BAD_REQUEST = 2
+};
+
+typedef struct crack_request {
+  uint32_t magic;
+  uint8_t type;
+  uint8_t attack;            // enum crack_attack
+  int8_t priority;
+  uint8_t threads;           // 0 for the whole pool
+  uint16_t n_targets;
+  uint16_t reserved;
+  uint32_t spec_length;
+  uint32_t timeout_ms;       // 0 for no limit, the job is cancelled after
+} crack_request_t;
+
+typedef struct crack_response {
+  uint32_t magic;
+  uint8_t status;            // enum crack_response_status
+  uint8_t reserved;
+  uint16_t n_results;
+  uint64_t latency_us;       // From request received to job finished
+  uint64_t tried;
+} crack_response_t;
+
+typedef struct crack_hit {
+  uint16_t target;           // Index of the target in the request
+  uint16_t reserved;
+  uint32_t reserved2;
+  uint64_t index;            // Keyspace index of the matching candidate
+  char plain[64];
+} crack_hit_t;
+
+typedef struct crack_stats {
+  uint64_t jobs;
+  uint64_t p50_us;
+  uint64_t p99_us;
+  uint64_t max_us;
+  uint32_t workers;
+  uint32_t reserved;
+} crack_stats_t;
+
+#endif
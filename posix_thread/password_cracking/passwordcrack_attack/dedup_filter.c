@@ -0,0 +1,138 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include "dedup_filter.h"
+
+/******************************************************************************
+  The filter behind dedup_filter.h.
+
+  A candidate's 64 bit hash is used as:
+    bits  0-25   first bucket within the shard
+    bits 26-31   shard
+    bits 32-63   fingerprint (0 marks an empty slot, so 0 becomes 1)
+  The second bucket is the first XOR a hash of the fingerprint, as in a
+  cuckoo filter, so either bucket can be found from the other.
+
+  Compile with the program that uses it.
+******************************************************************************/
+
+#define BUCKET_SLOTS 4
+#define MAX_BUCKET_BITS 26
+#define MIN_BUCKETS 16
+
+struct dedup_filter {
+  _Atomic uint32_t *shard[DEDUP_SHARDS];
+  uint64_t bucket_mask;      // Buckets per shard - 1
+  atomic_llong entries;
+  atomic_llong lookups;
+  atomic_llong repeats;
+  atomic_llong not_stored;
+};
+
+static uint64_t hash_candidate(const char *s){
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for(; *s; s++){
+    h = (h ^ (unsigned char)*s) * 0x100000001b3ULL;
+  }
+  // FNV-1a spreads short strings badly, so finish with a full mix
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+dedup_filter_t *dedup_filter_create(long long expected, long long max_bytes){
+  dedup_filter_t *filter;
+  uint64_t buckets = MIN_BUCKETS;
+  long long per_bucket = BUCKET_SLOTS * sizeof(uint32_t) * DEDUP_SHARDS;
+  int s;
+
+  // Twice the expected candidates in slots, for a load of at most 1/2
+  while(buckets * BUCKET_SLOTS * DEDUP_SHARDS < 2 * (uint64_t)expected &&
+        buckets < (1ULL << MAX_BUCKET_BITS) &&
+        (long long)(2 * buckets) * per_bucket <= max_bytes){
+    buckets *= 2;
+  }
+  if((long long)buckets * per_bucket > max_bytes) return NULL;
+
+  filter = calloc(1, sizeof(dedup_filter_t));
+  filter->bucket_mask = buckets - 1;
+  for(s=0; s<DEDUP_SHARDS; s++){
+    filter->shard[s] = calloc(buckets * BUCKET_SLOTS, sizeof(uint32_t));
+    if(filter->shard[s] == NULL){
+      dedup_filter_destroy(filter);
+      return NULL;
+    }
+  }
+  return filter;
+}
+
+int dedup_filter_insert(dedup_filter_t *filter, const char *candidate){
+  uint64_t h = hash_candidate(candidate);
+  uint32_t fingerprint = h >> 32 ? h >> 32 : 1;
+  _Atomic uint32_t *table = filter->shard[(h >> MAX_BUCKET_BITS) %
+                                          DEDUP_SHARDS];
+  uint64_t bucket[2];
+  int b, i;
+
+  bucket[0] = h & filter->bucket_mask;
+  bucket[1] = (bucket[0] ^ (fingerprint * 0x5bd1e995u)) & filter->bucket_mask;
+  atomic_fetch_add_explicit(&filter->lookups, 1, memory_order_relaxed);
+
+  for(b=0; b<2; b++){
+    _Atomic uint32_t *slot = table + bucket[b] * BUCKET_SLOTS;
+    for(i=0; i<BUCKET_SLOTS; i++){
+      if(atomic_load_explicit(&slot[i], memory_order_relaxed) == fingerprint){
+        atomic_fetch_add_explicit(&filter->repeats, 1, memory_order_relaxed);
+        return 0;
+      }
+    }
+  }
+
+  for(b=0; b<2; b++){
+    _Atomic uint32_t *slot = table + bucket[b] * BUCKET_SLOTS;
+    for(i=0; i<BUCKET_SLOTS; i++){
+      uint32_t expected = 0;
+      if(atomic_compare_exchange_strong_explicit(&slot[i], &expected,
+                                                 fingerprint,
+                                                 memory_order_relaxed,
+                                                 memory_order_relaxed)){
+        atomic_fetch_add_explicit(&filter->entries, 1, memory_order_relaxed);
+        return 1;
+      }
+      if(expected == fingerprint){
+        // Another thread stored the same candidate a moment ago
+        atomic_fetch_add_explicit(&filter->repeats, 1, memory_order_relaxed);
+        return 0;
+      }
+    }
+  }
+  atomic_fetch_add_explicit(&filter->not_stored, 1, memory_order_relaxed);
+  return 1;
+}
+
+void dedup_filter_stats(dedup_filter_t *filter, dedup_stats_t *stats){
+  double load;
+
+  stats->slots = (filter->bucket_mask + 1) * BUCKET_SLOTS * DEDUP_SHARDS;
+  stats->bytes = stats->slots * sizeof(uint32_t);
+  stats->entries = atomic_load(&filter->entries);
+  stats->lookups = atomic_load(&filter->lookups);
+  stats->repeats = atomic_load(&filter->repeats);
+  stats->not_stored = atomic_load(&filter->not_stored);
+  // Each lookup compares against 2 x BUCKET_SLOTS slots; the load grew
+  // from 0, so on average it was half of what it is now
+  load = (double)stats->entries / stats->slots;
+  stats->false_repeats = stats->lookups * 2.0 * BUCKET_SLOTS * (load / 2) /
+                         4294967296.0;
+}
+
+void dedup_filter_destroy(dedup_filter_t *filter){
+  int s;
+  for(s=0; s<DEDUP_SHARDS; s++){
+    free((void *)filter->shard[s]);
+  }
+  free(filter);
+}
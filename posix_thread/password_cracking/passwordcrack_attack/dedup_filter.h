@@ -0,0 +1,58 @@
+#ifndef DEDUP_FILTER_H
+#define DEDUP_FILTER_H
+
+/******************************************************************************
+  An approximate set of the candidates already hashed, so that repeats can
+  be dropped before they cost a crypt() per salt.
+
+  The layout is that of a cuckoo filter: every candidate has a 32 bit
+  fingerprint that may live in one of two buckets of four slots. Slots are
+  claimed with a compare and swap, so any number of threads insert at once
+  without a lock. Fingerprints are never moved from one bucket to the
+  other, as a lock-free move is not possible with plain CAS; a candidate
+  whose two buckets are both full is simply not remembered, and will be
+  hashed again if it comes back. The filter is sized for a load of at most
+  one half, where that is rare.
+
+  The table is split into shards chosen by bits of the candidate's hash, so
+  no single allocation is larger than 1/DEDUP_SHARDS of the whole.
+
+  A filter can be wrong in one direction only: a new candidate whose
+  fingerprint matches one already in either of its buckets is taken for a
+  repeat and dropped. With 32 bit fingerprints this happens about
+  8 x load / 2^32 times per candidate, which dedup_filter_stats() reports.
+******************************************************************************/
+
+#define DEDUP_SHARDS 64
+
+typedef struct dedup_filter dedup_filter_t;
+
+typedef struct dedup_stats {
+  long long bytes;           // Memory used by the table
+  long long slots;
+  long long entries;         // Fingerprints stored
+  long long lookups;
+  long long repeats;         // Candidates reported as seen before
+  long long not_stored;      // New candidates not remembered, buckets full
+  double false_repeats;      // Expected new candidates wrongly dropped
+} dedup_stats_t;
+
+/**
+ Creates a filter for about expected candidates, using at most max_bytes.
+ Returns NULL if there is not enough memory for even a small filter.
+*/
+
+dedup_filter_t *dedup_filter_create(long long expected, long long max_bytes);
+
+/**
+ Adds a candidate. Returns 1 if it is new, and should be hashed, or 0 if
+ it has (probably) been added before.
+*/
+
+int dedup_filter_insert(dedup_filter_t *filter, const char *candidate);
+
+void dedup_filter_stats(dedup_filter_t *filter, dedup_stats_t *stats);
+
+void dedup_filter_destroy(dedup_filter_t *filter);
+
+#endif
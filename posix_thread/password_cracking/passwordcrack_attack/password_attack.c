@@ -0,0 +1,1862 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <crypt.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <limits.h>
+#include <stdarg.h>
+#include "wordlist_stream.h"
+#include "dedup_filter.h"
+#include "crack_kernels.h"
+
+/******************************************************************************
+  Cracks a set of crypt(3) hashes with several attack strategies, using
+  threads. Before anything is cracked the program plans the attack:
+
+    1. Each hashing scheme found in the targets ($1$, $5$, $6$, $6$rounds=..)
+       is benchmarked for a short time on this machine, with the thread
+       count that the attack will use, giving hashes per second.
+    2. The keyspace of every strategy is computed, and from it the time
+       needed to try every candidate against every distinct salt.
+    3. Strategies are ordered by expected cracks per second, i.e. by
+       (uncracked targets x hit probability) / predicted time.
+
+  The plan is printed, then run in order until every target is cracked.
+  Predicted and actual figures for each strategy are appended to a CSV
+  file so that the predictions can be checked afterwards. A strategy run
+  in two passes (see weights below) gets a row per pass, told apart by the
+  pass column: single, first or second.
+
+  Strategies:
+    -m mask      brute force over a mask. ?u = A-Z, ?l = a-z, ?d = 0-9,
+                 ?s = punctuation, ?a = all of them, ?? = '?', anything
+                 else is a literal character. e.g. ?u?u?d?d
+    -w file      dictionary attack, one candidate per line. A gzip, BGZF
+                 or zstd compressed list is read through a decompression
+                 stage (see wordlist_stream.h) and never unpacked to disk.
+                 Its number of words is kept in file.count once counted
+    -c l+r       combinator attack, every word of file l followed by every
+                 word of file r
+    -x w+mask    hybrid attack, every word of file w followed by the mask,
+                 e.g. -x names.txt+?d?d?d?d
+    -y mask+w    hybrid attack, the mask followed by every word of file w,
+                 e.g. -y ?u?u+surnames.txt
+                 The sides of -c, -x and -y may hold a '+' of their own;
+                 the spec is split where both sides make sense
+    -i mask:min-max
+                 length sweep, brute force over every length from min to
+                 max, where length L uses the first L positions of the
+                 mask, e.g. -i ?u?u?u?d?d:3-5. A mask of one position is
+                 used for every position, e.g. -i ?l:1-6
+
+  Combinator and hybrid candidates are generated on the fly, one outer word
+  at a time, so the cross product is never held in memory. Threads claim
+  outer words, and each thread builds the word's part of the candidate once
+  and then only rewrites the inner part.
+
+  A compressed wordlist is read twice: once while planning, to count its
+  words, and once while running. While running, the decompression stage
+  hands batches of words to the hashing threads in list order, and BGZF
+  lists are also inflated by several threads at once. Only -w takes
+  compressed lists; the word files of combinator and hybrid attacks are
+  held in memory.
+
+  A length sweep is one job on one set of threads. Its keyspace holds the
+  shortest length first, so the threads work through the cheap lengths
+  before starting on longer ones, moving on without waiting for each other.
+  The time at which each length is finished is printed. The sweep stops,
+  like every strategy, as soon as every target is cracked.
+
+  When targets have different weights, every strategy is run in two
+  passes. In the first pass each salt is searched over the share
+  weight / top weight of the strategy's keyspace, where top weight is the
+  highest weight among the live targets. The heaviest targets are searched
+  through first, and every hash computed is still checked against all
+  targets of its salt. The second pass searches what the first left out.
+  Strategies are ordered by expected weight cracked per second. The time
+  from the start of the run to each crack is printed at the end.
+
+  Any strategy may be followed by @p, the probability that the strategy finds a
+  target (default 0.5), e.g. -m ?u?u?u?d?d@0.2
+
+  Other options:
+    -f file      hashes to crack, one per line (default: the compiled-in
+                 challenge set below). A hash may be followed by a space
+                 and a weight, how much it matters that it is cracked
+                 soon (default 1)
+    -t threads   number of threads (default: all online cores)
+    -o file      CSV file that predictions and results are appended to
+                 (default: plan_results.csv)
+    -n           print the plan only, do not run it
+    -g           always use the generic mask generator, even for masks
+                 that have a specialised kernel built in (see below)
+    -U mb        drop candidates that have been tried before, in this or
+                 an earlier strategy of the same run, using a filter of at
+                 most mb megabytes (see dedup_filter.h). Wordlists with
+                 repeated words, combinator attacks ("ab"+"c" = "a"+"bc")
+                 and strategies that overlap all produce repeats. Very
+                 rarely a new candidate is dropped as well; the report at
+                 the end gives the expected number
+
+  Machine readable output:
+    -J file      write a JSON lines report stream to file (which may be a
+                 FIFO), one record per line:
+                   {"type":"hit","target":..,"hash":..,"plain":..,
+                    "index":..,"strategy":..,"thread":..,"time":..,
+                    "unix":..}
+                   {"type":"progress","strategy":..,"tried":..,
+                    "to_search":..,"cracked":..,"remaining":..,
+                    "candidates_per_s":..,"time":..}
+                   {"type":"end","cracked":..,"remaining":..,"time":..}
+                 time is seconds since the start of the run, unix is the
+                 wall clock. Hashing threads only append records to a
+                 buffer in memory; a writer thread does all the writing
+                 and flushes after every batch, so the stream can be read
+                 while the run goes on
+    -I seconds   interval between progress records (default 1)
+
+  Limits, for runs that must finish within an agreed time or cost:
+    -D seconds   stop every thread once this much time has passed since the
+                 start, which includes counting the words of compressed lists
+    -B guesses   stop after this many guesses, where a guess is one hash of
+                 one candidate with one target's salt
+    -P policy    how a guess budget is split between targets (salts):
+                 shared  one pot, spent on every live target alike (default)
+                 even    each salt gets budget / salts, unused budget of a
+                         cracked target is not handed on
+    -O file      write the coverage lines (see below) to file as well
+    -C file      continue from a previous run: keyspace ranges that the
+                 coverage lines in file show as searched for every live
+                 target of a strategy are skipped
+
+  At the end the program prints, for every target not cracked, the exact
+  keyspace ranges of every strategy that have been searched for it, one
+  tab separated line per target and strategy:
+    covered <hash> <kind> <spec> <ranges>
+  where ranges is a comma separated list of start-end pairs, end excluded,
+  or '-' if nothing was searched. Targets that have been cracked get a line
+    cracked <hash> <plain>
+  instead. These lines are what -C reads back; cracked targets are then not
+  searched for again.
+
+  Precomputed tables are not offered as a strategy: every target here is
+  salted, which is exactly what makes tables useless.
+
+  Compile with:
+    cc -o password_attack password_attack.c wordlist_stream.c dedup_filter.c \
+      -lcrypt -lz -pthread
+
+  The mask generators and the target scan are in crack_kernels.h, shared
+  with crack_bench.
+
+  Run with the default masks (two or three initials and two digits):
+    ./password_attack
+******************************************************************************/
+
+int n_passwords = 4;
+
+char *encrypted_passwords[] = {
+"$6$KB$3MiAO5oLs/.coZCPQ2QYOy8Ozo3v7QzGdwBEv3N7E0pJen3CJ63DmYXIZz6KEsykHmGsu3Dh1KCNe0niN0wvx/",
+"$6$KB$jyDvGJlpBoZ7V0LmBQMe8IRWBBOs5iptBLdOhT4LNJClRiXwfx4ul/IlCXEgzYOUjIhmBUJKNfHPVmJP3dueR1",
+"$6$KB$iyAdOw/ziDVBE0sXz8H3YRvGMVpqgV0DTg0dVbtPUyheOGYQGWP0C0g4hXnGTMZtUT0NXtmeaMY1Q6ykJqcTw0",
+"$6$KB$Uz4cD9uzcYjtg9/zNnA4wdLtqlTWw42taHPdqzfJYQOmv2Ct79UJ8e11XtqdxzH3E58trHonpZFDOwYRwJPGs1"
+};
+
+char *default_masks[] = { "?u?u?d?d", "?u?u?u?d?d" };
+
+#define MAX_THREADS 256
+#define MAX_ATTACKS 64
+#define MAX_SCHEMES 16
+#define CHUNK 64             // Candidates claimed by a thread at a time
+#define BENCHMARK_NS 300000000LL
+
+/**
+ A target hash. Targets with the same setting (scheme, rounds and salt) are
+ put in one group so each candidate is hashed once per distinct salt rather
+ than once per target.
+*/
+
+typedef struct target {
+  char *hash;
+  int group;
+  atomic_int cracked;
+  char plain[MAX_CANDIDATE];
+  double weight;             // How much cracking it soon matters
+  long long cracked_ns;      // From the start of the run, 0 if not cracked
+} target_t;
+
+typedef struct salt_group {
+  char setting[CRYPT_OUTPUT_SIZE];
+  int scheme;
+  int *members;
+  int n_members;
+  atomic_int remaining;
+  atomic_llong hashes;       // Guesses spent on this salt so far
+  long long limit;           // Candidates at or past this index are skipped
+  long long skip_below;      // And so are those below this one
+} salt_group_t;
+
+typedef struct scheme {
+  char key[CRYPT_OUTPUT_SIZE];    // Setting with the salt removed
+  char example[CRYPT_OUTPUT_SIZE];
+  double hashes_per_second;       // All threads together
+} scheme_t;
+
+typedef struct wordlist {
+  char *text;
+  char **words;
+  long long n_words;
+} wordlist_t;
+
+enum { ATTACK_MASK, ATTACK_WORDLIST, ATTACK_INCREMENT, ATTACK_COMBINATOR,
+       ATTACK_WORD_MASK, ATTACK_MASK_WORD };
+
+const char *attack_kind_names[] = { "mask", "wordlist", "increment", "combo",
+                                    "word+mask", "mask+word" };
+
+/**
+ A set of keyspace ranges, each from start up to but excluding end.
+*/
+
+typedef struct range {
+  long long start;
+  long long end;
+} range_t;
+
+typedef struct range_list {
+  range_t *r;
+  int n;
+  int capacity;
+} range_list_t;
+
+typedef struct attack {
+  int kind;
+  char spec[256];
+  mask_t mask;
+  mask_kernel_t kernel;      // Specialised kernel for the mask, or NULL
+  wordlist_t words;          // Outer list of combinator and hybrid attacks
+  wordlist_t right;          // Inner list of a combinator attack
+  long long inner;           // Candidates per outer word, 1 if not combined
+  int streamed;              // Compressed wordlist, read through a stream
+  int min_length;            // Lengths of a length sweep
+  int max_length;
+  long long length_start[MAX_CANDIDATE + 1]; // First index of each length
+  long long keyspace;
+  range_list_t *covered;     // Per target, searched in this or earlier runs
+  range_list_t todo;         // What is left to search for the live targets
+  double p_hit;
+  double predicted_s;
+  double expected_cracks;
+  double predicted_rate;     // Expected cracks per second
+} attack_t;
+
+target_t *targets;
+int n_targets;
+salt_group_t *groups;
+int n_groups;
+scheme_t schemes[MAX_SCHEMES];
+int n_schemes;
+int generic_only;            // Set by -g to disable specialised kernels
+atomic_int n_remaining;      // Targets not cracked yet, over all groups
+
+enum { BUDGET_SHARED, BUDGET_EVEN };
+
+struct timespec run_start;
+long long deadline_ns;       // 0 for no deadline
+long long budget;            // 0 for no guess budget
+int budget_policy = BUDGET_SHARED;
+atomic_int stop_all;         // Set once the deadline has passed
+
+dedup_filter_t *dedup;       // Set by -U
+long long dedup_below = LLONG_MAX; // Indexes every live salt will hash
+atomic_llong hashes_saved;   // crypt() calls avoided by dropping repeats
+
+/**
+ Work shared by the threads running one attack.
+*/
+
+typedef struct job {
+  attack_t *attack;
+  long long *todo_prefix;    // Position of each todo range in the work
+  long long claim_limit;     // Positions at or past this are not claimed
+  wordlist_stream_t *stream; // Decompression stage of a streamed wordlist
+  atomic_llong *length_left; // Candidates of each length still to search
+  struct timespec start;
+  atomic_llong next;         // Next unclaimed position
+  atomic_llong tried;
+  pthread_mutex_t done_lock;
+  range_list_t done;         // Keyspace ranges that have been searched
+} job_t;
+
+typedef struct arguments {
+  job_t *job;
+  struct crypt_data *data;
+  int number;
+} arguments_t;
+
+/**
+ The JSON lines report stream, see -J. Records are appended to pending by
+ any thread; the writer thread swaps it for an empty buffer and writes it
+ out with the lock released.
+*/
+
+typedef struct report {
+  FILE *f;
+  pthread_t writer;
+  pthread_mutex_t lock;
+  pthread_cond_t ready;
+  char *pending;
+  size_t length;
+  size_t capacity;
+  int closing;
+  job_t *job;                // Job running now, for progress records
+  long long interval_ns;
+} report_t;
+
+report_t report = { .interval_ns = 1000000000LL };
+_Thread_local int thread_number = -1;
+
+//Calculating time
+
+int time_difference(struct timespec *start, struct timespec *finish,
+                    long long int *difference) {
+  long long int ds =  finish->tv_sec - start->tv_sec;
+  long long int dn =  finish->tv_nsec - start->tv_nsec;
+  if(dn < 0 ) {
+    ds--;
+    dn += 1000000000;
+  }
+  *difference = ds * 1000000000 + dn;
+  return !(*difference > 0);
+}
+
+long long int elapsed_since(struct timespec *start){
+  struct timespec now;
+  long long int difference;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  time_difference(start, &now, &difference);
+  return difference;
+}
+
+int past_deadline(void *unused){
+  if(deadline_ns > 0 && elapsed_since(&run_start) >= deadline_ns){
+    atomic_store(&stop_all, 1);
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ Counts the words of a compressed list, which takes a full pass through it
+ the first time (see wordlist_stream_count()). Nothing is searched after
+ the deadline, so the count stops there too. Returns -1 if the list cannot
+ be read.
+*/
+
+long long count_words(const char *filename, int n_threads){
+  return wordlist_stream_count(filename, n_threads, past_deadline, NULL);
+}
+
+void ranges_add(range_list_t *list, long long start, long long end){
+  if(start >= end) return;
+  if(list->n == list->capacity){
+    list->capacity = list->capacity ? list->capacity * 2 : 16;
+    list->r = realloc(list->r, list->capacity * sizeof(range_t));
+  }
+  list->r[list->n].start = start;
+  list->r[list->n].end = end;
+  list->n++;
+}
+
+int compare_ranges(const void *a, const void *b){
+  const range_t *x = a, *y = b;
+  return x->start < y->start ? -1 : x->start > y->start;
+}
+
+/**
+ Sorts the ranges and joins those that overlap or touch.
+*/
+
+void ranges_merge(range_list_t *list){
+  int i, n = 0;
+
+  qsort(list->r, list->n, sizeof(range_t), compare_ranges);
+  for(i=0; i<list->n; i++){
+    if(n > 0 && list->r[i].start <= list->r[n-1].end){
+      if(list->r[i].end > list->r[n-1].end) list->r[n-1].end = list->r[i].end;
+    } else {
+      list->r[n++] = list->r[i];
+    }
+  }
+  list->n = n;
+}
+
+void ranges_intersect(range_list_t *a, range_list_t *b, range_list_t *out){
+  int i = 0, j = 0;
+
+  out->n = 0;
+  while(i < a->n && j < b->n){
+    long long start = a->r[i].start > b->r[j].start ? a->r[i].start :
+                                                      b->r[j].start;
+    long long end = a->r[i].end < b->r[j].end ? a->r[i].end : b->r[j].end;
+    ranges_add(out, start, end);
+    if(a->r[i].end < b->r[j].end) i++; else j++;
+  }
+}
+
+/**
+ Everything from 0 up to limit that is not in covered, which must be
+ merged.
+*/
+
+void ranges_complement(range_list_t *covered, long long limit,
+                       range_list_t *out){
+  long long from = 0;
+  int i;
+
+  out->n = 0;
+  for(i=0; i<covered->n && from < limit; i++){
+    ranges_add(out, from, covered->r[i].start < limit ?
+                          covered->r[i].start : limit);
+    from = covered->r[i].end;
+  }
+  if(from < limit) ranges_add(out, from, limit);
+}
+
+void ranges_copy(range_list_t *from, range_list_t *to){
+  int i;
+  to->n = 0;
+  for(i=0; i<from->n; i++){
+    ranges_add(to, from->r[i].start, from->r[i].end);
+  }
+}
+
+long long ranges_total(range_list_t *list){
+  long long total = 0;
+  int i;
+  for(i=0; i<list->n; i++){
+    total += list->r[i].end - list->r[i].start;
+  }
+  return total;
+}
+
+void ranges_print(FILE *f, range_list_t *list){
+  int i;
+  if(list->n == 0){
+    fputc('-', f);
+  }
+  for(i=0; i<list->n; i++){
+    fprintf(f, "%s%lld-%lld", i ? "," : "", list->r[i].start,
+            list->r[i].end);
+  }
+}
+
+void ranges_parse(const char *text, range_list_t *list){
+  long long start, end;
+  int used;
+
+  while(sscanf(text, "%lld-%lld%n", &start, &end, &used) == 2){
+    ranges_add(list, start, end);
+    text += used;
+    if(*text != ',') break;
+    text++;
+  }
+}
+
+/**
+ True once every target is cracked or the deadline has passed. Checked by
+ the threads between chunks, so they all stop within a chunk of the limit.
+*/
+
+int should_stop(){
+  if(atomic_load_explicit(&n_remaining, memory_order_relaxed) == 0 ||
+     atomic_load_explicit(&stop_all, memory_order_relaxed)){
+    return 1;
+  }
+  if(deadline_ns > 0 && elapsed_since(&run_start) >= deadline_ns){
+    atomic_store(&stop_all, 1);
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ The setting of a hash is everything up to and including the last '$'. The
+ scheme key is the setting without the salt, e.g. "$6$rounds=10000$".
+*/
+
+void setting_of(const char *hash, char *setting){
+  const char *end = strrchr(hash, '$');
+  int length = end ? end - hash + 1 : (int)strlen(hash);
+  memcpy(setting, hash, length);
+  setting[length] = '\0';
+}
+
+void scheme_key_of(const char *setting, char *key){
+  int length = strlen(setting);
+  const char *salt_start;
+
+  // Drop the trailing '$', then everything back to the '$' before the salt
+  memcpy(key, setting, length);
+  key[length - 1] = '\0';
+  salt_start = strrchr(key, '$');
+  if(salt_start != NULL){
+    key[salt_start - key + 1] = '\0';
+  }
+}
+
+int add_scheme(const char *setting){
+  char key[CRYPT_OUTPUT_SIZE];
+  int i;
+
+  scheme_key_of(setting, key);
+  for(i=0; i<n_schemes; i++){
+    if(strcmp(schemes[i].key, key) == 0) return i;
+  }
+  if(n_schemes == MAX_SCHEMES){
+    fprintf(stderr, "too many hashing schemes\n");
+    exit(1);
+  }
+  strcpy(schemes[n_schemes].key, key);
+  strcpy(schemes[n_schemes].example, setting);
+  return n_schemes++;
+}
+
+void add_targets(char **hashes, int n){
+  char setting[CRYPT_OUTPUT_SIZE];
+  int i, g;
+
+  targets = calloc(n, sizeof(target_t));
+  groups = calloc(n, sizeof(salt_group_t));
+  n_targets = n;
+  for(i=0; i<n; i++){
+    char *space = strpbrk(hashes[i], " \t");
+    targets[i].weight = 1;
+    if(space != NULL){
+      *space = '\0';
+      targets[i].weight = atof(space + 1);
+      if(targets[i].weight < 0) targets[i].weight = 0;
+    }
+    targets[i].hash = hashes[i];
+    setting_of(hashes[i], setting);
+    for(g=0; g<n_groups; g++){
+      if(strcmp(groups[g].setting, setting) == 0) break;
+    }
+    if(g == n_groups){
+      strcpy(groups[g].setting, setting);
+      groups[g].scheme = add_scheme(setting);
+      groups[g].members = calloc(n, sizeof(int));
+      n_groups++;
+    }
+    groups[g].members[groups[g].n_members++] = i;
+    atomic_fetch_add(&groups[g].remaining, 1);
+    targets[i].group = g;
+  }
+  atomic_store(&n_remaining, n);
+}
+
+/**
+ Reads a whole file and splits it into lines in place. Empty lines and lines
+ of max_length characters or more are skipped.
+*/
+
+char **read_lines(const char *filename, int max_length, char **text_out,
+                  long long *n_out){
+  FILE *f = fopen(filename, "rb");
+  long size;
+  char *text, *p;
+  char **lines;
+  long long n = 0, i = 0;
+
+  if(f == NULL){
+    perror(filename);
+    exit(1);
+  }
+  fseek(f, 0, SEEK_END);
+  size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  text = malloc(size + 1);
+  if(fread(text, 1, size, f) != (size_t)size){
+    perror(filename);
+    exit(1);
+  }
+  text[size] = '\0';
+  fclose(f);
+
+  for(p=text; *p; p++){
+    if(*p == '\n') n++;
+  }
+  lines = malloc((n + 1) * sizeof(char *));
+  p = text;
+  while(*p){
+    char *end = strchr(p, '\n');
+    if(end != NULL) *end = '\0';
+    p[strcspn(p, "\r")] = '\0';
+    if(*p && strlen(p) < (size_t)max_length) lines[i++] = p;
+    if(end == NULL) break;
+    p = end + 1;
+  }
+  *text_out = text;
+  *n_out = i;
+  return lines;
+}
+
+/**
+ Copies s into out as a JSON string. out must hold 6 bytes per character
+ of s, plus 3.
+*/
+
+char *json_string(char *out, const char *s){
+  char *p = out;
+  *p++ = '"';
+  for(; *s; s++){
+    unsigned char c = *s;
+    if(c == '"' || c == '\\'){
+      *p++ = '\\';
+      *p++ = c;
+    } else if(c < ' '){
+      p += sprintf(p, "\\u%04x", c);
+    } else {
+      *p++ = c;
+    }
+  }
+  *p++ = '"';
+  *p = '\0';
+  return out;
+}
+
+/**
+ Appends one record to the report stream. Never waits for the stream to
+ be written, only for other threads appending at the same moment.
+*/
+
+void report_record(int urgent, const char *format, ...){
+  char line[2048];
+  va_list ap;
+  int n;
+
+  if(report.f == NULL) return;
+  va_start(ap, format);
+  n = vsnprintf(line, sizeof(line) - 1, format, ap);
+  va_end(ap);
+  if(n < 0) return;
+  if(n > (int)sizeof(line) - 2) n = sizeof(line) - 2;
+  line[n++] = '\n';
+
+  pthread_mutex_lock(&report.lock);
+  if(report.length + n > report.capacity){
+    report.capacity = 2 * (report.length + n);
+    report.pending = realloc(report.pending, report.capacity);
+  }
+  memcpy(report.pending + report.length, line, n);
+  report.length += n;
+  if(urgent) pthread_cond_signal(&report.ready);
+  pthread_mutex_unlock(&report.lock);
+}
+
+/**
+ Adds a progress record for the running job. Called by the writer with
+ report.lock held, so it must not use report_record().
+*/
+
+void report_progress(long long *last_tried, long long *last_ns){
+  char line[1024], spec[6 * sizeof(((attack_t *)0)->spec) + 3];
+  long long now = elapsed_since(&run_start), tried;
+  attack_t *attack;
+  int n;
+
+  if(report.job == NULL) return;
+  attack = report.job->attack;
+  tried = atomic_load(&report.job->tried);
+  if(tried < *last_tried) *last_tried = 0;
+  n = snprintf(line, sizeof(line), "{\"type\":\"progress\",\"strategy\":%s,"
+               "\"tried\":%lld,\"to_search\":%lld,\"cracked\":%d,"
+               "\"remaining\":%d,\"candidates_per_s\":%.1f,\"time\":%.3f}\n",
+               json_string(spec, attack->spec), tried,
+               ranges_total(&attack->todo),
+               n_targets - atomic_load(&n_remaining),
+               atomic_load(&n_remaining),
+               now > *last_ns ?
+               (tried - *last_tried) / ((now - *last_ns) / 1.0e9) : 0.0,
+               now / 1.0e9);
+  *last_tried = tried;
+  *last_ns = now;
+  if(n >= (int)sizeof(line)) return;
+  if(report.length + n > report.capacity){
+    report.capacity = 2 * (report.length + n);
+    report.pending = realloc(report.pending, report.capacity);
+  }
+  memcpy(report.pending + report.length, line, n);
+  report.length += n;
+}
+
+void *report_thread(void *arg){
+  char *out = NULL;
+  size_t out_capacity = 0, out_length;
+  long long last_tried = 0, last_ns = 0, next_progress = report.interval_ns;
+  int closing;
+
+  pthread_mutex_lock(&report.lock);
+  do {
+    struct timespec wake;
+    long long now = elapsed_since(&run_start);
+    long long wait_ns = next_progress > now ? next_progress - now : 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &wake);
+    wake.tv_sec += (wake.tv_nsec + wait_ns) / 1000000000;
+    wake.tv_nsec = (wake.tv_nsec + wait_ns) % 1000000000;
+    if(report.length == 0 && !report.closing && wait_ns > 0){
+      pthread_cond_timedwait(&report.ready, &report.lock, &wake);
+    }
+    if(elapsed_since(&run_start) >= next_progress){
+      report_progress(&last_tried, &last_ns);
+      next_progress = elapsed_since(&run_start) + report.interval_ns;
+    }
+
+    // Swap buffers, then write with the lock released
+    out_length = report.length;
+    if(out_capacity < report.capacity){
+      out_capacity = report.capacity;
+      out = realloc(out, out_capacity);
+    }
+    memcpy(out, report.pending, out_length);
+    report.length = 0;
+    closing = report.closing;
+    pthread_mutex_unlock(&report.lock);
+
+    if(out_length > 0){
+      fwrite(out, 1, out_length, report.f);
+      fflush(report.f);
+    }
+    pthread_mutex_lock(&report.lock);
+  } while(!closing || report.length > 0);
+  pthread_mutex_unlock(&report.lock);
+  free(out);
+  return NULL;
+}
+
+void report_open(const char *filename){
+  pthread_condattr_t attr;
+
+  report.f = fopen(filename, "w");
+  if(report.f == NULL){
+    perror(filename);
+    exit(1);
+  }
+  pthread_mutex_init(&report.lock, NULL);
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&report.ready, &attr);
+  pthread_condattr_destroy(&attr);
+  pthread_create(&report.writer, NULL, report_thread, NULL);
+}
+
+/**
+ Sets the job that progress records are about, NULL between jobs.
+*/
+
+void report_job(job_t *job){
+  if(report.f == NULL) return;
+  pthread_mutex_lock(&report.lock);
+  report.job = job;
+  pthread_mutex_unlock(&report.lock);
+}
+
+void report_close(){
+  if(report.f == NULL) return;
+  report_record(0, "{\"type\":\"end\",\"cracked\":%d,\"remaining\":%d,"
+                "\"time\":%.3f}", n_targets - atomic_load(&n_remaining),
+                atomic_load(&n_remaining), elapsed_since(&run_start) / 1.0e9);
+  pthread_mutex_lock(&report.lock);
+  report.closing = 1;
+  pthread_cond_signal(&report.ready);
+  pthread_mutex_unlock(&report.lock);
+  pthread_join(report.writer, NULL);
+  fclose(report.f);
+  free(report.pending);
+}
+
+/**
+ Reports a hit in the same format as the other crack programs.
+*/
+
+void found(int t, const char *plain, long long index, const char *enc){
+  int expected = 0;
+  if(atomic_compare_exchange_strong(&targets[t].cracked, &expected, 1)){
+    strcpy(targets[t].plain, plain);
+    atomic_fetch_sub(&groups[targets[t].group].remaining, 1);
+    atomic_fetch_sub(&n_remaining, 1);
+    // A negative index is a target cracked by an earlier run, see -C
+    if(index >= 0){
+      targets[t].cracked_ns = elapsed_since(&run_start);
+      printf("#%-8lld%s %s\n", index + 1, plain, enc);
+      fflush(stdout);
+    }
+    if(index >= 0 && report.f != NULL){
+      char plain_json[6 * MAX_CANDIDATE + 3], hash_json[6 * CRYPT_OUTPUT_SIZE];
+      char spec_json[6 * sizeof(report.job->attack->spec) + 3];
+      struct timespec now;
+      clock_gettime(CLOCK_REALTIME, &now);
+      report_record(1, "{\"type\":\"hit\",\"target\":%d,\"hash\":%s,"
+                    "\"plain\":%s,\"index\":%lld,\"strategy\":%s,"
+                    "\"thread\":%d,\"time\":%.3f,\"unix\":%lld.%03ld}", t,
+                    json_string(hash_json, enc),
+                    json_string(plain_json, plain), index,
+                    json_string(spec_json, report.job->attack->spec),
+                    thread_number, elapsed_since(&run_start) / 1.0e9,
+                    (long long)now.tv_sec, now.tv_nsec / 1000000);
+    }
+  }
+}
+
+int target_live(int t){
+  return !atomic_load_explicit(&targets[t].cracked, memory_order_relaxed);
+}
+
+const char *target_hash(int t){
+  return targets[t].hash;
+}
+
+/**
+ Hashes one candidate once for every salt that still has uncracked targets
+ and compares the result against each of them.
+*/
+
+void check_candidate(const char *plain, long long index,
+                     struct crypt_data *data){
+  int g;
+  char *enc;
+
+  // A repeat is dropped only where every live salt would hash it, since a
+  // salt past its budget limit never saw the first one
+  if(dedup != NULL && index < dedup_below &&
+     !dedup_filter_insert(dedup, plain)){
+    for(g=0; g<n_groups; g++){
+      if(atomic_load_explicit(&groups[g].remaining,
+                              memory_order_relaxed) > 0){
+        atomic_fetch_add_explicit(&hashes_saved, 1, memory_order_relaxed);
+      }
+    }
+    return;
+  }
+
+  for(g=0; g<n_groups; g++){
+    if(atomic_load_explicit(&groups[g].remaining, memory_order_relaxed) == 0 ||
+       index >= groups[g].limit || index < groups[g].skip_below){
+      continue;
+    }
+    enc = crypt_r(plain, groups[g].setting, data);
+    atomic_fetch_add_explicit(&groups[g].hashes, 1, memory_order_relaxed);
+    if(enc == NULL) continue;
+    scan_salt(enc, groups[g].members, groups[g].n_members, plain, index);
+  }
+}
+
+void run_wordlist_chunk(wordlist_t *words, long long first, long long count,
+                        struct crypt_data *data){
+  long long c;
+  for(c=0; c<count; c++){
+    check_candidate(words->words[first + c], first + c, data);
+  }
+}
+
+/**
+ Tries count candidates made from one outer word of a combinator or hybrid
+ attack, starting from candidate from of that word. Candidates longer than
+ MAX_CANDIDATE - 1 are skipped. Returns the number of candidates covered,
+ which is less than count only if the threads were told to stop.
+*/
+
+long long run_combined_word(attack_t *attack, long long outer, long long from,
+                            long long count, struct crypt_data *data){
+  const char *word = attack->words.words[outer];
+  int word_length = strlen(word);
+  long long base = outer * attack->inner;
+  char plain[2 * MAX_CANDIDATE];
+  int digit[MAX_CANDIDATE];
+  long long c;
+  char *mask_out;
+
+  if(attack->kind == ATTACK_COMBINATOR){
+    memcpy(plain, word, word_length);
+    for(c=from; c<from+count; c++){
+      const char *right = attack->right.words[c];
+      int right_length = strlen(right);
+      if((c - from) % CHUNK == CHUNK - 1 && should_stop()) return c - from;
+      if(word_length + right_length >= MAX_CANDIDATE) continue;
+      memcpy(plain + word_length, right, right_length + 1);
+      check_candidate(plain, base + c, data);
+    }
+    return count;
+  }
+
+  if(word_length + attack->mask.length >= MAX_CANDIDATE){
+    return count;
+  }
+  if(attack->kind == ATTACK_WORD_MASK){
+    memcpy(plain, word, word_length);
+    mask_out = plain + word_length;
+  } else {
+    memcpy(plain + attack->mask.length, word, word_length);
+    mask_out = plain;
+  }
+  plain[word_length + attack->mask.length] = '\0';
+  mask_decode(&attack->mask, from, digit, mask_out);
+  for(c=from; c<from+count; c++){
+    if((c - from) % CHUNK == CHUNK - 1 && should_stop()) return c - from;
+    check_candidate(plain, base + c, data);
+    mask_step(&attack->mask, digit, mask_out);
+  }
+  return count;
+}
+
+/**
+ Claims the next piece of work. Work positions run over the todo ranges
+ one after the other, so ranges searched by an earlier run are never
+ handed out. A claim never crosses the end of a todo range or, for
+ combined attacks, of an outer word. Returns 0 when there is nothing left.
+*/
+
+int claim(job_t *job, long long unit, long long *first, long long *count){
+  attack_t *attack = job->attack;
+  range_t *todo = attack->todo.r;
+  long long position, n;
+  int low, high, i;
+
+  position = atomic_load(&job->next);
+  do {
+    if(position >= job->claim_limit) return 0;
+    low = 0;
+    high = attack->todo.n - 1;
+    while(low < high){
+      int middle = (low + high + 1) / 2;
+      if(job->todo_prefix[middle] <= position) low = middle; else high = middle - 1;
+    }
+    i = low;
+    *first = todo[i].start + (position - job->todo_prefix[i]);
+    n = todo[i].end - *first;
+    if(n > unit) n = unit;
+    if(n > job->claim_limit - position) n = job->claim_limit - position;
+    if(attack->kind >= ATTACK_COMBINATOR &&
+       n > attack->inner - *first % attack->inner){
+      n = attack->inner - *first % attack->inner;
+    }
+  } while(!atomic_compare_exchange_weak(&job->next, &position, position + n));
+  *count = n;
+  return 1;
+}
+
+void record_done(job_t *job, long long first, long long count){
+  pthread_mutex_lock(&job->done_lock);
+  ranges_add(&job->done, first, first + count);
+  pthread_mutex_unlock(&job->done_lock);
+  atomic_fetch_add(&job->tried, count);
+}
+
+/**
+ Tries a chunk of a length sweep, which may run from the end of one
+ length into the next.
+*/
+
+void run_increment_chunk(job_t *job, long long first, long long count,
+                         struct crypt_data *data){
+  attack_t *attack = job->attack;
+  mask_t mask = attack->mask;
+  int length = attack->min_length;
+  long long n;
+
+  while(count > 0){
+    while(first >= attack->length_start[length + 1]) length++;
+    n = attack->length_start[length + 1] - first;
+    if(n > count) n = count;
+    mask.length = length;
+    run_mask_chunk(&mask, first - attack->length_start[length], n,
+                   attack->length_start[length], data);
+    if(atomic_fetch_sub(&job->length_left[length], n) == n){
+      printf("length %d finished at %.2fs\n", length,
+             elapsed_since(&job->start) / 1.0e9);
+      fflush(stdout);
+    }
+    first += n;
+    count -= n;
+  }
+}
+
+/**
+ Work position of a keyspace index, or -1 if the index is not to be
+ searched.
+*/
+
+long long position_of(job_t *job, long long index){
+  range_t *todo = job->attack->todo.r;
+  int low = 0, high = job->attack->todo.n - 1;
+
+  while(low <= high){
+    int middle = (low + high) / 2;
+    if(index < todo[middle].start){
+      high = middle - 1;
+    } else if(index >= todo[middle].end){
+      low = middle + 1;
+    } else {
+      return job->todo_prefix[middle] + (index - todo[middle].start);
+    }
+  }
+  return -1;
+}
+
+/**
+ Runs a compressed wordlist. Batches come from the decompression stage in
+ list order, so a thread takes a whole batch rather than claiming. Words
+ searched by an earlier run are passed over, and the thread stops at the
+ first word past the guess budget.
+*/
+
+void run_streamed(job_t *job, struct crypt_data *data){
+  word_batch_t *batch;
+  int past_limit = 0;
+
+  while(!past_limit && !should_stop() &&
+        (batch = wordlist_stream_next(job->stream)) != NULL){
+    long long first = 0, count = 0;
+    int i;
+    for(i=0; i<batch->n; i++){
+      long long index = batch->first + i;
+      long long position = position_of(job, index);
+      if(position >= job->claim_limit){
+        past_limit = 1;
+        break;
+      }
+      if(position < 0) continue;
+      if(count % CHUNK == CHUNK - 1 && should_stop()) break;
+      if(index != first + count){
+        if(count > 0) record_done(job, first, count);
+        first = index;
+        count = 0;
+      }
+      check_candidate(batch->words[i], index, data);
+      count++;
+    }
+    if(count > 0) record_done(job, first, count);
+    wordlist_batch_free(batch);
+  }
+}
+
+void *attack_thread(void *arg){
+  arguments_t *args = arg;
+  job_t *job = args->job;
+  attack_t *attack = job->attack;
+  long long first, count;
+
+  thread_number = args->number;
+  if(attack->streamed){
+    run_streamed(job, args->data);
+    return NULL;
+  }
+  if(attack->kind >= ATTACK_COMBINATOR){
+    // Combined attacks split the outer word list between the threads
+    while(!should_stop() && claim(job, attack->inner, &first, &count)){
+      count = run_combined_word(attack, first / attack->inner,
+                                first % attack->inner, count, args->data);
+      record_done(job, first, count);
+    }
+    return NULL;
+  }
+
+  while(!should_stop() && claim(job, CHUNK, &first, &count)){
+    if(attack->kernel != NULL){
+      attack->kernel(first, count, args->data);
+    } else if(attack->kind == ATTACK_INCREMENT){
+      run_increment_chunk(job, first, count, args->data);
+    } else if(attack->kind == ATTACK_MASK){
+      run_mask_chunk(&attack->mask, first, count, 0, args->data);
+    } else {
+      run_wordlist_chunk(&attack->words, first, count, args->data);
+    }
+    record_done(job, first, count);
+  }
+  return NULL;
+}
+
+/**
+ Measures how many hashes per second one scheme gives with n_threads busy.
+*/
+
+typedef struct benchmark_arguments {
+  const char *setting;
+  struct crypt_data *data;
+  long long hashes;
+} benchmark_arguments_t;
+
+void *benchmark_thread(void *arg){
+  benchmark_arguments_t *args = arg;
+  struct timespec start;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  do {
+    crypt_r("AB12", args->setting, args->data);
+    args->hashes++;
+  } while(elapsed_since(&start) < BENCHMARK_NS);
+  return NULL;
+}
+
+void benchmark_schemes(int n_threads, struct crypt_data **data){
+  pthread_t threads[MAX_THREADS];
+  benchmark_arguments_t args[MAX_THREADS];
+  struct timespec start;
+  long long total, time_elapsed;
+  int s, i;
+
+  for(s=0; s<n_schemes; s++){
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(i=0; i<n_threads; i++){
+      args[i].setting = schemes[s].example;
+      args[i].data = data[i];
+      args[i].hashes = 0;
+      pthread_create(&threads[i], NULL, benchmark_thread, &args[i]);
+    }
+    total = 0;
+    for(i=0; i<n_threads; i++){
+      pthread_join(threads[i], NULL);
+      total += args[i].hashes;
+    }
+    time_elapsed = elapsed_since(&start);
+    schemes[s].hashes_per_second = total / (time_elapsed / 1.0e9);
+    printf("benchmark %-20s %12.1f hashes/s with %d threads\n",
+           schemes[s].key, schemes[s].hashes_per_second, n_threads);
+  }
+}
+
+/**
+ Seconds needed to hash one candidate against every uncracked salt.
+*/
+
+double seconds_per_candidate(){
+  double seconds = 0;
+  int g;
+  for(g=0; g<n_groups; g++){
+    if(atomic_load(&groups[g].remaining) > 0){
+      seconds += 1.0 / schemes[groups[g].scheme].hashes_per_second;
+    }
+  }
+  return seconds;
+}
+
+/**
+ Sum of the weights of the targets not cracked yet.
+*/
+
+double live_weight(){
+  double weight = 0;
+  int t;
+  for(t=0; t<n_targets; t++){
+    if(!targets[t].cracked) weight += targets[t].weight;
+  }
+  return weight;
+}
+
+void predict(attack_t *attack){
+  attack->predicted_s = ranges_total(&attack->todo) * seconds_per_candidate();
+  attack->expected_cracks = live_weight() * attack->p_hit;
+  attack->predicted_rate = attack->predicted_s > 0 ?
+                           attack->expected_cracks / attack->predicted_s : 0;
+}
+
+int compare_attacks(const void *a, const void *b){
+  const attack_t *x = a, *y = b;
+  if(x->predicted_rate > y->predicted_rate) return -1;
+  if(x->predicted_rate < y->predicted_rate) return 1;
+  return 0;
+}
+
+/**
+ Reads mask:min-max for a length sweep and lays out its keyspace, one
+ length after another from the shortest.
+*/
+
+int parse_increment(attack_t *attack){
+  char mask_spec[sizeof(attack->spec)];
+  char *colon = strrchr(strcpy(mask_spec, attack->spec), ':');
+  mask_t *mask = &attack->mask;
+  long long per_length = 1;
+  int length;
+
+  if(colon == NULL) return -1;
+  *colon++ = '\0';
+  if(parse_mask(mask_spec, mask) != 0 ||
+     sscanf(colon, "%d-%d", &attack->min_length, &attack->max_length) != 2 ||
+     attack->min_length < 1 || attack->max_length < attack->min_length ||
+     attack->max_length >= MAX_CANDIDATE){
+    return -1;
+  }
+  if(mask->length == 1){
+    for(length=1; length<attack->max_length; length++){
+      mask->charset[length] = mask->charset[0];
+      mask->size[length] = mask->size[0];
+    }
+    mask->length = attack->max_length;
+  }
+  if(attack->max_length > mask->length) return -1;
+
+  attack->keyspace = 0;
+  for(length=1; length<=attack->max_length; length++){
+    if(per_length > LLONG_MAX / mask->size[length - 1]) return -1;
+    per_length *= mask->size[length - 1];
+    if(length < attack->min_length) continue;
+    if(attack->keyspace > LLONG_MAX - per_length) return -1;
+    attack->length_start[length] = attack->keyspace;
+    attack->keyspace += per_length;
+  }
+  attack->length_start[attack->max_length + 1] = attack->keyspace;
+  return 0;
+}
+
+/**
+ Counts what is to be searched of each length of a length sweep.
+*/
+
+void init_length_left(job_t *job){
+  attack_t *attack = job->attack;
+  range_list_t length_range = {0}, todo = {0};
+  int length;
+
+  job->length_left = calloc(MAX_CANDIDATE + 1, sizeof(atomic_llong));
+  for(length=attack->min_length; length<=attack->max_length; length++){
+    length_range.n = 0;
+    ranges_add(&length_range, attack->length_start[length],
+               attack->length_start[length + 1]);
+    ranges_intersect(&attack->todo, &length_range, &todo);
+    atomic_init(&job->length_left[length], ranges_total(&todo));
+  }
+  free(length_range.r);
+  free(todo.r);
+}
+
+/**
+ Splits the left+right spec of a combinator or hybrid attack, returning the
+ right side, or NULL. A mask or a file name may hold a '+' of its own, so
+ the split is made at the first '+' where each file side is a file that can
+ be read and the mask side, if any, is a valid mask.
+*/
+
+char *split_attack(char *spec, int kind){
+  char *plus;
+  mask_t mask;
+  int left_ok, right_ok;
+
+  for(plus=strchr(spec, '+'); plus!=NULL; plus=strchr(plus + 1, '+')){
+    *plus = '\0';
+    left_ok = kind == ATTACK_MASK_WORD ? parse_mask(spec, &mask) == 0
+                                       : access(spec, R_OK) == 0;
+    right_ok = kind == ATTACK_WORD_MASK ? parse_mask(plus + 1, &mask) == 0
+                                        : access(plus + 1, R_OK) == 0;
+    if(left_ok && right_ok) return plus + 1;
+    *plus = '+';
+  }
+  return NULL;
+}
+
+int add_attack(attack_t *attacks, int n, int kind, const char *arg){
+  attack_t *attack = &attacks[n];
+  char *at;
+
+  if(n == MAX_ATTACKS){
+    fprintf(stderr, "too many strategies\n");
+    exit(1);
+  }
+  memset(attack, 0, sizeof(*attack));
+  attack->kind = kind;
+  attack->p_hit = 0.5;
+  snprintf(attack->spec, sizeof(attack->spec), "%s", arg);
+  at = strrchr(attack->spec, '@');
+  if(at != NULL){
+    *at = '\0';
+    attack->p_hit = atof(at + 1);
+  }
+  attack->inner = 1;
+  if(kind == ATTACK_MASK){
+    if(parse_mask(attack->spec, &attack->mask) != 0 ||
+       (attack->keyspace = mask_keyspace(&attack->mask)) < 0){
+      fprintf(stderr, "bad mask %s\n", attack->spec);
+      exit(1);
+    }
+  } else if(kind == ATTACK_INCREMENT){
+    if(parse_increment(attack) != 0){
+      fprintf(stderr, "bad length sweep %s, expected mask:min-max\n",
+              attack->spec);
+      exit(1);
+    }
+  } else if(kind == ATTACK_WORDLIST && wordlist_is_compressed(attack->spec)){
+    // Counted in main(), once the number of threads is known
+    attack->streamed = 1;
+  } else if(kind == ATTACK_WORDLIST){
+    attack->words.words = read_lines(attack->spec, MAX_CANDIDATE,
+                                     &attack->words.text,
+                                     &attack->words.n_words);
+    attack->keyspace = attack->words.n_words;
+  } else {
+    char left[sizeof(attack->spec)];
+    char *right = split_attack(strcpy(left, attack->spec), kind);
+    char *word_file, *mask_spec;
+    if(right == NULL){
+      fprintf(stderr, "expected left+right, with %s, got %s\n",
+              kind == ATTACK_COMBINATOR ? "two readable files" :
+              "a readable file and a mask", attack->spec);
+      exit(1);
+    }
+    if(kind == ATTACK_COMBINATOR){
+      word_file = left;
+      attack->right.words = read_lines(right, MAX_CANDIDATE,
+                                       &attack->right.text,
+                                       &attack->right.n_words);
+      attack->inner = attack->right.n_words;
+    } else {
+      word_file = kind == ATTACK_WORD_MASK ? left : right;
+      mask_spec = kind == ATTACK_WORD_MASK ? right : left;
+      if(parse_mask(mask_spec, &attack->mask) != 0 ||
+         (attack->inner = mask_keyspace(&attack->mask)) < 0){
+        fprintf(stderr, "bad mask %s\n", mask_spec);
+        exit(1);
+      }
+    }
+    attack->words.words = read_lines(word_file, MAX_CANDIDATE,
+                                     &attack->words.text,
+                                     &attack->words.n_words);
+    if(attack->inner > 0 && attack->words.n_words > LLONG_MAX / attack->inner){
+      fprintf(stderr, "%s has more candidates than can be counted\n",
+              attack->spec);
+      exit(1);
+    }
+    attack->keyspace = attack->words.n_words * attack->inner;
+  }
+  return n + 1;
+}
+
+/**
+ Works out what an attack still has to search: every index that has not
+ been searched for at least one live target.
+*/
+
+void build_todo(attack_t *attack){
+  range_list_t common = {0}, scratch = {0};
+  int t, first = 1;
+
+  for(t=0; t<n_targets; t++){
+    if(targets[t].cracked) continue;
+    if(first){
+      ranges_copy(&attack->covered[t], &common);
+      first = 0;
+    } else {
+      ranges_intersect(&common, &attack->covered[t], &scratch);
+      ranges_copy(&scratch, &common);
+    }
+  }
+  ranges_complement(&common, attack->keyspace, &attack->todo);
+  free(common.r);
+  free(scratch.r);
+}
+
+/**
+ Keyspace index of a work position, or LLONG_MAX past the end of the work.
+*/
+
+long long index_at(job_t *job, long long position){
+  attack_t *attack = job->attack;
+  int i;
+
+  for(i=0; i<attack->todo.n; i++){
+    if(position < job->todo_prefix[i + 1]){
+      return attack->todo.r[i].start + (position - job->todo_prefix[i]);
+    }
+  }
+  return LLONG_MAX;
+}
+
+/**
+ Limits the attack to what is left of the guess budget. Under the shared
+ policy the claims stop when the rest of the budget, spread over the live
+ salts, is used. Under the even policy every salt has its own allowance and
+ is dropped from check_candidate() once the attack passes it.
+*/
+
+void apply_budget(job_t *job){
+  long long total = ranges_total(&job->attack->todo);
+  long long spent = 0, allowance, most = 0;
+  int g, live = 0;
+
+  job->claim_limit = total;
+  dedup_below = LLONG_MAX;
+  for(g=0; g<n_groups; g++){
+    groups[g].limit = LLONG_MAX;
+    spent += atomic_load(&groups[g].hashes);
+    if(atomic_load(&groups[g].remaining) > 0) live++;
+  }
+  if(budget == 0 || live == 0) return;
+
+  if(budget_policy == BUDGET_SHARED){
+    allowance = budget > spent ? (budget - spent) / live : 0;
+    if(allowance < job->claim_limit) job->claim_limit = allowance;
+    return;
+  }
+  for(g=0; g<n_groups; g++){
+    if(atomic_load(&groups[g].remaining) == 0) continue;
+    allowance = budget / n_groups - atomic_load(&groups[g].hashes);
+    if(allowance < 0) allowance = 0;
+    groups[g].limit = index_at(job, allowance);
+    if(groups[g].limit < dedup_below) dedup_below = groups[g].limit;
+    if(allowance > most) most = allowance;
+  }
+  if(most < job->claim_limit) job->claim_limit = most;
+}
+
+/**
+ Sets up the first pass of a strategy over targets of different weights:
+ each live salt is limited to the share weight / top weight of the work,
+ where a salt weighs as much as its heaviest live target. Returns 0, and
+ changes nothing, if every live salt weighs the same.
+*/
+
+int apply_priority(job_t *job){
+  long long total = ranges_total(&job->attack->todo);
+  double *weight = malloc(n_groups * sizeof(double)), top = 0;
+  int g, m, differ = 0;
+
+  for(g=0; g<n_groups; g++){
+    weight[g] = -1;
+    for(m=0; m<groups[g].n_members; m++){
+      target_t *target = &targets[groups[g].members[m]];
+      if(!target->cracked && target->weight > weight[g]){
+        weight[g] = target->weight;
+      }
+    }
+    if(weight[g] > top) top = weight[g];
+  }
+  for(g=0; g<n_groups; g++){
+    if(weight[g] >= 0 && weight[g] != top) differ = 1;
+  }
+
+  for(g=0; g<n_groups && differ && top > 0; g++){
+    long long limit;
+    if(weight[g] < 0 || weight[g] == top) continue;
+    limit = index_at(job, (long long)(total * (weight[g] / top)));
+    if(limit < groups[g].limit) groups[g].limit = limit;
+    if(groups[g].limit < dedup_below) dedup_below = groups[g].limit;
+  }
+  free(weight);
+  return differ && top > 0;
+}
+
+/**
+ Adds what the attack searched to the coverage of every live target,
+ leaving out anything past the target's budget limit.
+*/
+
+void update_coverage(job_t *job){
+  attack_t *attack = job->attack;
+  range_list_t clipped = {0}, limit = {0};
+  int t, i;
+
+  ranges_merge(&job->done);
+  for(t=0; t<n_targets; t++){
+    if(targets[t].cracked) continue;
+    limit.n = 0;
+    ranges_add(&limit, 0, groups[targets[t].group].limit);
+    ranges_intersect(&job->done, &limit, &clipped);
+    for(i=0; i<clipped.n; i++){
+      ranges_add(&attack->covered[t], clipped.r[i].start, clipped.r[i].end);
+    }
+    ranges_merge(&attack->covered[t]);
+  }
+  free(clipped.r);
+  free(limit.r);
+}
+
+/**
+ Reads the coverage lines of an earlier run. Lines for targets or
+ strategies that are not part of this run are ignored.
+*/
+
+void load_coverage(const char *filename, attack_t *attacks, int n_attacks){
+  char *text, **lines;
+  long long n, l;
+  int t, a;
+
+  lines = read_lines(filename, INT_MAX, &text, &n);
+  for(l=0; l<n; l++){
+    char *field[5];
+    char *p = lines[l];
+    int f;
+    for(f=0; f<5 && p!=NULL; f++){
+      field[f] = p;
+      p = strchr(p, '\t');
+      if(p != NULL) *p++ = '\0';
+    }
+    if(f < 2) continue;
+    for(t=0; t<n_targets && strcmp(targets[t].hash, field[1]) != 0; t++);
+    if(t < n_targets && f >= 3 && strcmp(field[0], "cracked") == 0 &&
+       strlen(field[2]) < MAX_CANDIDATE){
+      found(t, field[2], -1, targets[t].hash);
+      continue;
+    }
+    if(f < 5 || strcmp(field[0], "covered") != 0) continue;
+    for(a=0; a<n_attacks; a++){
+      if(strcmp(attack_kind_names[attacks[a].kind], field[2]) == 0 &&
+         strcmp(attacks[a].spec, field[3]) == 0) break;
+    }
+    if(t == n_targets || a == n_attacks) continue;
+    ranges_parse(field[4], &attacks[a].covered[t]);
+    ranges_merge(&attacks[a].covered[t]);
+  }
+  free(lines);
+  free(text);
+}
+
+void print_coverage(FILE *f, attack_t *attacks, int n_attacks){
+  int t, a;
+  for(t=0; t<n_targets; t++){
+    if(targets[t].cracked){
+      fprintf(f, "cracked\t%s\t%s\n", targets[t].hash, targets[t].plain);
+      continue;
+    }
+    for(a=0; a<n_attacks; a++){
+      fprintf(f, "covered\t%s\t%s\t%s\t", targets[t].hash,
+              attack_kind_names[attacks[a].kind], attacks[a].spec);
+      ranges_print(f, &attacks[a].covered[t]);
+      fputc('\n', f);
+    }
+  }
+}
+
+void print_plan(attack_t *attacks, int n){
+  int i;
+  printf("\n%-4s%-9s %-24s %14s %12s %10s %12s\n", "#", "kind", "strategy",
+         "to search", "predicted_s", "p_hit", "cracks/s");
+  for(i=0; i<n; i++){
+    printf("%-4d%-9s %-24s %14lld %12.2f %10.2f %12.6f\n", i + 1,
+           attack_kind_names[attacks[i].kind], attacks[i].spec,
+           ranges_total(&attacks[i].todo), attacks[i].predicted_s,
+           attacks[i].p_hit, attacks[i].predicted_rate);
+  }
+  printf("\n");
+}
+
+int main(int argc, char *argv[]){
+  attack_t *attacks = calloc(MAX_ATTACKS, sizeof(attack_t));
+  int n_attacks = 0;
+  int n_threads = sysconf(_SC_NPROCESSORS_ONLN);
+  int plan_only = 0;
+  long long dedup_mb = 0;
+  char *results_file = "plan_results.csv";
+  char *coverage_out = NULL, *coverage_in = NULL, *report_file = NULL;
+  char **hashes = encrypted_passwords;
+  int n_hashes = n_passwords;
+  struct crypt_data *data[MAX_THREADS];
+  pthread_t threads[MAX_THREADS];
+  arguments_t args[MAX_THREADS];
+  struct timespec start, finish, attack_start;
+  long long int time_elapsed;
+  FILE *results;
+  const char *results_header = "strategy,pass,keyspace,threads,predicted_s,"
+    "actual_s,predicted_hps,actual_hps,searched,cracked\n";
+  char header[256];
+  int prioritised = 0;
+  int opt, i, a;
+
+  while((opt = getopt(argc, argv, "gm:w:c:x:y:i:f:t:o:nD:B:P:O:C:U:J:I:")) != -1){
+    switch(opt){
+      case 'm': n_attacks = add_attack(attacks, n_attacks, ATTACK_MASK,
+                                       optarg); break;
+      case 'w': n_attacks = add_attack(attacks, n_attacks, ATTACK_WORDLIST,
+                                       optarg); break;
+      case 'c': n_attacks = add_attack(attacks, n_attacks, ATTACK_COMBINATOR,
+                                       optarg); break;
+      case 'x': n_attacks = add_attack(attacks, n_attacks, ATTACK_WORD_MASK,
+                                       optarg); break;
+      case 'y': n_attacks = add_attack(attacks, n_attacks, ATTACK_MASK_WORD,
+                                       optarg); break;
+      case 'i': n_attacks = add_attack(attacks, n_attacks, ATTACK_INCREMENT,
+                                       optarg); break;
+      case 'f': {
+        char *text;
+        long long n;
+        hashes = read_lines(optarg, CRYPT_OUTPUT_SIZE + 32, &text, &n);
+        n_hashes = n;
+        break;
+      }
+      case 't': n_threads = atoi(optarg); break;
+      case 'o': results_file = optarg; break;
+      case 'n': plan_only = 1; break;
+      case 'g': generic_only = 1; break;
+      case 'D': deadline_ns = atof(optarg) * 1.0e9; break;
+      case 'B': budget = atof(optarg); break;
+      case 'P':
+        budget_policy = strcmp(optarg, "even") == 0 ? BUDGET_EVEN :
+                                                      BUDGET_SHARED;
+        break;
+      case 'O': coverage_out = optarg; break;
+      case 'C': coverage_in = optarg; break;
+      case 'U': dedup_mb = atoll(optarg); break;
+      case 'J': report_file = optarg; break;
+      case 'I': report.interval_ns = atof(optarg) * 1.0e9; break;
+      default:
+        fprintf(stderr, "usage: %s [-m mask[@p]] [-w wordlist[@p]] [-c l+r[@p]] "
+                "[-x w+mask[@p]] [-y mask+w[@p]] [-i mask:min-max[@p]] "
+                "[-f hashes] [-t threads] [-o results.csv] [-n] [-g] "
+                "[-D seconds] [-B guesses] [-P shared|even] [-O coverage] "
+                "[-C coverage] [-U mb] [-J report.jsonl] [-I seconds]\n",
+                argv[0]);
+        return 1;
+    }
+  }
+  if(n_attacks == 0){
+    for(i=0; i<2; i++){
+      n_attacks = add_attack(attacks, n_attacks, ATTACK_MASK,
+                             default_masks[i]);
+    }
+  }
+  if(n_threads < 1) n_threads = 1;
+  if(n_threads > MAX_THREADS) n_threads = MAX_THREADS;
+  // Counting a compressed list is a full pass through it, so it is charged
+  // against the deadline too
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  run_start = start;
+  for(a=0; a<n_attacks; a++){
+    if(attacks[a].kind == ATTACK_MASK && !generic_only){
+      attacks[a].kernel = find_mask_kernel(attacks[a].spec);
+    }
+    if(attacks[a].streamed){
+      clock_gettime(CLOCK_MONOTONIC, &attack_start);
+      attacks[a].keyspace = count_words(attacks[a].spec, n_threads);
+      if(attacks[a].keyspace < 0) return 1;
+      printf("counted %lld words in %s in %.2fs%s\n", attacks[a].keyspace,
+             attacks[a].spec, elapsed_since(&attack_start) / 1.0e9,
+             atomic_load(&stop_all) ? ", stopped at the deadline" : "");
+    }
+  }
+
+  add_targets(hashes, n_hashes);
+  for(a=0; a<n_attacks; a++){
+    attacks[a].covered = calloc(n_targets, sizeof(range_list_t));
+  }
+  if(coverage_in != NULL){
+    load_coverage(coverage_in, attacks, n_attacks);
+  }
+  for(i=0; i<n_threads; i++){
+    data[i] = calloc(1, sizeof(struct crypt_data));
+  }
+
+  benchmark_schemes(n_threads, data);
+  for(a=0; a<n_attacks; a++){
+    build_todo(&attacks[a]);
+    predict(&attacks[a]);
+  }
+  qsort(attacks, n_attacks, sizeof(attack_t), compare_attacks);
+  print_plan(attacks, n_attacks);
+  if(plan_only){
+    return 0;
+  }
+
+  if(dedup_mb > 0){
+    long long expected = 0;
+    for(a=0; a<n_attacks; a++){
+      expected += ranges_total(&attacks[a].todo);
+    }
+    dedup = dedup_filter_create(expected, dedup_mb << 20);
+    if(dedup == NULL){
+      fprintf(stderr, "%lldMB is too little for a dedup filter\n", dedup_mb);
+      return 1;
+    }
+  }
+
+  if(report_file != NULL){
+    if(report.interval_ns < 1000000) report.interval_ns = 1000000;
+    report_open(report_file);
+  }
+
+  results = fopen(results_file, "a+");
+  if(results == NULL){
+    perror(results_file);
+    return 1;
+  }
+  if(fgets(header, sizeof(header), results) == NULL){
+    fputs(results_header, results);
+  } else if(strcmp(header, results_header) != 0){
+    // Rows of another layout would be read with the wrong columns
+    fprintf(stderr, "%s has other columns than %s", results_file,
+            results_header);
+    return 1;
+  }
+
+  // A strategy run with a first pass by weight is run again for the rest
+  for(a=0; a<n_attacks && !should_stop(); a += !prioritised){
+    job_t job;
+    int before = atomic_load(&n_remaining);
+    int second_pass = prioritised;
+    const char *pass;
+    double predicted_s, actual_s, predicted_hps, actual_hps, per_candidate;
+
+    prioritised = 0;
+    if(!second_pass){
+      for(i=0; i<n_groups; i++){
+        groups[i].skip_below = 0;
+      }
+    }
+
+    // Re-plan with the targets that are still live when the attack starts
+    build_todo(&attacks[a]);
+    predict(&attacks[a]);
+    per_candidate = seconds_per_candidate();
+    predicted_s = attacks[a].predicted_s;
+
+    memset(&job, 0, sizeof(job));
+    job.attack = &attacks[a];
+    job.todo_prefix = calloc(attacks[a].todo.n + 1, sizeof(long long));
+    for(i=0; i<attacks[a].todo.n; i++){
+      job.todo_prefix[i + 1] = job.todo_prefix[i] +
+                               attacks[a].todo.r[i].end -
+                               attacks[a].todo.r[i].start;
+    }
+    atomic_init(&job.next, 0);
+    atomic_init(&job.tried, 0);
+    pthread_mutex_init(&job.done_lock, NULL);
+    apply_budget(&job);
+    if(job.claim_limit == 0){
+      printf("%s skipped, the guess budget is spent\n", attacks[a].spec);
+      free(job.todo_prefix);
+      continue;
+    }
+    prioritised = !second_pass && apply_priority(&job);
+    pass = prioritised ? "first" : second_pass ? "second" : "single";
+    printf("running %s %s%s%s, predicted %.2fs\n",
+           attack_kind_names[attacks[a].kind],
+           attacks[a].spec,
+           attacks[a].kernel != NULL ? " (specialised kernel)" : "",
+           prioritised ? " (first pass, by weight)" :
+           second_pass ? " (second pass)" : "",
+           predicted_s);
+    if(attacks[a].streamed){
+      job.stream = wordlist_stream_open(attacks[a].spec, n_threads);
+      if(job.stream == NULL) return 1;
+    }
+    if(attacks[a].kind == ATTACK_INCREMENT){
+      init_length_left(&job);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &attack_start);
+    job.start = attack_start;
+    report_job(&job);
+    for(i=0; i<n_threads; i++){
+      args[i].job = &job;
+      args[i].data = data[i];
+      args[i].number = i;
+      pthread_create(&threads[i], NULL, attack_thread, &args[i]);
+    }
+    for(i=0; i<n_threads; i++){
+      pthread_join(threads[i], NULL);
+    }
+    report_job(NULL);
+    actual_s = elapsed_since(&attack_start) / 1.0e9;
+    if(job.stream != NULL){
+      long long bytes, waits;
+      wordlist_stream_stats(job.stream, &bytes, &waits);
+      printf("decompressed %.1fMB at %.1fMB/s, hashing threads waited for "
+             "the decompressor %lld times\n", bytes / 1.0e6,
+             bytes / 1.0e6 / actual_s, waits);
+      wordlist_stream_close(job.stream);
+    }
+    update_coverage(&job);
+    if(prioritised){
+      // The second pass leaves out what each salt searched in the first
+      long long reached = index_at(&job, job.claim_limit);
+      for(i=0; i<n_groups; i++){
+        groups[i].skip_below = groups[i].limit < reached ? groups[i].limit :
+                                                           reached;
+      }
+      if(should_stop()) prioritised = 0;
+    }
+    free(job.todo_prefix);
+    free(job.length_left);
+    free(job.done.r);
+    pthread_mutex_destroy(&job.done_lock);
+
+    // Hash rates count candidates, as a candidate costs one hash per salt
+    predicted_hps = per_candidate > 0 ? 1.0 / per_candidate : 0;
+    actual_hps = actual_s > 0 ? atomic_load(&job.tried) / actual_s : 0;
+    printf("%s finished in %.2fs (predicted %.2fs for all of it), "
+           "%lld/%lld candidates, %d cracked\n", attacks[a].spec, actual_s,
+           predicted_s, (long long)atomic_load(&job.tried),
+           ranges_total(&attacks[a].todo),
+           before - atomic_load(&n_remaining));
+    fprintf(results, "%s,%s,%lld,%d,%.6f,%.6f,%.2f,%.2f,%lld,%d\n",
+            attacks[a].spec, pass, attacks[a].keyspace, n_threads,
+            predicted_s, actual_s, predicted_hps, actual_hps,
+            (long long)atomic_load(&job.tried),
+            before - atomic_load(&n_remaining));
+  }
+  fclose(results);
+  report_close();
+
+  if(atomic_load(&stop_all)){
+    printf("stopped at the deadline\n");
+  }
+  if(budget > 0){
+    long long spent = 0;
+    for(i=0; i<n_groups; i++){
+      spent += atomic_load(&groups[i].hashes);
+    }
+    printf("%lld of %lld guesses spent\n", spent, budget);
+  }
+  if(dedup != NULL){
+    dedup_stats_t stats;
+    long long hashed = 0;
+    dedup_filter_stats(dedup, &stats);
+    for(i=0; i<n_groups; i++){
+      hashed += atomic_load(&groups[i].hashes);
+    }
+    printf("dedup: %.1fMB filter, %lld candidates stored (load %.1f%%), "
+           "%lld not stored as the filter was full\n", stats.bytes / 1048576.0,
+           stats.entries, 100.0 * stats.entries / stats.slots,
+           stats.not_stored);
+    printf("dedup: %lld repeats dropped, saving %lld of %lld hashes (%.2f%%), "
+           "%.2g new candidates expected to be dropped in error\n",
+           stats.repeats, (long long)atomic_load(&hashes_saved),
+           hashed + atomic_load(&hashes_saved),
+           hashed + atomic_load(&hashes_saved) > 0 ?
+           100.0 * atomic_load(&hashes_saved) /
+           (hashed + atomic_load(&hashes_saved)) : 0.0,
+           stats.false_repeats);
+    dedup_filter_destroy(dedup);
+  }
+  printf("\n%-8s %12s  %s\n", "weight", "time_to_crack", "hash");
+  for(i=0; i<n_targets; i++){
+    if(targets[i].cracked_ns > 0){
+      printf("%-8g %11.3fs  %s\n", targets[i].weight,
+             targets[i].cracked_ns / 1.0e9, targets[i].hash);
+    } else {
+      printf("%-8g %12s  %s\n", targets[i].weight,
+             targets[i].cracked ? "earlier run" : "-", targets[i].hash);
+    }
+  }
+  for(i=0; i<n_targets; i++){
+    if(!targets[i].cracked){
+      printf(" %-8s%s %s\n", "", "not found", targets[i].hash);
+    }
+  }
+  print_coverage(stdout, attacks, n_attacks);
+  if(coverage_out != NULL){
+    FILE *f = fopen(coverage_out, "w");
+    if(f == NULL){
+      perror(coverage_out);
+      return 1;
+    }
+    print_coverage(f, attacks, n_attacks);
+    fclose(f);
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &finish);
+  time_difference(&start, &finish, &time_elapsed);
+  printf("Time elapsed was %lldns or %0.9lfs\n", time_elapsed,
+         (time_elapsed/1.0e9));
+  return 0;
+}
@@ -0,0 +1,789 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#include "wordlist_stream.h"
+
+/******************************************************************************
+  The pipeline behind wordlist_stream.h.
+
+    BGZF, zstd frames:
+              reader -> n decode threads -> ordered ring -> splitter -> queue
+    others:   one producer thread that reads, decompresses and splits -> queue
+
+  The reader of the parallel path only hands out whole blocks (BGZF blocks
+  or zstd frames), so the decode threads never wait on each other. Blocks
+  finish in any order; the splitter takes them back in file order from a
+  ring of slots, which also stops the decode threads running too far ahead.
+  zstd frames are far larger than BGZF blocks, so fewer of them are let
+  ahead.
+
+  Compile with the program that uses it, adding -lz (and -DHAVE_ZSTD -lzstd
+  for zstd support).
+******************************************************************************/
+
+#define QUEUE_BATCHES 256
+#define READ_SIZE (1 << 16)
+#define BGZF_BLOCK (1 << 16)       // Largest block, compressed or not
+#define BLOCK_RING 64
+#define MAX_INFLATERS 64
+#define ZSTD_MAX_FRAME (8 << 20)   // Largest zstd frame decoded in parallel
+#define ZSTD_MAX_HEADER 18
+
+enum { FORMAT_PLAIN, FORMAT_GZIP, FORMAT_BGZF, FORMAT_ZSTD,
+       FORMAT_ZSTD_FRAMES };
+
+typedef struct block {
+  long long seq;
+  int ready;
+  int length;
+  unsigned char *out;
+  int capacity;
+} block_t;
+
+struct wordlist_stream {
+  FILE *f;
+  int format;
+  pthread_t producer;
+
+  // Queue of finished batches, between the producer and the hashing threads
+  pthread_mutex_t lock;
+  pthread_cond_t not_empty;
+  pthread_cond_t not_full;
+  word_batch_t *queue[QUEUE_BATCHES];
+  int head;
+  int n_queued;
+  int finished;
+  int stopping;
+  long long bytes;           // Decompressed bytes split so far
+  long long waits;           // Times a hashing thread found the queue empty
+
+  // Splitter state, only touched by the producer
+  word_batch_t *batch;
+  int line_length;
+  int in_cr;                 // Rest of the line after a '\r' is dropped
+  char line[WORDLIST_MAX_WORD];
+  long long n_words;
+
+  // BGZF and zstd frames only
+  int n_inflaters;
+  pthread_t inflaters[MAX_INFLATERS];
+  pthread_mutex_t read_lock;
+  long long next_block;
+  int eof;
+  pthread_mutex_t block_lock;
+  pthread_cond_t block_ready;
+  pthread_cond_t block_free;
+  block_t *ring;
+  int window;                // Blocks let ahead of the splitter
+  long long next_emit;
+  long long n_blocks;        // -1 until the reader reaches the end
+  int failed;
+};
+
+/**
+ Puts a batch on the queue, waiting while it is full. Returns -1 if the
+ stream is being closed, in which case the batch is freed.
+*/
+
+static int push_batch(wordlist_stream_t *stream, word_batch_t *batch){
+  pthread_mutex_lock(&stream->lock);
+  while(stream->n_queued == QUEUE_BATCHES && !stream->stopping){
+    pthread_cond_wait(&stream->not_full, &stream->lock);
+  }
+  if(stream->stopping){
+    pthread_mutex_unlock(&stream->lock);
+    wordlist_batch_free(batch);
+    return -1;
+  }
+  stream->queue[(stream->head + stream->n_queued) % QUEUE_BATCHES] = batch;
+  stream->n_queued++;
+  pthread_cond_signal(&stream->not_empty);
+  pthread_mutex_unlock(&stream->lock);
+  return 0;
+}
+
+static word_batch_t *new_batch(long long first){
+  word_batch_t *batch = malloc(sizeof(word_batch_t));
+  batch->text = malloc(WORDLIST_BATCH * WORDLIST_MAX_WORD);
+  batch->first = first;
+  batch->n = 0;
+  return batch;
+}
+
+static int emit_word(wordlist_stream_t *stream){
+  word_batch_t *batch = stream->batch;
+  char *word = batch->text + batch->n * WORDLIST_MAX_WORD;
+
+  memcpy(word, stream->line, stream->line_length);
+  word[stream->line_length] = '\0';
+  batch->words[batch->n++] = word;
+  stream->n_words++;
+  if(batch->n == WORDLIST_BATCH){
+    stream->batch = new_batch(stream->n_words);
+    return push_batch(stream, batch);
+  }
+  return 0;
+}
+
+/**
+ Splits decompressed text into words. Lines may run across calls. Returns
+ -1 if the stream is being closed.
+*/
+
+static int split_text(wordlist_stream_t *stream, const unsigned char *text,
+                      size_t length){
+  size_t i;
+
+  pthread_mutex_lock(&stream->lock);
+  stream->bytes += length;
+  pthread_mutex_unlock(&stream->lock);
+  for(i=0; i<length; i++){
+    unsigned char c = text[i];
+    if(c == '\n'){
+      if(stream->line_length > 0 && stream->line_length < WORDLIST_MAX_WORD &&
+         emit_word(stream) != 0){
+        return -1;
+      }
+      stream->line_length = 0;
+      stream->in_cr = 0;
+    } else if(c == '\r'){
+      stream->in_cr = 1;
+    } else if(!stream->in_cr){
+      if(stream->line_length < WORDLIST_MAX_WORD){
+        stream->line[stream->line_length] = c;
+      }
+      if(stream->line_length <= WORDLIST_MAX_WORD) stream->line_length++;
+    }
+  }
+  return 0;
+}
+
+/**
+ Handles a last line without a '\n' and queues the last, partly full batch.
+*/
+
+static void finish_text(wordlist_stream_t *stream){
+  if(split_text(stream, (const unsigned char *)"\n", 1) != 0) return;
+  if(stream->batch->n > 0){
+    push_batch(stream, stream->batch);
+  } else {
+    wordlist_batch_free(stream->batch);
+  }
+  stream->batch = NULL;
+}
+
+/**
+ Makes room for length bytes in a buffer. Returns -1 if out of memory.
+*/
+
+static int reserve(unsigned char **buffer, int *capacity, int length){
+  unsigned char *bigger;
+
+  if(length <= *capacity) return 0;
+  bigger = realloc(*buffer, length);
+  if(bigger == NULL) return -1;
+  *buffer = bigger;
+  *capacity = length;
+  return 0;
+}
+
+static void produce_plain(wordlist_stream_t *stream){
+  unsigned char *in = malloc(READ_SIZE);
+  size_t n;
+
+  while((n = fread(in, 1, READ_SIZE, stream->f)) > 0){
+    if(split_text(stream, in, n) != 0) break;
+  }
+  free(in);
+}
+
+/**
+ Inflates a gzip file one member after another.
+*/
+
+static void produce_gzip(wordlist_stream_t *stream){
+  unsigned char *in = malloc(READ_SIZE), *out = malloc(4 * READ_SIZE);
+  z_stream z = {0};
+  int status = Z_OK;
+
+  inflateInit2(&z, 15 + 16);
+  while(1){
+    if(z.avail_in == 0){
+      z.avail_in = fread(in, 1, READ_SIZE, stream->f);
+      z.next_in = in;
+      if(z.avail_in == 0){
+        if(status != Z_STREAM_END){
+          fprintf(stderr, "wordlist: gzip data cut short\n");
+        }
+        break;
+      }
+    }
+    if(status == Z_STREAM_END){
+      // Another member follows
+      inflateReset(&z);
+    }
+    z.next_out = out;
+    z.avail_out = 4 * READ_SIZE;
+    status = inflate(&z, Z_NO_FLUSH);
+    if(status != Z_OK && status != Z_STREAM_END && status != Z_BUF_ERROR){
+      fprintf(stderr, "wordlist: bad gzip data (%s)\n",
+              z.msg != NULL ? z.msg : "inflate failed");
+      break;
+    }
+    if(split_text(stream, out, 4 * READ_SIZE - z.avail_out) != 0) break;
+  }
+  inflateEnd(&z);
+  free(in);
+  free(out);
+}
+
+#ifdef HAVE_ZSTD
+static void produce_zstd(wordlist_stream_t *stream){
+  size_t in_size = ZSTD_DStreamInSize(), out_size = ZSTD_DStreamOutSize();
+  unsigned char *in = malloc(in_size), *out = malloc(out_size);
+  ZSTD_DStream *z = ZSTD_createDStream();
+  size_t n, status = 0;
+
+  ZSTD_initDStream(z);
+  while((n = fread(in, 1, in_size, stream->f)) > 0){
+    ZSTD_inBuffer input = { in, n, 0 };
+    while(input.pos < input.size){
+      ZSTD_outBuffer output = { out, out_size, 0 };
+      status = ZSTD_decompressStream(z, &output, &input);
+      if(ZSTD_isError(status)){
+        fprintf(stderr, "wordlist: bad zstd data (%s)\n",
+                ZSTD_getErrorName(status));
+        goto done;
+      }
+      if(split_text(stream, out, output.pos) != 0) goto done;
+    }
+  }
+  // 0 once a frame is complete, otherwise a hint of the input still needed
+  if(status != 0){
+    fprintf(stderr, "wordlist: zstd data cut short\n");
+  }
+done:
+  ZSTD_freeDStream(z);
+  free(in);
+  free(out);
+}
+
+static unsigned long little_endian(const unsigned char *p, int n){
+  unsigned long value = 0;
+  while(n-- > 0) value = value << 8 | p[n];
+  return value;
+}
+
+/**
+ Size of the header of a zstd frame, from its magic number and frame header
+ descriptor (the first 5 bytes).
+*/
+
+static int frame_header_size(const unsigned char *frame){
+  static const int id_size[] = { 0, 1, 2, 4 };
+  static const int content_size[] = { 0, 2, 4, 8 };
+  int descriptor = frame[4], single = descriptor >> 5 & 1;
+  int size = content_size[descriptor >> 6];
+
+  if(size == 0 && single) size = 1;
+  return 5 + !single + id_size[descriptor & 3] + size;
+}
+
+/**
+ The decompressed size a frame header records, or -1 if it records none or
+ one too large to decode the frame in memory.
+*/
+
+static long long frame_content_size(const unsigned char *header, int size){
+  unsigned long long n = ZSTD_getFrameContentSize(header, size);
+
+  if(n == ZSTD_CONTENTSIZE_UNKNOWN || n == ZSTD_CONTENTSIZE_ERROR ||
+     n > ZSTD_MAX_FRAME){
+    return -1;
+  }
+  return n;
+}
+
+/**
+ Reads the next zstd frame whole, skipping skippable frames such as the
+ seek table of the seekable format. Returns its compressed size, 0 at the
+ end of the file, or -1 if the data is bad or the frame cannot be decoded
+ on its own.
+*/
+
+static int read_frame(FILE *f, unsigned char **frame, int *capacity){
+  unsigned long magic, block;
+  int length, size, last = 0;
+  size_t n;
+
+  if(reserve(frame, capacity, ZSTD_MAX_HEADER) != 0) return -1;
+  while(1){
+    n = fread(*frame, 1, 4, f);
+    if(n == 0) return 0;
+    if(n != 4) return -1;
+    magic = little_endian(*frame, 4);
+    if((magic & ZSTD_MAGIC_SKIPPABLE_MASK) != ZSTD_MAGIC_SKIPPABLE_START){
+      break;
+    }
+    if(fread(*frame, 1, 4, f) != 4 ||
+       fseeko(f, little_endian(*frame, 4), SEEK_CUR) != 0){
+      return -1;
+    }
+  }
+  if(magic != ZSTD_MAGICNUMBER || fread(*frame + 4, 1, 1, f) != 1) return -1;
+  length = frame_header_size(*frame);
+  if(fread(*frame + 5, 1, length - 5, f) != (size_t)(length - 5)) return -1;
+  if(frame_content_size(*frame, length) < 0){
+    fprintf(stderr, "wordlist: a zstd frame does not record a size of at "
+            "most %dMB, as frames decoded in parallel must\n",
+            ZSTD_MAX_FRAME >> 20);
+    return -1;
+  }
+  while(!last){
+    if(reserve(frame, capacity, length + 3) != 0 ||
+       fread(*frame + length, 1, 3, f) != 3){
+      return -1;
+    }
+    block = little_endian(*frame + length, 3);
+    length += 3;
+    last = block & 1;
+    if((block >> 1 & 3) == 3) return -1;          // Reserved block type
+    size = (block >> 1 & 3) == 1 ? 1 : block >> 3; // RLE blocks hold 1 byte
+    if(length + size > 2 * ZSTD_MAX_FRAME ||
+       reserve(frame, capacity, length + size) != 0 ||
+       fread(*frame + length, 1, size, f) != (size_t)size){
+      return -1;
+    }
+    length += size;
+  }
+  if((*frame)[4] & 4){
+    // Content checksum, which ZSTD_decompressDCtx() checks
+    if(reserve(frame, capacity, length + 4) != 0 ||
+       fread(*frame + length, 1, 4, f) != 4){
+      return -1;
+    }
+    length += 4;
+  }
+  return length;
+}
+
+static int decompress_frame(ZSTD_DCtx *z, unsigned char *frame, int length,
+                            block_t *slot){
+  long long size = frame_content_size(frame, frame_header_size(frame));
+  size_t n;
+
+  if(reserve(&slot->out, &slot->capacity, size) != 0) return -1;
+  n = ZSTD_decompressDCtx(z, slot->out, size, frame, length);
+  if(ZSTD_isError(n) || (long long)n != size) return -1;
+  slot->length = n;
+  return 0;
+}
+#endif
+
+/**
+ Reads one BGZF block. Returns its compressed size, 0 at the end of the
+ file, or -1 if the data is not BGZF.
+*/
+
+static int read_block(FILE *f, unsigned char *block){
+  int xlen, bsize, n = fread(block, 1, 12, f);
+
+  if(n == 0) return 0;
+  if(n != 12 || block[0] != 0x1f || block[1] != 0x8b || !(block[3] & 4)){
+    return -1;
+  }
+  xlen = block[10] | block[11] << 8;
+  if(fread(block + 12, 1, xlen, f) != (size_t)xlen || xlen < 6 ||
+     block[12] != 'B' || block[13] != 'C'){
+    return -1;
+  }
+  bsize = (block[16] | block[17] << 8) + 1;
+  if(bsize < 12 + xlen + 8 ||
+     fread(block + 12 + xlen, 1, bsize - 12 - xlen, f) !=
+     (size_t)(bsize - 12 - xlen)){
+    return -1;
+  }
+  return bsize;
+}
+
+static int inflate_block(unsigned char *block, int bsize, block_t *slot){
+  int xlen = block[10] | block[11] << 8;
+  unsigned char *trailer = block + bsize - 8;
+  uLong isize = trailer[4] | trailer[5] << 8 | trailer[6] << 16 |
+                (uLong)trailer[7] << 24;
+  uLong crc = trailer[0] | trailer[1] << 8 | trailer[2] << 16 |
+              (uLong)trailer[3] << 24;
+  z_stream z = {0};
+  int status;
+
+  if(isize > BGZF_BLOCK ||
+     reserve(&slot->out, &slot->capacity, BGZF_BLOCK) != 0){
+    return -1;
+  }
+  inflateInit2(&z, -15);
+  z.next_in = block + 12 + xlen;
+  z.avail_in = bsize - 12 - xlen - 8;
+  z.next_out = slot->out;
+  z.avail_out = BGZF_BLOCK;
+  status = inflate(&z, Z_FINISH);
+  inflateEnd(&z);
+  slot->length = BGZF_BLOCK - z.avail_out;
+  if(status != Z_STREAM_END || (uLong)slot->length != isize ||
+     crc32(crc32(0, NULL, 0), slot->out, slot->length) != crc){
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ Reads the next block of the parallel path into a buffer. Returns as
+ read_block() does.
+*/
+
+static int read_unit(wordlist_stream_t *stream, unsigned char **block,
+                     int *capacity){
+#ifdef HAVE_ZSTD
+  if(stream->format == FORMAT_ZSTD_FRAMES){
+    return read_frame(stream->f, block, capacity);
+  }
+#endif
+  if(reserve(block, capacity, BGZF_BLOCK) != 0) return -1;
+  return read_block(stream->f, *block);
+}
+
+static void *decode_thread(void *arg){
+  wordlist_stream_t *stream = arg;
+  const char *unit = stream->format == FORMAT_BGZF ? "BGZF block"
+                                                   : "zstd frame";
+  unsigned char *block = NULL;
+  long long seq;
+  block_t *slot;
+  int bsize, capacity = 0, bad;
+#ifdef HAVE_ZSTD
+  ZSTD_DCtx *z = stream->format == FORMAT_ZSTD_FRAMES ? ZSTD_createDCtx()
+                                                      : NULL;
+#endif
+
+  while(1){
+    pthread_mutex_lock(&stream->read_lock);
+    if(stream->eof){
+      pthread_mutex_unlock(&stream->read_lock);
+      break;
+    }
+    bsize = read_unit(stream, &block, &capacity);
+    seq = stream->next_block++;
+    if(bsize <= 0){
+      stream->eof = 1;
+      pthread_mutex_lock(&stream->block_lock);
+      stream->n_blocks = seq;
+      if(bsize < 0) stream->failed = 1;
+      pthread_cond_broadcast(&stream->block_ready);
+      pthread_mutex_unlock(&stream->block_lock);
+      pthread_mutex_unlock(&stream->read_lock);
+      break;
+    }
+    pthread_mutex_unlock(&stream->read_lock);
+
+    // Wait for the slot to be given back by the splitter
+    pthread_mutex_lock(&stream->block_lock);
+    while(seq - stream->next_emit >= stream->window && !stream->failed){
+      pthread_cond_wait(&stream->block_free, &stream->block_lock);
+    }
+    bad = stream->failed;
+    pthread_mutex_unlock(&stream->block_lock);
+    if(bad) break;
+
+    slot = &stream->ring[seq % BLOCK_RING];
+#ifdef HAVE_ZSTD
+    bad = z != NULL ? decompress_frame(z, block, bsize, slot)
+                    : inflate_block(block, bsize, slot);
+#else
+    bad = inflate_block(block, bsize, slot);
+#endif
+    if(bad){
+      fprintf(stderr, "wordlist: bad %s %lld\n", unit, seq);
+      slot->length = -1;
+    }
+    pthread_mutex_lock(&stream->block_lock);
+    if(slot->length < 0) stream->failed = 1;
+    slot->seq = seq;
+    slot->ready = 1;
+    pthread_cond_broadcast(&stream->block_ready);
+    pthread_mutex_unlock(&stream->block_lock);
+  }
+#ifdef HAVE_ZSTD
+  ZSTD_freeDCtx(z);
+#endif
+  free(block);
+  return NULL;
+}
+
+static void produce_blocks(wordlist_stream_t *stream){
+  int i, stop = 0;
+
+  stream->ring = calloc(BLOCK_RING, sizeof(block_t));
+  stream->n_blocks = -1;
+  stream->window = BLOCK_RING;
+  if(stream->format == FORMAT_ZSTD_FRAMES &&
+     stream->window > 2 * stream->n_inflaters){
+    stream->window = 2 * stream->n_inflaters;
+  }
+  for(i=0; i<stream->n_inflaters; i++){
+    pthread_create(&stream->inflaters[i], NULL, decode_thread, stream);
+  }
+  while(!stop){
+    block_t *slot = &stream->ring[stream->next_emit % BLOCK_RING];
+
+    pthread_mutex_lock(&stream->block_lock);
+    while(!(slot->ready && slot->seq == stream->next_emit) &&
+          stream->n_blocks != stream->next_emit && !stream->failed){
+      pthread_cond_wait(&stream->block_ready, &stream->block_lock);
+    }
+    if(!(slot->ready && slot->seq == stream->next_emit) || slot->length < 0){
+      pthread_mutex_unlock(&stream->block_lock);
+      break;
+    }
+    pthread_mutex_unlock(&stream->block_lock);
+
+    stop = split_text(stream, slot->out, slot->length) != 0;
+
+    pthread_mutex_lock(&stream->block_lock);
+    slot->ready = 0;
+    stream->next_emit++;
+    if(stop) stream->failed = 1;
+    pthread_cond_broadcast(&stream->block_free);
+    pthread_mutex_unlock(&stream->block_lock);
+  }
+  if(stream->failed && !stop){
+    fprintf(stderr, "wordlist: bad %s data, list cut short\n",
+            stream->format == FORMAT_BGZF ? "BGZF" : "zstd");
+  }
+
+  // Decode threads may be waiting for a slot that will never be freed
+  pthread_mutex_lock(&stream->block_lock);
+  stream->failed = 1;
+  pthread_cond_broadcast(&stream->block_free);
+  pthread_mutex_unlock(&stream->block_lock);
+  for(i=0; i<stream->n_inflaters; i++){
+    pthread_join(stream->inflaters[i], NULL);
+  }
+  for(i=0; i<BLOCK_RING; i++){
+    free(stream->ring[i].out);
+  }
+  free(stream->ring);
+}
+
+static void *producer_thread(void *arg){
+  wordlist_stream_t *stream = arg;
+
+  stream->batch = new_batch(0);
+  switch(stream->format){
+    case FORMAT_BGZF:
+    case FORMAT_ZSTD_FRAMES: produce_blocks(stream); break;
+    case FORMAT_GZIP: produce_gzip(stream); break;
+#ifdef HAVE_ZSTD
+    case FORMAT_ZSTD: produce_zstd(stream); break;
+#endif
+    default: produce_plain(stream); break;
+  }
+  if(stream->batch != NULL){
+    finish_text(stream);
+  }
+  if(stream->batch != NULL){
+    wordlist_batch_free(stream->batch);
+  }
+
+  pthread_mutex_lock(&stream->lock);
+  stream->finished = 1;
+  pthread_cond_broadcast(&stream->not_empty);
+  pthread_mutex_unlock(&stream->lock);
+  return NULL;
+}
+
+static int format_of(FILE *f){
+  unsigned char magic[ZSTD_MAX_HEADER];
+  size_t n = fread(magic, 1, sizeof(magic), f);
+
+  rewind(f);
+  if(n >= 4 && magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f &&
+     magic[3] == 0xfd){
+#ifdef HAVE_ZSTD
+    // A list of frames that record their size, as the seekable format
+    // writes, is decoded in parallel, judging by the first frame
+    if(n >= 5 && (int)n >= frame_header_size(magic) &&
+       frame_content_size(magic, frame_header_size(magic)) >= 0){
+      return FORMAT_ZSTD_FRAMES;
+    }
+#endif
+    return FORMAT_ZSTD;
+  }
+  if(n >= 2 && magic[0] == 0x1f && magic[1] == 0x8b){
+    if(n >= 14 && (magic[3] & 4) && magic[12] == 'B' && magic[13] == 'C'){
+      return FORMAT_BGZF;
+    }
+    return FORMAT_GZIP;
+  }
+  return FORMAT_PLAIN;
+}
+
+int wordlist_is_compressed(const char *filename){
+  FILE *f = fopen(filename, "rb");
+  int format;
+
+  if(f == NULL) return 0;
+  format = format_of(f);
+  fclose(f);
+  return format != FORMAT_PLAIN;
+}
+
+wordlist_stream_t *wordlist_stream_open(const char *filename, int n_threads){
+  wordlist_stream_t *stream;
+  FILE *f = fopen(filename, "rb");
+
+  if(f == NULL){
+    perror(filename);
+    return NULL;
+  }
+  stream = calloc(1, sizeof(wordlist_stream_t));
+  stream->f = f;
+  stream->format = format_of(f);
+#ifndef HAVE_ZSTD
+  if(stream->format == FORMAT_ZSTD){
+    fprintf(stderr, "%s: zstd support not compiled in (-DHAVE_ZSTD -lzstd)\n",
+            filename);
+    fclose(f);
+    free(stream);
+    return NULL;
+  }
+#endif
+  if(n_threads < 1) n_threads = 1;
+  if(n_threads > MAX_INFLATERS) n_threads = MAX_INFLATERS;
+  stream->n_inflaters = n_threads;
+  pthread_mutex_init(&stream->lock, NULL);
+  pthread_cond_init(&stream->not_empty, NULL);
+  pthread_cond_init(&stream->not_full, NULL);
+  pthread_mutex_init(&stream->read_lock, NULL);
+  pthread_mutex_init(&stream->block_lock, NULL);
+  pthread_cond_init(&stream->block_ready, NULL);
+  pthread_cond_init(&stream->block_free, NULL);
+  pthread_create(&stream->producer, NULL, producer_thread, stream);
+  return stream;
+}
+
+word_batch_t *wordlist_stream_next(wordlist_stream_t *stream){
+  word_batch_t *batch = NULL;
+
+  pthread_mutex_lock(&stream->lock);
+  if(stream->n_queued == 0 && !stream->finished) stream->waits++;
+  while(stream->n_queued == 0 && !stream->finished){
+    pthread_cond_wait(&stream->not_empty, &stream->lock);
+  }
+  if(stream->n_queued > 0){
+    batch = stream->queue[stream->head];
+    stream->head = (stream->head + 1) % QUEUE_BATCHES;
+    stream->n_queued--;
+    pthread_cond_signal(&stream->not_full);
+  }
+  pthread_mutex_unlock(&stream->lock);
+  return batch;
+}
+
+void wordlist_batch_free(word_batch_t *batch){
+  free(batch->text);
+  free(batch);
+}
+
+void wordlist_stream_stats(wordlist_stream_t *stream, long long *bytes,
+                           long long *waits){
+  pthread_mutex_lock(&stream->lock);
+  *bytes = stream->bytes;
+  *waits = stream->waits;
+  pthread_mutex_unlock(&stream->lock);
+}
+
+void wordlist_stream_close(wordlist_stream_t *stream){
+  pthread_mutex_lock(&stream->lock);
+  stream->stopping = 1;
+  pthread_cond_broadcast(&stream->not_full);
+  pthread_mutex_unlock(&stream->lock);
+  pthread_join(stream->producer, NULL);
+
+  while(stream->n_queued > 0){
+    wordlist_batch_free(stream->queue[stream->head]);
+    stream->head = (stream->head + 1) % QUEUE_BATCHES;
+    stream->n_queued--;
+  }
+  pthread_mutex_destroy(&stream->lock);
+  pthread_cond_destroy(&stream->not_empty);
+  pthread_cond_destroy(&stream->not_full);
+  pthread_mutex_destroy(&stream->read_lock);
+  pthread_mutex_destroy(&stream->block_lock);
+  pthread_cond_destroy(&stream->block_ready);
+  pthread_cond_destroy(&stream->block_free);
+  fclose(stream->f);
+  free(stream);
+}
+
+/**
+ The count kept for a list, checked against its size and modification
+ time, or -1 if there is none that still holds.
+*/
+
+static long long cached_count(const char *cache_name, const struct stat *st){
+  FILE *f = fopen(cache_name, "r");
+  long long size, seconds, nanoseconds, n;
+  int fields;
+
+  if(f == NULL) return -1;
+  fields = fscanf(f, "%lld %lld %lld %lld", &size, &seconds, &nanoseconds, &n);
+  fclose(f);
+  if(fields != 4 || size != (long long)st->st_size ||
+     seconds != (long long)st->st_mtim.tv_sec ||
+     nanoseconds != (long long)st->st_mtim.tv_nsec || n < 0){
+    return -1;
+  }
+  return n;
+}
+
+long long wordlist_stream_count(const char *filename, int n_threads,
+                                int (*stop)(void *arg), void *arg){
+  char cache_name[4096];
+  wordlist_stream_t *stream;
+  word_batch_t *batch;
+  struct stat st;
+  long long n = 0;
+  int stopped = 0;
+  FILE *cache;
+
+  if(stat(filename, &st) != 0){
+    perror(filename);
+    return -1;
+  }
+  snprintf(cache_name, sizeof(cache_name), "%s.count", filename);
+  if((n = cached_count(cache_name, &st)) >= 0) return n;
+
+  n = 0;
+  stream = wordlist_stream_open(filename, n_threads);
+  if(stream == NULL) return -1;
+  while(!stopped && (batch = wordlist_stream_next(stream)) != NULL){
+    n += batch->n;
+    wordlist_batch_free(batch);
+    stopped = stop != NULL && stop(arg);
+  }
+  wordlist_stream_close(stream);
+
+  // Not being able to keep the count, e.g. in a read only directory, only
+  // means counting again next time
+  if(!stopped && (cache = fopen(cache_name, "w")) != NULL){
+    fprintf(cache, "%lld %lld %lld %lld\n", (long long)st.st_size,
+            (long long)st.st_mtim.tv_sec, (long long)st.st_mtim.tv_nsec, n);
+    if(fclose(cache) != 0) remove(cache_name);
+  }
+  return n;
+}
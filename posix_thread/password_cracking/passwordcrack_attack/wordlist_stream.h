@@ -0,0 +1,94 @@
+#ifndef WORDLIST_STREAM_H
+#define WORDLIST_STREAM_H
+
+/******************************************************************************
+  Reads a compressed wordlist as a stream of word batches, without ever
+  writing the decompressed list to disk or holding all of it in memory.
+
+  Decompression runs in its own pipeline stage. A producer thread
+  decompresses and splits the text into batches of words, which it puts on
+  a bounded queue for the hashing threads to take. When the queue is full
+  the producer waits, so memory use stays at a few batches.
+
+  Formats:
+    gzip    one inflate stream, including files of several gzip members
+    BGZF    gzip made of independent blocks that record their own size
+            (bgzip, samtools). Blocks are inflated in parallel, one block
+            per decompression thread, and put back in order.
+    zstd    when compiled with -DHAVE_ZSTD and linked with -lzstd. A list
+            of frames that each record a size of up to 8MB, such as the
+            seekable format writes (zstd --seekable, t2sz), is decoded in
+            parallel, one frame per decompression thread, and put back in
+            order; its first frame decides. Any other zstd file is
+            decompressed by the producer alone.
+
+  Words are numbered from 0 in file order. Empty lines and lines of
+  WORDLIST_MAX_WORD characters or more are skipped and not numbered, the
+  same as for an uncompressed wordlist.
+******************************************************************************/
+
+#define WORDLIST_MAX_WORD 64
+#define WORDLIST_BATCH 64      // Small, so slow hashes spread over threads
+
+typedef struct wordlist_stream wordlist_stream_t;
+
+typedef struct word_batch {
+  char *text;                // Owns the characters of the words
+  char *words[WORDLIST_BATCH];
+  long long first;           // Number of words[0] in the whole list
+  int n;
+} word_batch_t;
+
+/**
+ True if the file starts with a gzip or zstd magic number.
+*/
+
+int wordlist_is_compressed(const char *filename);
+
+/**
+ Starts the pipeline. n_threads is the number of decompression threads to
+ use for formats that can be decompressed in parallel. Returns NULL, with
+ a message on stderr, if the file cannot be read.
+*/
+
+wordlist_stream_t *wordlist_stream_open(const char *filename, int n_threads);
+
+/**
+ Takes the next batch, waiting for the producer if needed. Returns NULL at
+ the end of the list. Safe to call from several threads.
+*/
+
+word_batch_t *wordlist_stream_next(wordlist_stream_t *stream);
+
+void wordlist_batch_free(word_batch_t *batch);
+
+/**
+ Decompressed bytes so far, and the number of times a caller of
+ wordlist_stream_next() had to wait for the producer. If waits stays near
+ zero, decompression is keeping ahead of hashing.
+*/
+
+void wordlist_stream_stats(wordlist_stream_t *stream, long long *bytes,
+                           long long *waits);
+
+/**
+ Stops the pipeline, even before the end of the list, and frees it. No
+ thread may be inside wordlist_stream_next() at the time.
+*/
+
+void wordlist_stream_close(wordlist_stream_t *stream);
+
+/**
+ Number of words in the list. The first count streams through all of it
+ and is kept in filename.count, next to the list, so that later runs need
+ not decompress the list just to size it; a list of another size or
+ modification time is counted again. stop, if not NULL, is called with arg
+ between batches, and if it returns true the count stops there and the
+ words so far are returned, without being kept. Returns -1, with a
+ message, if the list cannot be read.
+*/
+
+long long wordlist_stream_count(const char *filename, int n_threads,
+                                int (*stop)(void *arg), void *arg);
+
+#endif
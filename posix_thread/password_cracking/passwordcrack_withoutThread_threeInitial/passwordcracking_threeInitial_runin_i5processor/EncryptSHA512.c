@@ -2,17 +2,39 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <crypt.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/random.h>
 
 /******************************************************************************
-  This program is used to set challenges for password cracking programs. 
+  This program is used to set challenges for password cracking programs.
   Encrypts using SHA-512.
-  
+
   Compile with:
-    cc -o EncryptSHA512 EncryptSHA512.c -lcrypt
-    
+    cc -o EncryptSHA512 EncryptSHA512.c -lcrypt -pthread
+
   To encrypt the password "pass":
     ./EncryptSHA512 pass
-    
+
+  A password starting with '-' is taken as is unless it begins like one of
+  the batch options below; "--" before the password always works:
+    ./EncryptSHA512 -- -b
+
+  To encrypt a whole file of passwords, one per line, each with its own
+  random salt (reads stdin when no file is given):
+    ./EncryptSHA512 -b passwords.txt > challenges.txt
+
+  Batch mode options:
+    -t threads   number of hashing threads (default: all online cores)
+    -r rounds    sha512crypt rounds to use (default: 5000, the crypt default)
+    -c ms        calibrate rounds so one verification takes about ms
+                 milliseconds on this machine (overrides -r)
+
+  Output lines are written in the same order as the input lines. A line
+  longer than MAX_LINE - 2 characters stops the run, as it could not be
+  hashed whole without losing that order.
+
   It doesn't do any checking, just does the job or fails ungracefully.
 
   Dr Kevan Buckley, University of Wolverhampton, 2017
@@ -20,9 +42,266 @@
 
 #define SALT "$6$KB$"
 
+#define SALT_LENGTH 16        // Maximum salt length sha512crypt accepts
+#define BATCH_LINES 4096      // Lines hashed between two ordered writes
+#define MAX_LINE 256          // Longest plaintext accepted in batch mode
+#define MAX_THREADS 256
+#define DEFAULT_ROUNDS 5000
+#define MIN_ROUNDS 1000       // Limits enforced by crypt(3) for $6$
+#define MAX_ROUNDS 999999999
+
+static const char salt_chars[] =
+  "./0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+
+typedef struct arguments {
+  char (*plain)[MAX_LINE];   // Plaintexts of the current batch
+  char (*hashed)[CRYPT_OUTPUT_SIZE];
+  int start;                 // First line of the batch for this thread
+  int end;                   // One past the last line for this thread
+  long rounds;
+  struct crypt_data *data;   // Per-thread scratch space for crypt_r
+  unsigned char random[4096];// Buffered output of getrandom()
+  int random_used;
+} arguments_t;
+
+/**
+ Returns one byte from the kernel CSPRNG. getrandom() is called once per
+ 4096 bytes so the cost of the system call is spread over 256 salts.
+*/
+
+unsigned char random_byte(arguments_t *args){
+  if(args->random_used == sizeof(args->random)){
+    size_t filled = 0;
+    while(filled < sizeof(args->random)){
+      ssize_t n = getrandom(args->random + filled,
+                            sizeof(args->random) - filled, 0);
+      if(n < 0){
+        perror("getrandom");
+        exit(1);
+      }
+      filled += n;
+    }
+    args->random_used = 0;
+  }
+  return args->random[args->random_used++];
+}
+
+/**
+ Builds a setting string such as "$6$rounds=20000$<16 random chars>$". The
+ rounds= field is left out when the default is used so that output matches
+ the single password mode.
+*/
+
+void make_setting(arguments_t *args, char *setting){
+  int i;
+  char salt[SALT_LENGTH + 1];
+
+  for(i=0; i<SALT_LENGTH; i++){
+    // 256 is a multiple of 64 so masking keeps the choice uniform
+    salt[i] = salt_chars[random_byte(args) & 63];
+  }
+  salt[SALT_LENGTH] = '\0';
+
+  if(args->rounds == DEFAULT_ROUNDS){
+    sprintf(setting, "$6$%s$", salt);
+  } else {
+    sprintf(setting, "$6$rounds=%ld$%s$", args->rounds, salt);
+  }
+}
+
+void *hash_lines(void *arg){
+  arguments_t *args = arg;
+  char setting[64];
+  char *enc;
+  int i;
+
+  for(i=args->start; i<args->end; i++){
+    make_setting(args, setting);
+    enc = crypt_r(args->plain[i], setting, args->data);
+    if(enc == NULL || enc[0] == '*'){
+      fprintf(stderr, "crypt failed for line \"%s\"\n", args->plain[i]);
+      exit(1);
+    }
+    strcpy(args->hashed[i], enc);
+  }
+  return NULL;
+}
+
+//Calculating time
+
+int time_difference(struct timespec *start, struct timespec *finish,
+                    long long int *difference) {
+  long long int ds =  finish->tv_sec - start->tv_sec;
+  long long int dn =  finish->tv_nsec - start->tv_nsec;
+  if(dn < 0 ) {
+    ds--;
+    dn += 1000000000;
+  }
+  *difference = ds * 1000000000 + dn;
+  return !(*difference > 0);
+}
+
+/**
+ Picks the number of rounds that makes one crypt() take roughly target_ms on
+ this machine. sha512crypt time is linear in rounds, so a single measurement
+ at a known round count is scaled, then checked once and refined.
+*/
+
+long calibrate_rounds(double target_ms){
+  struct crypt_data *data = calloc(1, sizeof(struct crypt_data));
+  struct timespec start, finish;
+  long long int time_elapsed;
+  long rounds = 20000;
+  char setting[64];
+  int pass, i, reps;
+  double per_hash_ms;
+
+  for(pass=0; pass<2; pass++){
+    sprintf(setting, "$6$rounds=%ld$calibration$", rounds);
+    reps = 3;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(i=0; i<reps; i++){
+      crypt_r("calibration", setting, data);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &finish);
+    time_difference(&start, &finish, &time_elapsed);
+    per_hash_ms = time_elapsed / 1.0e6 / reps;
+    rounds = (long)(rounds * (target_ms / per_hash_ms));
+    if(rounds < MIN_ROUNDS) rounds = MIN_ROUNDS;
+    if(rounds > MAX_ROUNDS) rounds = MAX_ROUNDS;
+  }
+  free(data);
+  fprintf(stderr, "calibrated rounds=%ld for %.1fms per verification\n",
+          rounds, target_ms);
+  return rounds;
+}
+
+/**
+ Reads up to BATCH_LINES lines, stripping the line terminator. Returns the
+ number of lines read, 0 at end of input, or -1 if a line is too long.
+ first_line is the number of the first line, for the message.
+*/
+
+int read_batch(FILE *in, char (*plain)[MAX_LINE], long long first_line){
+  int n = 0;
+  size_t length;
+  while(n < BATCH_LINES && fgets(plain[n], MAX_LINE, in) != NULL){
+    // Without a terminator, unless at the end of the input, fgets() has
+    // stopped part way and the rest would come back as lines of their own
+    length = strlen(plain[n]);
+    if(length > 0 && plain[n][length - 1] != '\n' && !feof(in)){
+      fprintf(stderr, "line %lld is longer than %d characters\n",
+              first_line + n, MAX_LINE - 2);
+      return -1;
+    }
+    plain[n][strcspn(plain[n], "\r\n")] = '\0';
+    n++;
+  }
+  return n;
+}
+
+int batch(FILE *in, int n_threads, long rounds){
+  char (*plain)[MAX_LINE] = malloc(sizeof(*plain) * BATCH_LINES);
+  char (*hashed)[CRYPT_OUTPUT_SIZE] = malloc(sizeof(*hashed) * BATCH_LINES);
+  arguments_t *args = calloc(n_threads, sizeof(arguments_t));
+  pthread_t threads[MAX_THREADS];
+  long long total = 0;
+  int n, i, per_thread, failed = 0;
+
+  for(i=0; i<n_threads; i++){
+    args[i].plain = plain;
+    args[i].hashed = hashed;
+    args[i].rounds = rounds;
+    args[i].data = calloc(1, sizeof(struct crypt_data));
+    args[i].random_used = sizeof(args[i].random);
+  }
+
+  while((n = read_batch(in, plain, total + 1)) > 0){
+    // Contiguous slices so that no two threads write the same cache line
+    per_thread = (n + n_threads - 1) / n_threads;
+    for(i=0; i<n_threads; i++){
+      args[i].start = i * per_thread < n ? i * per_thread : n;
+      args[i].end = args[i].start + per_thread < n ?
+                    args[i].start + per_thread : n;
+      pthread_create(&threads[i], NULL, hash_lines, &args[i]);
+    }
+    for(i=0; i<n_threads; i++){
+      pthread_join(threads[i], NULL);
+    }
+    for(i=0; i<n; i++){
+      fputs(hashed[i], stdout);
+      fputc('\n', stdout);
+    }
+    total += n;
+  }
+  if(n < 0) failed = 1;
+  fflush(stdout);
+  fprintf(stderr, "%lld passwords encrypted\n", total);
+
+  for(i=0; i<n_threads; i++){
+    free(args[i].data);
+  }
+  free(args);
+  free(hashed);
+  free(plain);
+  return failed;
+}
+
 int main(int argc, char *argv[]){
-  
-  printf("%s\n", crypt(argv[1], SALT));
+  int opt, failed;
+  int batch_mode = 0;
+  int n_threads = sysconf(_SC_NPROCESSORS_ONLN);
+  long rounds = DEFAULT_ROUNDS;
+  double calibrate_ms = 0;
+  FILE *in = stdin;
+
+  // A lone argument is a password unless it is one of the batch options
+  if(argc == 2 && (argv[1][0] != '-' || argv[1][1] == '\0' ||
+                   strchr("btrc", argv[1][1]) == NULL)){
+    printf("%s\n", crypt(argv[1], SALT));
+    return 0;
+  }
+  if(argc == 3 && strcmp(argv[1], "--") == 0){
+    printf("%s\n", crypt(argv[2], SALT));
+    return 0;
+  }
+
+  while((opt = getopt(argc, argv, "bt:r:c:")) != -1){
+    switch(opt){
+      case 'b': batch_mode = 1; break;
+      case 't': n_threads = atoi(optarg); break;
+      case 'r': rounds = atol(optarg); break;
+      case 'c': calibrate_ms = atof(optarg); break;
+      default:
+        fprintf(stderr, "usage: %s [--] pass | %s -b [-t threads] "
+                "[-r rounds | -c ms] [file]\n", argv[0], argv[0]);
+        return 1;
+    }
+  }
+  if(!batch_mode){
+    fprintf(stderr, "usage: %s [--] pass | %s -b [-t threads] "
+            "[-r rounds | -c ms] [file]\n", argv[0], argv[0]);
+    return 1;
+  }
+  if(n_threads < 1) n_threads = 1;
+  if(n_threads > MAX_THREADS) n_threads = MAX_THREADS;
+  if(rounds < MIN_ROUNDS) rounds = MIN_ROUNDS;
+  if(rounds > MAX_ROUNDS) rounds = MAX_ROUNDS;
+  if(calibrate_ms > 0){
+    rounds = calibrate_rounds(calibrate_ms);
+  }
+  if(optind < argc){
+    in = fopen(argv[optind], "r");
+    if(in == NULL){
+      perror(argv[optind]);
+      return 1;
+    }
+  }
+
+  failed = batch(in, n_threads, rounds);
 
-  return 0;
+  if(in != stdin){
+    fclose(in);
+  }
+  return failed;
 }